@@ -137,6 +137,8 @@ echo "CFLAGS = -DNDEBUG -D__STDC_FORMAT_MACROS -Wall -O2 -Wno-sign-compare" >> b
 echo "CFLAGS += ${PLATFORM_CFLAGS}" >> build_config.mk
 #echo "CFLAGS += -I \"$LEVELDB_PATH/include\"" >> build_config.mk
 echo "CFLAGS += -I \"$ROCKSDB_PATH/include\"" >> build_config.mk
+# replication frames, see BinlogFrame
+echo "CFLAGS += -I \"$SNAPPY_PATH\"" >> build_config.mk
 
 echo "CLIBS=" >> build_config.mk
 #echo "CLIBS += \"$LEVELDB_PATH/libleveldb.a\"" >> build_config.mk
@@ -144,6 +146,17 @@ echo "CLIBS=" >> build_config.mk
 echo "CLIBS += -L \"$ROCKSDB_PATH\"" >> build_config.mk
 echo "CLIBS += \"$SNAPPY_PATH/.libs/libsnappy.a\"" >> build_config.mk
 
+# leveldb.compression: zstd needs rocksdb built with libzstd
+if [ -f /usr/include/zstd.h -o -f /usr/local/include/zstd.h ]; then
+	echo "CLIBS += -lzstd" >> build_config.mk
+fi
+
+# leveldb.table_format: terark needs terark-zip-rocksdb, see set-env.sh
+if [ -n "$PKG_TERARK_HOME" -a -f "$PKG_TERARK_HOME/include/table/terark_zip_table.h" ]; then
+	echo "CFLAGS += -DSSDB_WITH_TERARK -I \"$PKG_TERARK_HOME/include\"" >> build_config.mk
+	echo "CLIBS += -L \"$PKG_TERARK_HOME/lib\" -lterark-zip-rocksdb-r" >> build_config.mk
+fi
+
 case "$TARGET_OS" in
 	CYGWIN*|FreeBSD|OS_ANDROID_CROSSCOMPILE)
 	;;
@@ -11,10 +11,15 @@
 #include "util/log.h"
 #include "util/strings.h"
 
-BackendSync::BackendSync(SSDBImpl *ssdb, int sync_speed){
+// binlogs read in one sync(), and the size of a frame
+#define SYNC_BATCH_MAX		1000
+#define FRAME_SIZE_MAX		(1024 * 1024)
+
+BackendSync::BackendSync(SSDBImpl *ssdb, int sync_speed, bool compress){
     thread_quit = false;
     this->ssdb = ssdb;
     this->sync_speed = sync_speed;
+    this->compress = compress;
 }
 
 BackendSync::~BackendSync(){
@@ -120,7 +125,12 @@ void* BackendSync::_run_thread(void *arg){
 		client.noop();
 	    }else{
 		idle ++;
-		usleep(TICK_INTERVAL_MS * 1000);
+		if(client.status == Client::SYNC){
+		    // woken by the commit of the next binlog
+		    logs->wait(client.last_seq, TICK_INTERVAL_MS);
+		}else{
+		    usleep(TICK_INTERVAL_MS * 1000);
+		}
 	    }
 	}else{
 	    idle = 0;
@@ -155,7 +165,10 @@ BackendSync::Client::Client(const BackendSync *backend){
     last_noop_seq = 0;
     last_key = "";
     is_mirror = false;
+    use_frames = false;
+    use_hmerge = false;
     iter = NULL;
+    reader = NULL;
 }
 
 BackendSync::Client::~Client(){
@@ -163,6 +176,10 @@ BackendSync::Client::~Client(){
 	delete iter;
 	iter = NULL;
     }
+    if(reader){
+	delete reader;
+	reader = NULL;
+    }
 }
 
 std::string BackendSync::Client::stats(){
@@ -211,6 +228,14 @@ void BackendSync::Client::init(){
 	    is_mirror = true;
 	}
     }
+    // what the slave understands, older slaves send none or only frame
+    for(size_t i=4; i<req->size(); i++){
+	if(req->at(i).String() == "frame"){
+	    use_frames = true;
+	}else if(req->at(i).String() == "hmerge"){
+	    use_hmerge = true;
+	}
+    }
 	
     SSDBImpl *ssdb = (SSDBImpl *)backend->ssdb;
     BinlogQueue *logs = ssdb->_binlogs;
@@ -268,12 +293,14 @@ void BackendSync::Client::reset(){
 }
 
 void BackendSync::Client::out_of_sync(){
+    this->flush_frame();
     this->status = Client::OUT_OF_SYNC;
     Binlog noop(this->last_seq, BinlogType::CTRL, BinlogCommand::NONE, "OUT_OF_SYNC");
     link->send(noop.repr());
 }
 
 void BackendSync::Client::noop(){
+    this->flush_frame();
     uint64_t seq;
     if(this->status == Client::COPY && this->last_key.empty()){
 	seq = 0;
@@ -357,26 +384,102 @@ int BackendSync::Client::copy(){
     return 1;
 }
 
-// sync seq and/or binlog
+// sync seq and/or binlogs, up to SYNC_BATCH_MAX of them at once
 int BackendSync::Client::sync(BinlogQueue *logs){
-    Binlog log;
+    if(this->reader == NULL){
+	this->reader = new BinlogReader(logs);
+    }
+    int count = 0;
+    while(count < SYNC_BATCH_MAX && link->output->size() + frame.size() < FRAME_SIZE_MAX){
+	Binlog log;
+	int ret = this->next(logs, &log);
+	if(ret == 0){
+	    break;
+	}
+	count ++;
+	if(ret == 2){
+	    // a noop or out of sync was sent
+	    break;
+	}
+
+	std::string val;
+	switch(log.cmd()){
+	case BinlogCommand::KSET:
+	case BinlogCommand::HSET:
+	    // place del here, once Merge is adopted, maybe worthless
+	case BinlogCommand::HDEL:
+	case BinlogCommand::ZSET:
+	case BinlogCommand::QSET:
+	case BinlogCommand::QPUSH_BACK:
+	case BinlogCommand::QPUSH_FRONT:
+	    ret = backend->ssdb->raw_get(log.key(), &val);
+	    if(ret == -1){
+		log_error("fd: %d, raw_get error!", link->fd());
+	    }else if(ret == 0){
+		//log_debug("%s", hexmem(log.key().data(), log.key().size()).c_str());
+		log_trace("fd: %d, skip not found: %s", link->fd(), log.dumps().c_str());
+	    }else{
+		this->send(log, val);
+	    }
+	    break;
+	case BinlogCommand::HMERGE:
+	    // while copying, the value of the key may already have the operand
+	    // in it, a full value is safe to apply twice, an increment is not.
+	    // a slave that does not know HMERGE gets the full value too
+	    if(this->status == Client::COPY || !this->use_hmerge){
+		ret = backend->ssdb->raw_get(log.key(), &val);
+		if(ret == 1){
+		    Binlog full(log.seq(), log.type(), BinlogCommand::HSET, slice(log.key()));
+		    this->send(full, val);
+		}else if(ret == -1){
+		    log_error("fd: %d, raw_get error!", link->fd());
+		}
+		break;
+	    }
+	    this->send(log);
+	    break;
+	case BinlogCommand::KDEL:
+	    //case BinlogCommand::HDEL:
+	case BinlogCommand::ZDEL:
+	case BinlogCommand::QPOP_BACK:
+	case BinlogCommand::QPOP_FRONT:
+	    this->send(log);
+	    break;
+	case BinlogCommand::NONE:
+	    // barriers, like the end of a bulk load, the slave copies again
+	    if(log.type() == BinlogType::CTRL){
+		this->send(log);
+	    }
+	    break;
+	}
+    }
+    this->flush_frame();
+    return count > 0;
+}
+
+// 1: the binlog after last_seq, 2: a noop or out of sync was sent instead
+int BackendSync::Client::next(BinlogQueue *logs, Binlog *log){
     while(1){
 	int ret = 0;
 	uint64_t expect_seq = this->last_seq + 1;
-	if(this->status == Client::COPY && this->last_seq == 0){
-	    ret = logs->find_last(&log);
+	bool copy_start = this->status == Client::COPY && this->last_seq == 0;
+	if(copy_start){
+	    ret = logs->find_last(log);
 	}else{
-	    ret = logs->find_next(expect_seq, &log);
+	    ret = reader->find_next(expect_seq, log);
 	}
 	if(ret == 0){
 	    return 0;
 	}
-	if(this->status == Client::COPY && log.key() > this->last_key){
+	// a barrier is not a key, the slave gets it even while copying,
+	// unless the copy starts after it
+	bool barrier = log->type() == BinlogType::CTRL && !copy_start;
+	if(this->status == Client::COPY && !barrier && log->key() > this->last_key){
 	    log_debug("fd: %d, last_key: '%s', drop: %s",
 		      link->fd(),
 		      hexmem(this->last_key.data(), this->last_key.size()).c_str(),
-		      log.dumps().c_str());
-	    this->last_seq = log.seq();
+		      log->dumps().c_str());
+	    this->last_seq = log->seq();
 	    // WARN: When there are writes behind last_key, we MUST create
 	    // a new iterator, because iterator will not know this key.
 	    // Because iterator ONLY iterates throught keys written before
@@ -387,63 +490,58 @@ int BackendSync::Client::sync(BinlogQueue *logs){
 	    }
 	    continue;
 	}
-	if(this->last_seq != 0 && log.seq() != expect_seq){
+	if(this->last_seq != 0 && log->seq() != expect_seq){
 	    log_warn("%s:%d fd: %d, OUT_OF_SYNC! log.seq: %" PRIu64 ", expect_seq: %" PRIu64 "",
 		     link->remote_ip, link->remote_port,
 		     link->fd(),
-		     log.seq(),
+		     log->seq(),
 		     expect_seq
 		     );
 	    this->out_of_sync();
-	    return 1;
+	    return 2;
 	}
 	
 	// update last_seq
-	this->last_seq = log.seq();
+	this->last_seq = log->seq();
 
-	char type = log.type();
+	char type = log->type();
 	if(type == BinlogType::MIRROR && this->is_mirror){
 	    if(this->last_seq - this->last_noop_seq >= 1000){
 		this->noop();
-		return 1;
+		return 2;
 	    }else{
 		continue;
 	    }
 	}
-		
-	break;
+	return 1;
     }
+}
 
-    int ret = 0;
-    std::string val;
-    switch(log.cmd()){
-    case BinlogCommand::KSET:
-    case BinlogCommand::HSET:
-	// place del here, once Merge is adopted, maybe worthless
-    case BinlogCommand::HDEL:
-    case BinlogCommand::ZSET:
-    case BinlogCommand::QSET:
-    case BinlogCommand::QPUSH_BACK:
-    case BinlogCommand::QPUSH_FRONT:
-	ret = backend->ssdb->raw_get(log.key(), &val);
-	if(ret == -1){
-	    log_error("fd: %d, raw_get error!", link->fd());
-	}else if(ret == 0){
-	    //log_debug("%s", hexmem(log.key().data(), log.key().size()).c_str());
-	    log_trace("fd: %d, skip not found: %s", link->fd(), log.dumps().c_str());
-	}else{
-	    log_trace("fd: %d, %s", link->fd(), log.dumps().c_str());
-	    link->send(log.repr(), val);
-	}
-	break;
-    case BinlogCommand::KDEL:
-	//case BinlogCommand::HDEL:
-    case BinlogCommand::ZDEL:
-    case BinlogCommand::QPOP_BACK:
-    case BinlogCommand::QPOP_FRONT:
-	log_trace("fd: %d, %s", link->fd(), log.dumps().c_str());
-	link->send(log.repr());
-	break;
+void BackendSync::Client::send(const Binlog &log, const Bytes &val){
+    log_trace("fd: %d, %s", link->fd(), log.dumps().c_str());
+    if(use_frames){
+	frame.add(log, val);
+    }else{
+	link->send(Bytes(log.data(), log.size()), val);
     }
-    return 1;
+}
+
+void BackendSync::Client::send(const Binlog &log){
+    log_trace("fd: %d, %s", link->fd(), log.dumps().c_str());
+    if(use_frames){
+	frame.add(log);
+    }else{
+	link->send(Bytes(log.data(), log.size()));
+    }
+}
+
+// the binlogs collected so far as one message, before anything else is sent
+void BackendSync::Client::flush_frame(){
+    if(frame.count() == 0){
+	return;
+    }
+    std::string codec, payload;
+    frame.encode(backend->compress, &codec, &payload);
+    link->send("frame", codec, payload);
+    frame.clear();
 }
@@ -33,8 +33,9 @@ private:
 	std::map<pthread_t, Client *> workers;
 	SSDBImpl *ssdb;
 	int sync_speed;
+	bool compress;
 public:
-	BackendSync(SSDBImpl *ssdb, int sync_speed);
+	BackendSync(SSDBImpl *ssdb, int sync_speed, bool compress=false);
 	~BackendSync();
 	void proc(const Link *link);
 	
@@ -54,8 +55,14 @@ struct BackendSync::Client{
 	std::string last_key;
 	const BackendSync *backend;
 	bool is_mirror;
+	// the slave takes binlogs in frames, see BinlogFrame
+	bool use_frames;
+	// the slave applies HMERGE operands, others get the full value
+	bool use_hmerge;
 	
 	Iterator *iter;
+	BinlogReader *reader;
+	BinlogFrame frame;
 
 	Client(const BackendSync *backend);
 	~Client();
@@ -64,6 +71,10 @@ struct BackendSync::Client{
 	void noop();
 	int copy();
 	int sync(BinlogQueue *logs);
+	int next(BinlogQueue *logs, Binlog *log);
+	void send(const Binlog &log, const Bytes &val);
+	void send(const Binlog &log);
+	void flush_frame();
 	void out_of_sync();
 
 	std::string stats();
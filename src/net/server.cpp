@@ -25,7 +25,9 @@ static DEF_PROC(del_deny_ip);
 #define TICK_INTERVAL          100 // ms
 #define STATUS_REPORT_TICKS    (300 * 1000/TICK_INTERVAL) // second
 static const int READER_THREADS = 10;
-static const int WRITER_THREADS = 1;  // 必须为1, 因为某些写操作依赖单线程
+// writes lock the keys they touch, so writes on different keys run in
+// parallel and are group committed, server.writers overrides it
+static const int WRITER_THREADS = 8;
 
 volatile bool quit = false;
 volatile uint32_t g_ticks = 0;
@@ -135,6 +137,8 @@ NetworkServer* NetworkServer::init(const Config &conf, int num_readers, int num_
 	}
 	if(num_writers >= 0){
 		serv->num_writers = num_writers;
+	}else if(conf.get_num("server.writers") > 0){
+		serv->num_writers = conf.get_num("server.writers");
 	}
 	
 	{ // server
@@ -156,6 +160,7 @@ NetworkServer* NetworkServer::init(const Config &conf, int num_readers, int num_
 		// so, set server socket nonblock.
 		serv->serv_link->noblock();
 		log_info("server listen on %s:%d", ip, port);
+		log_info("    readers: %d, writers: %d", serv->num_readers, serv->num_writers);
 
 		std::string password;
 		password = conf.get_str("server.auth");
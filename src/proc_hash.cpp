@@ -4,6 +4,7 @@
   found in the LICENSE file.
 */
 /* hash */
+#include <algorithm>
 #include "serv.h"
 #include "net/proc.h"
 #include "net/server.h"
@@ -14,8 +15,7 @@ int proc_hexists(NetworkServer *net, Link *link, const Request &req, Response *r
 
     const Bytes &name = req[1];
     const Bytes &key = req[2];
-    std::string val;
-    int ret = serv->ssdb->hget(name, key, &val);
+    int ret = serv->ssdb->hexists(name, key);
     resp->reply_bool(ret);
     return 0;
 }
@@ -24,14 +24,21 @@ int proc_multi_hexists(NetworkServer *net, Link *link, const Request &req, Respo
     CHECK_NUM_PARAMS(3);
     SSDBServer *serv = (SSDBServer *)net->data;
 
+    // req[1] as a batch of one
+    HashValueBatch batch(1);
+    std::vector<Bytes> names(1, req[1]);
+    if(serv->ssdb->multi_hget_values(names, 0, &batch) == -1){
+	resp->push_back("error");
+	return 0;
+    }
     resp->push_back("ok");
-    const Bytes &name = req[1];
-    std::string val;
+    const HashValueView &view = batch.views[0];
     for(Request::const_iterator it=req.begin()+2; it!=req.end(); it++){
 	const Bytes &key = *it;
-	int64_t ret = serv->ssdb->hget(name, key, &val);
+	int move = ChessHashEncoder::move_id(key);
+	int16_t score;
 	resp->push_back(key.String());
-	if(ret > 0){
+	if(move != -1 && view.find(move, &score) == 1){
 	    resp->push_back("1");
 	}else{
 	    resp->push_back("0");
@@ -44,40 +51,124 @@ int proc_multi_hsize(NetworkServer *net, Link *link, const Request &req, Respons
     CHECK_NUM_PARAMS(2);
     SSDBServer *serv = (SSDBServer *)net->data;
 
+    HashValueBatch batch(req.size() - 1);
+    if(serv->ssdb->multi_hget_values(req, 1, &batch) == -1){
+	resp->push_back("error");
+	return 0;
+    }
     resp->push_back("ok");
-    for(Request::const_iterator it=req.begin()+1; it!=req.end(); it++){
-	const Bytes &key = *it;
-	int64_t ret = serv->ssdb->hsize(key);
-	resp->push_back(key.String());
-	if(ret == -1){
-	    resp->push_back("-1");
-	}else{
-	    resp->add(ret);
+    for(size_t i=0; i<batch.views.size(); i++){
+	resp->push_back(req[i + 1].String());
+	resp->add(batch.views[i].count_live());
+    }
+    return 0;
+}
+
+// reply: key, field count, then field and score pairs, for each key found
+int proc_multi_hgetall(NetworkServer *net, Link *link, const Request &req, Response *resp){
+    CHECK_NUM_PARAMS(2);
+    SSDBServer *serv = (SSDBServer *)net->data;
+
+    HashValueBatch batch(req.size() - 1);
+    if(serv->ssdb->multi_hget_values(req, 1, &batch) == -1){
+	resp->push_back("error");
+	return 0;
+    }
+    resp->push_back("ok");
+    std::string field;
+    for(size_t i=0; i<batch.views.size(); i++){
+	const HashValueView &view = batch.views[i];
+	int live = view.count_live();
+	if(live == 0){
+	    continue;
+	}
+	resp->push_back(req[i + 1].String());
+	resp->add(live);
+	for(int j=0; j<view.count(); j++){
+	    if(view.live(j)){
+		ChessHashEncoder::move_field(view.move(j), &field);
+		resp->push_back(field);
+		resp->add((int)view.score(j));
+	    }
 	}
     }
     return 0;
 }
 
+// v2 entries as field and score pairs
+static void reply_entries(const std::string &entries, Response *resp){
+    std::string field;
+    for(size_t i=0; i<entries.size(); i+=kV2EntryLen){
+	ChessHashEncoder::move_field(ChessHashEncoder::entry_move(&entries[i]), &field);
+	resp->push_back(field);
+	resp->add((int)ChessHashEncoder::entry_score(&entries[i]));
+    }
+}
+
+// hbest key N [asc|desc]: the N best moves, best first, desc by default
+int proc_hbest(NetworkServer *net, Link *link, const Request &req, Response *resp){
+    CHECK_NUM_PARAMS(3);
+    SSDBServer *serv = (SSDBServer *)net->data;
+
+    bool desc = true;
+    if(req.size() > 3){
+	std::string order = req[3].String();
+	strtolower(&order);
+	if(order != "asc" && order != "desc"){
+	    resp->push_back("client_error");
+	    return 0;
+	}
+	desc = (order == "desc");
+    }
+    HashValueBatch batch(1);
+    std::vector<Bytes> names(1, req[1]);
+    if(serv->ssdb->multi_hget_values(names, 0, &batch) == -1){
+	resp->push_back("error");
+	return 0;
+    }
+    resp->push_back("ok");
+    std::string entries;
+    batch.views[0].best(req[2].Int(), desc, &entries);
+    reply_entries(entries, resp);
+    return 0;
+}
+
+// hfilter key min_score max_score: moves scored in [min, max], by move
+int proc_hfilter(NetworkServer *net, Link *link, const Request &req, Response *resp){
+    CHECK_NUM_PARAMS(4);
+    SSDBServer *serv = (SSDBServer *)net->data;
+
+    int lo = req[2].Int();
+    int hi = req[3].Int();
+    // no score an int16 holds is in the range
+    if(lo > 32767 || hi < -32768 || lo > hi){
+	resp->push_back("ok");
+	return 0;
+    }
+    // so neither bound wraps when narrowed
+    lo = std::max(lo, -32768);
+    hi = std::min(hi, 32767);
+    HashValueBatch batch(1);
+    std::vector<Bytes> names(1, req[1]);
+    if(serv->ssdb->multi_hget_values(names, 0, &batch) == -1){
+	resp->push_back("error");
+	return 0;
+    }
+    resp->push_back("ok");
+    std::string entries;
+    batch.views[0].filter(lo, hi, &entries);
+    reply_entries(entries, resp);
+    return 0;
+}
+
 int proc_multi_hset(NetworkServer *net, Link *link, const Request &req, Response *resp){
     SSDBServer *serv = (SSDBServer *)net->data;
     if(req.size() < 4 || req.size() % 2 != 0){
 	resp->push_back("client_error");
     }else{
-	int num = 0;
 	const Bytes &name = req[1];
-	std::vector<Bytes>::const_iterator it = req.begin() + 2;
-	for(; it != req.end(); it += 2){
-	    const Bytes &key = *it;
-	    const Bytes &val = *(it + 1);
-	    int ret = serv->ssdb->hset(name, key, val);
-	    if(ret == -1){
-		resp->push_back("error");
-		return 0;
-	    }else{
-		num += ret;
-	    }
-	}
-	resp->reply_int(0, num);
+	int ret = serv->ssdb->multi_hset(name, req, 2);
+	resp->reply_int(ret, ret);
     }
     return 0;
 }
@@ -86,20 +177,9 @@ int proc_multi_hdel(NetworkServer *net, Link *link, const Request &req, Response
     CHECK_NUM_PARAMS(3);
     SSDBServer *serv = (SSDBServer *)net->data;
 
-    int num = 0;
     const Bytes &name = req[1];
-    std::vector<Bytes>::const_iterator it = req.begin() + 2;
-    for(; it != req.end(); it += 1){
-	const Bytes &key = *it;
-	int ret = serv->ssdb->hdel(name, key);
-	if(ret == -1){
-	    resp->push_back("error");
-	    return 0;
-	}else{
-	    num += ret;
-	}
-    }
-    resp->reply_int(0, num);
+    int ret = serv->ssdb->multi_hdel(name, req, 2);
+    resp->reply_int(ret, ret);
     return 0;
 }
 
@@ -127,15 +207,22 @@ int proc_multi_hget(NetworkServer *net, Link *link, const Request &req, Response
     CHECK_NUM_PARAMS(3);
     SSDBServer *serv = (SSDBServer *)net->data;
 
+    // req[1] as a batch of one
+    HashValueBatch batch(1);
+    std::vector<Bytes> names(1, req[1]);
+    if(serv->ssdb->multi_hget_values(names, 0, &batch) == -1){
+	resp->push_back("error");
+	return 0;
+    }
     resp->push_back("ok");
-    const Bytes name = req[1];
+    const HashValueView &view = batch.views[0];
     for(auto it = req.begin() + 2; it != req.end(); ++it){
 	const Bytes &key = *it;
-	std::string val;
-	int ret = serv->ssdb->hget(name, key, &val);
-	if(ret == 1){
+	int move = ChessHashEncoder::move_id(key);
+	int16_t score;
+	if(move != -1 && view.find(move, &score) == 1){
 	    resp->push_back(key.String());
-	    resp->push_back(val);
+	    resp->add((int)score);
 	}
     }
     return 0;
@@ -290,7 +377,8 @@ int proc_hrlist(NetworkServer *net, Link *link, const Request &req, Response *re
     return 0;
 }
 
-// dir := +1|-1
+// hincr|hdecr name key [by] [blind]: the new score, or only ok if blind,
+// which saves reading it back. dir := +1|-1
 static int _hincr(SSDB *ssdb, const Request &req, Response *resp, int dir){
     CHECK_NUM_PARAMS(3);
 
@@ -298,10 +386,22 @@ static int _hincr(SSDB *ssdb, const Request &req, Response *resp, int dir){
     if(req.size() > 3){
 	by = req[3].Int64();
     }
+    bool blind = false;
+    if(req.size() > 4){
+	std::string mode = req[4].String();
+	strtolower(&mode);
+	if(mode != "blind"){
+	    resp->push_back("client_error");
+	    return 0;
+	}
+	blind = true;
+    }
     int64_t new_val;
-    int ret = ssdb->hincr(req[1], req[2], dir * by, &new_val);
+    int ret = ssdb->hincr(req[1], req[2], dir * by, blind? NULL : &new_val);
     if(ret == 0){
 	resp->reply_status(-1, "value is not an integer or out of range");
+    }else if(blind){
+	resp->reply_status(ret);
     }else{
 	resp->reply_int(ret, new_val);
     }
@@ -55,6 +55,9 @@ DEF_PROC(hexists);
 DEF_PROC(multi_hexists);
 DEF_PROC(multi_hsize);
 DEF_PROC(multi_hget);
+DEF_PROC(multi_hgetall);
+DEF_PROC(hbest);
+DEF_PROC(hfilter);
 DEF_PROC(multi_hset);
 DEF_PROC(multi_hdel);
 DEF_PROC(migrate_hset);
@@ -116,6 +119,8 @@ DEF_PROC(info);
 DEF_PROC(version);
 DEF_PROC(dbsize);
 DEF_PROC(compact);
+DEF_PROC(ingest);
+DEF_PROC(bulkload);
 DEF_PROC(clear_binlog);
 DEF_PROC(flushdb);
 
@@ -180,6 +185,9 @@ void SSDBServer::reg_procs(NetworkServer *net){
     REG_PROC(multi_hexists, "rt");
     REG_PROC(multi_hsize, "rt");
     REG_PROC(multi_hget, "rt");
+    REG_PROC(multi_hgetall, "rt");
+    REG_PROC(hbest, "rt");
+    REG_PROC(hfilter, "rt");
     REG_PROC(multi_hset, "wt");
     REG_PROC(multi_hdel, "wt");
     REG_PROC(migrate_hset, "wt");
@@ -247,6 +255,10 @@ void SSDBServer::reg_procs(NetworkServer *net){
     // doing compaction in a reader thread, because we have only one
     // writer thread(for performance reason); we don't want to block writes
     REG_PROC(compact, "rt");
+    // rocksdb blocks writes only while it assigns the files a seq
+    REG_PROC(ingest, "rt");
+    // end flushes and compacts, for long
+    REG_PROC(bulkload, "rt");
 
     REG_PROC(ignore_key_range, "r");
     REG_PROC(get_key_range, "r");
@@ -270,9 +282,11 @@ SSDBServer::SSDBServer(SSDB *ssdb, SSDB *meta, const Config &conf, NetworkServer
     this->reg_procs(net);
 
     int sync_speed = conf.get_num("replication.sync_speed");
+    // frames of binlogs to slaves compressed with snappy
+    bool sync_compress = (conf.get_str("replication.compress") == std::string("yes"));
 
     backend_dump = new BackendDump(this->ssdb);
-    backend_sync = new BackendSync(this->ssdb, sync_speed);
+    backend_sync = new BackendSync(this->ssdb, sync_speed, sync_compress);
     expiration = new ExpirationHandler(this->ssdb);
 	
     cluster = new Cluster(this->ssdb);
@@ -316,6 +330,9 @@ SSDBServer::SSDBServer(SSDB *ssdb, SSDB *meta, const Config &conf, NetworkServer
 		    slave->set_id(id);
 		}
 		slave->auth = c->get_str("auth");
+		if(c->get_num("workers") > 0){
+		    slave->apply_workers = c->get_num("workers");
+		}
 		slave->start();
 		slaves.push_back(slave);
 	    }
@@ -431,6 +448,46 @@ int proc_compact(NetworkServer *net, Link *link, const Request &req, Response *r
     return 0;
 }
 
+// ingest file [file...]: sst files made by tools/ssdb-ingest, paths on
+// the server
+int proc_ingest(NetworkServer *net, Link *link, const Request &req, Response *resp){
+    CHECK_NUM_PARAMS(2);
+    SSDBServer *serv = (SSDBServer *)net->data;
+    std::vector<std::string> files;
+    for(size_t i=1; i<req.size(); i++){
+	files.push_back(req[i].String());
+    }
+    log_info("ingest %d files, from %s", (int)files.size(), files[0].c_str());
+    int ret = serv->ssdb->ingest(files);
+    if(ret == -1){
+	resp->push_back("error");
+    }else{
+	resp->push_back("ok");
+    }
+    return 0;
+}
+
+// bulkload begin|end
+int proc_bulkload(NetworkServer *net, Link *link, const Request &req, Response *resp){
+    CHECK_NUM_PARAMS(2);
+    SSDBServer *serv = (SSDBServer *)net->data;
+    std::string action = req[1].String();
+    strtolower(&action);
+    if(action != "begin" && action != "end"){
+	resp->push_back("client_error");
+	resp->push_back("usage: bulkload begin|end");
+	return 0;
+    }
+    int ret = serv->ssdb->bulkload(action == "begin");
+    if(ret == -1){
+	resp->push_back("error");
+    }else{
+	resp->push_back("ok");
+	resp->push_back(ret == 1? "1" : "0");
+    }
+    return 0;
+}
+
 int proc_ignore_key_range(NetworkServer *net, Link *link, const Request &req, Response *resp){
     link->ignore_key_range = true;
     resp->push_back("ok");
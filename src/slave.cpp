@@ -8,6 +8,33 @@
 #include "slave.h"
 #include "include.h"
 
+// binlogs queued per worker, more block the receiving thread
+static const size_t WORKER_QUEUE_MAX = 10000;
+
+// a binlog applied twice gives the same data, but for the deltas of
+// hincr and the pushes and pops of queues
+static bool replayable(const Binlog &log){
+    switch(log.cmd()){
+    case BinlogCommand::QPUSH_BACK:
+    case BinlogCommand::QPUSH_FRONT:
+    case BinlogCommand::QPOP_BACK:
+    case BinlogCommand::QPOP_FRONT:
+		return false;
+    case BinlogCommand::HMERGE:{
+		bool delta = false;
+		Bytes val = log.val();
+		ChessHashEncoder::for_each_entry(val.data(), val.size(), [&delta](int move, int score, int op){
+			if(op == kOpAdd){
+				delta = true;
+			}
+		});
+		return !delta;
+    }
+    default:
+		return true;
+    }
+}
+
 Slave::Slave(SSDB *ssdb, SSDB *meta, const char *ip, int port, bool is_mirror){
     thread_quit = false;
     this->ssdb = ssdb;
@@ -35,7 +62,11 @@ Slave::Slave(SSDB *ssdb, SSDB *meta, const char *ip, int port, bool is_mirror){
     this->connect_retry = 0;
 	
     this->copy_count = 0;
-    this->sync_count = 0;
+    this->recv_seq = 0;
+    this->recopying = false;
+    this->apply_workers = 4;
+    this->in_frame = false;
+    this->status_dirty = false;
 }
 
 Slave::~Slave(){
@@ -79,8 +110,10 @@ std::string Slave::stats() const{
     }
 
     s.append("    last_seq   : " + str(last_seq) + "\n");
-    s.append("    copy_count : " + str(copy_count) + "\n");
-    s.append("    sync_count : " + str(sync_count) + "");
+    s.append("    copy_count : " + str(copy_count) + "");
+    for(size_t i=0; i<workers.size(); i++){
+		s.append("\n" + workers[i]->stats());
+    }
     return s;
 }
 
@@ -89,6 +122,10 @@ void Slave::start(){
     load_status();
     log_debug("last_seq: %" PRIu64 ", last_key: %s",
 			  last_seq, hexmem(last_key.data(), last_key.size()).c_str());
+    recv_seq = last_seq;
+    for(int i=0; i<(apply_workers > 0? apply_workers : 1); i++){
+		workers.push_back(new SlaveWorker(this, i));
+    }
 
     thread_quit = false;
     int err = pthread_create(&run_thread_tid, NULL, &Slave::_run_thread, this);
@@ -104,6 +141,12 @@ void Slave::stop(){
     if(err != 0){
 		log_error("can't join thread: %s", strerror(err));
     }
+    this->drain();
+    this->save_status();
+    for(size_t i=0; i<workers.size(); i++){
+		delete workers[i];
+    }
+    workers.clear();
 }
 
 void Slave::set_id(const std::string &id){
@@ -155,7 +198,30 @@ void Slave::load_status(){
     }
 }
 
+// binlogs before the first one a worker has not applied are all applied
+uint64_t Slave::applied_seq(){
+    uint64_t seq = recv_seq;
+    for(size_t i=0; i<workers.size(); i++){
+		uint64_t pending = workers[i]->pending_seq();
+		if(pending != 0 && pending - 1 < seq){
+			seq = pending - 1;
+		}
+    }
+    return seq;
+}
+
+// the seq saved is the low watermark of the workers, the binlogs after
+// it are received again after a crash
 void Slave::save_status(){
+    if(in_frame){
+		status_dirty = true;
+		return;
+    }
+    this->write_status();
+}
+
+void Slave::write_status(){
+    this->last_seq = this->applied_seq();
     std::string seq = str(this->last_seq);
     //meta->hset(status_key(), "last_key", this->last_key);
     //meta->hset(status_key(), "last_seq", seq);
@@ -168,6 +234,9 @@ int Slave::connect(){
     int port = this->master_port;
 	
     if(++connect_retry % 50 == 1){
+		// the master sends again from the last binlog applied
+		this->drain();
+		this->save_status();
 		log_info("[%s][%d] connecting to master at %s:%d...", this->id_.c_str(), (connect_retry-1)/50, ip, port);
 		link = Link::connect(ip, port);
 		if(link == NULL){
@@ -190,7 +259,15 @@ int Slave::connect(){
 				}
 			}
 			
-			link->send("sync140", str(this->last_seq), this->last_key, type);
+			// after the type, what this slave understands
+			std::vector<std::string> packet;
+			packet.push_back("sync140");
+			packet.push_back(str(this->last_seq));
+			packet.push_back(this->last_key);
+			packet.push_back(type);
+			packet.push_back("frame");
+			packet.push_back("hmerge");
+			link->send(packet);
 			if(link->flush() == -1){
 				log_error("[%s] network error", this->id_.c_str());
 				delete link;
@@ -242,6 +319,10 @@ void* Slave::_run_thread(void *arg){
 			sleep(1);
 			continue;
 		}else if(events->empty()){
+			// what the workers applied since
+			if(slave->applied_seq() != slave->last_seq){
+				slave->save_status();
+			}
 			if(idle++ >= MAX_RECV_IDLE){
 				log_error("the master hasn't responsed for awhile, reconnect...");
 				idle = 0;
@@ -274,6 +355,11 @@ void* Slave::_run_thread(void *arg){
 				if(slave->proc(*req) == -1){
 					goto err;
 				}
+				if(slave->recopying){
+					slave->recopying = false;
+					reconnect = true;
+					break;
+				}
 			}
 		}
     } // end while
@@ -286,7 +372,35 @@ void* Slave::_run_thread(void *arg){
     return (void *)NULL;;
 }
 
+// binlogs of a frame, applied in order as if sent one by one
+int Slave::proc_frame(const std::vector<Bytes> &req){
+    if(req.size() != 3){
+		log_error("invalid frame!");
+		return 0;
+    }
+    std::string buf;
+    std::vector<std::vector<Bytes> > records;
+    if(BinlogFrame::decode(req[1], req[2], &buf, &records) == -1){
+		log_error("invalid frame, codec: %s", req[1].String().c_str());
+		return 0;
+    }
+    int ret = 0;
+    in_frame = true;
+    status_dirty = false;
+    for(size_t i=0; i<records.size() && ret != -1 && !recopying; i++){
+		ret = this->proc(records[i]);
+    }
+    in_frame = false;
+    if(status_dirty){
+		this->save_status();
+    }
+    return ret;
+}
+
 int Slave::proc(const std::vector<Bytes> &req){
+    if(req[0] == "frame"){
+		return this->proc_frame(req);
+    }
     Binlog log;
     if(log.load(req[0]) == -1){
 		log_error("invalid binlog!");
@@ -301,9 +415,17 @@ int Slave::proc(const std::vector<Bytes> &req){
 		if(log.key() == "OUT_OF_SYNC"){
 			status = OUT_OF_SYNC;
 			log_error("OUT_OF_SYNC, you must reset this node manually!");
+		}else if(log.key() == "BULKLOAD" || log.key() == "INGEST"){
+			// the writes of the load or the files ingested are not in
+			// the binlog
+			log_error("master %s before seq: %" PRIu64 ", copy again",
+					  log.key().String().c_str(), log.seq());
+			this->recopy();
 		}
 		break;
     case BinlogType::COPY:{
+		// last_key must be of the last binlog applied
+		this->drain();
 		status = COPY;
 		if(req.size() >= 2){
 			log_debug("[%s] %s [%d]", sync_type, log.dumps().c_str(), req[1].size());
@@ -316,16 +438,23 @@ int Slave::proc(const std::vector<Bytes> &req){
     case BinlogType::SYNC:
     case BinlogType::MIRROR:{
 		status = SYNC;
-		if(++sync_count % 1000 == 1){
-			log_info("sync_count: %" PRIu64 ", last_seq: %" PRIu64 ", seq: %" PRIu64 "",
-					 sync_count, this->last_seq, log.seq());
-		}
 		if(req.size() >= 2){
 			log_debug("[%s] %s [%d]", sync_type, log.dumps().c_str(), req[1].size());
 		}else{
 			log_debug("[%s] %s", sync_type, log.dumps().c_str());
 		}
-		this->proc_sync(log, req);
+		if(replayable(log)){
+			this->dispatch(log, req);
+			break;
+		}
+		// applied after all the binlogs before it, and saved at once, so
+		// it is not applied again after a crash
+		this->drain();
+		if(this->apply(log, req) == -1){
+			return -1;
+		}
+		this->recv_seq = log.seq();
+		this->write_status();
 		break;
     }
     default:
@@ -336,14 +465,68 @@ int Slave::proc(const std::vector<Bytes> &req){
 
 int Slave::proc_noop(const Binlog &log, const std::vector<Bytes> &req){
     uint64_t seq = log.seq();
-    if(this->last_seq != seq){
-		log_debug("noop last_seq: %" PRIu64 ", seq: %" PRIu64 "", this->last_seq, seq);
-		this->last_seq = seq;
+    if(this->recv_seq != seq){
+		log_debug("noop last_seq: %" PRIu64 ", seq: %" PRIu64 "", this->recv_seq, seq);
+		this->recv_seq = seq;
 		this->save_status();
     }
     return 0;
 }
 
+// the binlogs of a key, of a zset or of a queue go to the same worker
+void Slave::dispatch(const Binlog &log, const std::vector<Bytes> &req){
+    Bytes key = log.key();
+    std::string name, tmp;
+    uint64_t seq;
+    switch(log.cmd()){
+    case BinlogCommand::ZSET:
+    case BinlogCommand::ZDEL:
+		if(decode_zset_key(key, &name, &tmp) != -1){
+			key = name;
+		}
+		break;
+    case BinlogCommand::QSET:
+    case BinlogCommand::QPUSH_BACK:
+    case BinlogCommand::QPUSH_FRONT:
+		if(decode_qitem_key(key, &name, &seq) != -1){
+			key = name;
+		}
+		break;
+    default:
+		break;
+    }
+    uint32_t h = 2166136261u;
+    for(int i=0; i<key.size(); i++){
+		h = (h ^ (uint8_t)key.data()[i]) * 16777619u;
+    }
+    workers[h % workers.size()]->push(log, req);
+    this->recv_seq = log.seq();
+    this->save_status();
+}
+
+// the master copies all the data again when asked from seq 0, what is
+// received until the reconnect is dropped. The data is cleared first, the
+// copy does not delete the keys gone on the master. Seq 0 is saved before,
+// so a crash while clearing still ends in a copy
+void Slave::recopy(){
+    this->drain();
+    this->status = OUT_OF_SYNC;
+    this->recv_seq = 0;
+    this->last_key = "";
+    this->write_status();
+    log_info("flushdb before copying again...");
+    if(ssdb->flushdb() == -1){
+		log_error("flushdb error, keys gone on the master may be left");
+    }
+    this->recopying = true;
+}
+
+void Slave::drain(){
+    for(size_t i=0; i<workers.size(); i++){
+		workers[i]->drain();
+    }
+}
+
 int Slave::proc_copy(const Binlog &log, const std::vector<Bytes> &req){
     switch(log.cmd()){
     case BinlogCommand::BEGIN:
@@ -374,6 +557,18 @@ int Slave::proc_copy(const Binlog &log, const std::vector<Bytes> &req){
 }
 
 int Slave::proc_sync(const Binlog &log, const std::vector<Bytes> &req){
+    if(this->apply(log, req) == -1){
+		return -1;
+    }
+    this->recv_seq = log.seq();
+    if(log.type() == BinlogType::COPY){
+		this->last_key = log.key().String();
+    }
+    this->save_status();
+    return 0;
+}
+
+int Slave::apply(const Binlog &log, const std::vector<Bytes> &req){
     switch(log.cmd()){
     case BinlogCommand::KSET:
 		{
@@ -420,6 +615,19 @@ int Slave::proc_sync(const Binlog &log, const std::vector<Bytes> &req){
 			}
 		}
 		break;
+    case BinlogCommand::HMERGE:
+		{
+			std::string key;
+			if(_encoder->decode_key(log.key(), &key) == -1){
+				break;
+			}
+			log_trace("hmerge %s",
+					  hexmem(key.data(), key.size()).c_str());
+			if(ssdb->hmerge(key, log.val(), log_type) == -1){
+				return -1;
+			}
+		}
+		break;
     case BinlogCommand::HDEL:
 		{
 			std::string key;
@@ -517,11 +725,105 @@ int Slave::proc_sync(const Binlog &log, const std::vector<Bytes> &req){
 		log_error("unknown binlog, type=%d, cmd=%d", log.type(), log.cmd());
 		break;
     }
-    this->last_seq = log.seq();
-    if(log.type() == BinlogType::COPY){
-		this->last_key = log.key().String();
-    }
-    this->save_status();
     return 0;
 }
 
+/* SlaveWorker */
+
+SlaveWorker::SlaveWorker(Slave *slave, int id){
+    this->slave = slave;
+    this->id = id;
+    this->busy_seq = 0;
+    this->sync_count = 0;
+    this->thread_quit = false;
+    int err = pthread_create(&tid, NULL, &SlaveWorker::_run_thread, this);
+    if(err != 0){
+		log_fatal("can't create thread: %s", strerror(err));
+		exit(0);
+    }
+}
+
+SlaveWorker::~SlaveWorker(){
+    {
+		std::lock_guard<std::mutex> lock(mutex);
+		thread_quit = true;
+    }
+    cv.notify_all();
+    pthread_join(tid, NULL);
+}
+
+void SlaveWorker::push(const Binlog &log, const std::vector<Bytes> &req){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(queue.size() >= WORKER_QUEUE_MAX){
+		cv.wait(lock);
+    }
+    queue.push_back(Item());
+    Item &item = queue.back();
+    item.log = log;
+    item.has_val = req.size() >= 2;
+    if(item.has_val){
+		item.val.assign(req[1].data(), req[1].size());
+    }
+    cv.notify_all();
+}
+
+void SlaveWorker::drain(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!queue.empty() || busy_seq != 0){
+		cv.wait(lock);
+    }
+}
+
+uint64_t SlaveWorker::pending_seq(){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(busy_seq != 0){
+		return busy_seq;
+    }
+    return queue.empty()? 0 : queue.front().log.seq();
+}
+
+std::string SlaveWorker::stats(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return "    worker " + str(id) + "   : sync_count " + str(sync_count) +
+		", queued " + str((uint64_t)queue.size());
+}
+
+void* SlaveWorker::_run_thread(void *arg){
+    SlaveWorker *worker = (SlaveWorker *)arg;
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    while(1){
+		while(worker->queue.empty() && !worker->thread_quit){
+			worker->cv.wait(lock);
+		}
+		if(worker->queue.empty()){
+			break;
+		}
+		Item item;
+		std::swap(item, worker->queue.front());
+		worker->queue.pop_front();
+		worker->busy_seq = item.log.seq();
+		worker->cv.notify_all();
+		lock.unlock();
+
+		std::vector<Bytes> req;
+		req.push_back(Bytes(item.log.data(), item.log.size()));
+		if(item.has_val){
+			req.push_back(Bytes(item.val));
+		}
+		if(worker->slave->apply(item.log, req) == -1){
+			log_fatal("Slave worker %d exit unexpectedly", worker->id);
+			exit(0);
+		}
+
+		lock.lock();
+		worker->busy_seq = 0;
+		if(++worker->sync_count % 1000 == 1){
+			log_info("[worker %d] sync_count: %" PRIu64 ", seq: %" PRIu64 "",
+					 worker->id, worker->sync_count, item.log.seq());
+		}
+		worker->cv.notify_all();
+	}
+    log_debug("SlaveWorker %d quit", worker->id);
+    return (void *)NULL;
+}
+
@@ -9,18 +9,71 @@ found in the LICENSE file.
 #include <stdint.h>
 #include <string>
 #include <pthread.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <vector>
 #include "ssdb/binlog.h"
 #include "ssdb/hash_encoder.h"
 #include "ssdb/ssdb_impl.h"
 #include "net/link.h"
 
+class Slave;
+
+// Applies the sync binlogs of a share of the keys in the order they were
+// received, so the binlogs of a key stay in order while the other keys
+// are applied in parallel. The writes of the workers are group committed
+// by the BinlogQueue, see BinlogQueue::commit().
+class SlaveWorker{
+public:
+	SlaveWorker(Slave *slave, int id);
+	~SlaveWorker();
+	// blocks while the queue is full
+	void push(const Binlog &log, const std::vector<Bytes> &req);
+	// waits for the binlogs pushed to be applied
+	void drain();
+	// the seq of the first binlog not applied yet, 0 if none
+	uint64_t pending_seq();
+	std::string stats();
+
+private:
+	struct Item{
+		Binlog log;
+		std::string val;
+		bool has_val;
+	};
+	Slave *slave;
+	int id;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<Item> queue;
+	// the seq of the binlog being applied, 0 if none
+	uint64_t busy_seq;
+	uint64_t sync_count;
+
+	volatile bool thread_quit;
+	pthread_t tid;
+	static void* _run_thread(void *arg);
+};
+
 class Slave{
 private:
+	friend class SlaveWorker;
+	// the seq up to which the binlogs are applied, as saved
 	uint64_t last_seq;
 	std::string last_key;
 	uint64_t copy_count;
-	uint64_t sync_count;
+	// the seq of the last binlog received
+	uint64_t recv_seq;
+	// sync binlogs are applied by the workers, others in the receiving
+	// thread once the workers are drained
+	std::vector<SlaveWorker *> workers;
+	void dispatch(const Binlog &log, const std::vector<Bytes> &req);
+	void drain();
+	uint64_t applied_seq();
+	// the master wrote data that is not in the binlog, see recopy()
+	bool recopying;
+	void recopy();
 		
 	std::string id_;
 
@@ -46,15 +99,23 @@ private:
 	std::string status_key();
 	void load_status();
 	void save_status();
+	// saves now, even in a frame
+	void write_status();
+	// status is saved once after the binlogs of a frame
+	bool in_frame;
+	bool status_dirty;
 
 	volatile bool thread_quit;
 	pthread_t run_thread_tid;
 	static void* _run_thread(void *arg);
 		
 	int proc(const std::vector<Bytes> &req);
+	int proc_frame(const std::vector<Bytes> &req);
 	int proc_noop(const Binlog &log, const std::vector<Bytes> &req);
 	int proc_copy(const Binlog &log, const std::vector<Bytes> &req);
 	int proc_sync(const Binlog &log, const std::vector<Bytes> &req);
+	// the write of a binlog, -1 on db error
+	int apply(const Binlog &log, const std::vector<Bytes> &req);
 
 	unsigned int connect_retry;
 	int connect();
@@ -63,6 +124,8 @@ private:
 	}
 public:
 	std::string auth;
+	// number of threads applying sync binlogs, set before start()
+	int apply_workers;
 	Slave(SSDB *ssdb, SSDB *meta, const char *ip, int port, bool is_mirror=false);
 	~Slave();
 	void start();
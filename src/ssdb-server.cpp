@@ -52,13 +52,28 @@ void MyApplication::run(){
 	log_info("main_db          : %s", data_db_dir.c_str());
 	log_info("meta_db          : %s", meta_db_dir.c_str());
 	log_info("cache_size       : %d MB", option.cache_size);
+	log_info("position_cache   : %d MB", option.position_cache_size);
 	log_info("block_size       : %d KB", option.block_size);
 	log_info("write_buffer     : %d MB", option.write_buffer_size);
 	log_info("max_open_files   : %d", option.max_open_files);
 	log_info("compaction_speed : %d MB/s", option.compaction_speed);
 	log_info("compression      : %s", option.compression.c_str());
+	if(option.compression == "zstd"){
+		log_info("zstd             : level %d, dict %d bytes, train %d bytes",
+			option.zstd_level, option.zstd_dict_size, option.zstd_train_size);
+	}
+	log_info("profile          : %s", option.profile.c_str());
+	log_info("block_cache      : %s", option.block_cache.c_str());
+	log_info("canonical        : %s", option.canonical.c_str());
+	log_info("table_format     : %s", option.table_format.c_str());
 	log_info("binlog           : %s", option.binlog? "yes" : "no");
 	log_info("binlog_capacity  : %d", option.binlog_capacity);
+	log_info("binlog_backend   : %s", option.binlog_backend.c_str());
+	if(option.binlog_backend == "wal"){
+		log_info("wal              : ttl %d s, limit %d MB", option.wal_ttl, option.wal_size_limit);
+	}
+	log_info("merge_collapse   : %d operands, %d/s", option.collapse_threshold, option.collapse_rate);
+	log_info("group_commit     : %d, wait %d us", option.group_commit_size, option.group_commit_wait);
 	log_info("sync_speed       : %d MB/s", conf->get_num("replication.sync_speed"));
 
 	SSDB *data_db = NULL;
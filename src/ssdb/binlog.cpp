@@ -4,11 +4,17 @@
   found in the LICENSE file.
 */
 #include "binlog.h"
+#include "wal_binlog.h"
 #include "const.h"
 #include "../include.h"
 #include "../util/log.h"
 #include "../util/strings.h"
+#include <algorithm>
+#include "snappy.h"
+#include "rocksdb/convenience.h"
+#include <chrono>
 #include <map>
+#include <memory>
 
 /* Binlog */
 
@@ -19,6 +25,31 @@ Binlog::Binlog(uint64_t seq, char type, char cmd, const rocksdb::Slice &key){
   buf.append(key.data(), key.size());
 }
 
+Binlog::Binlog(uint64_t seq, char type, char cmd, const rocksdb::Slice &key, const rocksdb::Slice &val){
+  uint32_t size = val.size();
+  buf.append((char *)(&seq), sizeof(uint64_t));
+  buf.push_back(type);
+  buf.push_back(cmd);
+  buf.append(key.data(), key.size());
+  buf.append(val.data(), val.size());
+  buf.append((char *)(&size), sizeof(uint32_t));
+}
+
+int Binlog::val_size() const{
+  if(this->cmd() != BinlogCommand::HMERGE){
+    return 0;
+  }
+  uint32_t size;
+  if(buf.size() < HEADER_LEN + sizeof(uint32_t)){
+    return -1;
+  }
+  memcpy(&size, buf.data() + buf.size() - sizeof(uint32_t), sizeof(uint32_t));
+  if(size > buf.size() - HEADER_LEN - sizeof(uint32_t)){
+    return -1;
+  }
+  return (int)size;
+}
+
 uint64_t Binlog::seq() const{
   return *((uint64_t *)(buf.data()));
 }
@@ -31,17 +62,29 @@ char Binlog::cmd() const{
   return buf[sizeof(uint64_t) + 1];
 }
 
-// key after strip seq, type, cmd
+// key after strip seq, type, cmd, and the value if any
 const Bytes Binlog::key() const{
+  int size = this->val_size();
+  if(this->cmd() == BinlogCommand::HMERGE && size >= 0){
+    return Bytes(buf.data() + HEADER_LEN, buf.size() - HEADER_LEN - size - sizeof(uint32_t));
+  }
   return Bytes(buf.data() + HEADER_LEN, buf.size() - HEADER_LEN);
 }
 
+const Bytes Binlog::val() const{
+  int size = this->val_size();
+  if(size <= 0){
+    return Bytes("", 0);
+  }
+  return Bytes(buf.data() + buf.size() - sizeof(uint32_t) - size, size);
+}
+
 int Binlog::load(const Bytes &s){
   if(s.size() < HEADER_LEN){
     return -1;
   }
   buf.assign(s.data(), s.size());
-  return 0;
+  return (this->val_size() == -1)? -1 : 0;
 }
 
 int Binlog::load(const rocksdb::Slice &s){
@@ -49,7 +92,7 @@ int Binlog::load(const rocksdb::Slice &s){
     return -1;
   }
   buf.assign(s.data(), s.size());
-  return 0;
+  return (this->val_size() == -1)? -1 : 0;
 }
 
 int Binlog::load(const std::string &s){
@@ -57,7 +100,7 @@ int Binlog::load(const std::string &s){
     return -1;
   }
   buf.assign(s.data(), s.size());
-  return 0;
+  return (this->val_size() == -1)? -1 : 0;
 }
 
 std::string Binlog::dumps() const{
@@ -104,6 +147,9 @@ std::string Binlog::dumps() const{
   case BinlogCommand::HDEL:
     str.append("hdel ");
     break;
+  case BinlogCommand::HMERGE:
+    str.append("hmerge ");
+    break;
   case BinlogCommand::ZSET:
     str.append("zset ");
     break;
@@ -138,8 +184,173 @@ std::string Binlog::dumps() const{
 }
 
 
+/* BinlogFrame */
+
+void BinlogFrame::append(const Bytes &s){
+  uint32_t size = s.size();
+  buf.append((char *)(&size), sizeof(uint32_t));
+  buf.append(s.data(), s.size());
+}
+
+void BinlogFrame::add(const Binlog &log){
+  buf.push_back(1);
+  this->append(Bytes(log.data(), log.size()));
+  _count ++;
+}
+
+void BinlogFrame::add(const Binlog &log, const Bytes &val){
+  buf.push_back(2);
+  this->append(Bytes(log.data(), log.size()));
+  this->append(val);
+  _count ++;
+}
+
+void BinlogFrame::encode(bool compress, std::string *codec, std::string *payload) const{
+  if(compress){
+    payload->clear();
+    snappy::Compress(buf.data(), buf.size(), payload);
+    if(payload->size() < buf.size()){
+      codec->assign("snappy");
+      return;
+    }
+  }
+  codec->assign("none");
+  payload->assign(buf);
+}
+
+int BinlogFrame::decode(const Bytes &codec, const Bytes &payload, std::string *buf,
+			std::vector<std::vector<Bytes> > *records){
+  if(codec == "snappy"){
+    buf->clear();
+    if(!snappy::Uncompress(payload.data(), payload.size(), buf)){
+      return -1;
+    }
+  }else if(codec == "none"){
+    buf->assign(payload.data(), payload.size());
+  }else{
+    return -1;
+  }
+  records->clear();
+  const char *p = buf->data();
+  const char *end = p + buf->size();
+  while(p < end){
+    int n = *p++;
+    if(n < 1 || n > 2){
+      return -1;
+    }
+    records->push_back(std::vector<Bytes>());
+    for(int i=0; i<n; i++){
+      uint32_t size;
+      if(end - p < (int)sizeof(uint32_t)){
+	return -1;
+      }
+      memcpy(&size, p, sizeof(uint32_t));
+      p += sizeof(uint32_t);
+      if((uint32_t)(end - p) < size){
+	return -1;
+      }
+      records->back().push_back(Bytes(p, size));
+      p += size;
+    }
+  }
+  return 0;
+}
+
 /* SyncLogQueue */
 
+// the transaction being built by this thread
+struct BinlogTransaction{
+  rocksdb::WriteBatch batch;
+  // binlogs without seq yet, see BinlogQueue::commit()
+  std::vector<std::string> logs;
+
+  void clear(){
+    batch.Clear();
+    logs.clear();
+  }
+};
+
+static thread_local BinlogTransaction tls_tran;
+
+// a transaction waiting in the group commit queue
+struct CommitRequest{
+  BinlogTransaction *tran;
+  rocksdb::Status status;
+  bool done;
+};
+
+// replays the batch of a group member into the group's batch
+class BatchAppender : public rocksdb::WriteBatch::Handler{
+ private:
+  rocksdb::WriteBatch *batch;
+  const std::vector<rocksdb::ColumnFamilyHandle*> &handles;
+
+  rocksdb::ColumnFamilyHandle* handle(uint32_t id) const{
+    for(size_t i=0; i<handles.size(); i++){
+      if(handles[i]->GetID() == id){
+	return handles[i];
+      }
+    }
+    return NULL;
+  }
+ public:
+  BatchAppender(rocksdb::WriteBatch *batch,
+		const std::vector<rocksdb::ColumnFamilyHandle*> &handles)
+    : batch(batch), handles(handles){
+  }
+
+  virtual rocksdb::Status PutCF(uint32_t id, const rocksdb::Slice& key,
+				const rocksdb::Slice& value){
+    rocksdb::ColumnFamilyHandle *cf = handle(id);
+    if(!cf){
+      return rocksdb::Status::InvalidArgument("unknown column family");
+    }
+    return batch->Put(cf, key, value);
+  }
+
+  virtual rocksdb::Status DeleteCF(uint32_t id, const rocksdb::Slice& key){
+    rocksdb::ColumnFamilyHandle *cf = handle(id);
+    if(!cf){
+      return rocksdb::Status::InvalidArgument("unknown column family");
+    }
+    return batch->Delete(cf, key);
+  }
+
+  virtual rocksdb::Status MergeCF(uint32_t id, const rocksdb::Slice& key,
+				  const rocksdb::Slice& value){
+    rocksdb::ColumnFamilyHandle *cf = handle(id);
+    if(!cf){
+      return rocksdb::Status::InvalidArgument("unknown column family");
+    }
+    return batch->Merge(cf, key, value);
+  }
+};
+
+// whether a batch writes to one column family only
+class ColumnFamilyCheck : public rocksdb::WriteBatch::Handler{
+ private:
+  uint32_t id;
+ public:
+  bool only;
+
+  ColumnFamilyCheck(uint32_t id) : id(id), only(true){
+  }
+  virtual rocksdb::Status PutCF(uint32_t cf, const rocksdb::Slice& key,
+				const rocksdb::Slice& value){
+    only = only && cf == id;
+    return rocksdb::Status::OK();
+  }
+  virtual rocksdb::Status DeleteCF(uint32_t cf, const rocksdb::Slice& key){
+    only = only && cf == id;
+    return rocksdb::Status::OK();
+  }
+  virtual rocksdb::Status MergeCF(uint32_t cf, const rocksdb::Slice& key,
+				  const rocksdb::Slice& value){
+    only = only && cf == id;
+    return rocksdb::Status::OK();
+  }
+};
+
 static inline std::string encode_seq_key(uint64_t seq){
   seq = big_endian(seq);
   std::string ret;
@@ -158,15 +369,22 @@ static inline uint64_t decode_seq_key(const rocksdb::Slice &key){
 }
 
 BinlogQueue::BinlogQueue(rocksdb::DB *db, std::vector<rocksdb::ColumnFamilyHandle*> handles,
-			 bool enabled, int capacity) {
+			 bool enabled, int capacity, bool wal) {
   this->db = db;
   //this->_write_opts.disableWAL = true;
   this->_cfHandles = handles;
   this->_min_seq = 0;
   this->_last_seq = 0;
-  this->_tran_seq = 0;
   this->_capacity = capacity;
   this->enabled = enabled;
+  this->_bulkload = false;
+  this->_group_max_size = 1;
+  this->_group_max_wait_us = 0;
+  this->_commits = 0;
+  this->_group_writes = 0;
+  this->_wal = NULL;
+  this->_oplog_last = 0;
+  this->_saved_seq = 0;
 	
   Binlog log;
   if(this->find_last(&log) == 1){
@@ -184,9 +402,40 @@ BinlogQueue::BinlogQueue(rocksdb::DB *db, std::vector<rocksdb::ColumnFamilyHandl
   if(this->find_next(this->_min_seq, &log) == 1){
     this->_min_seq = log.seq();
   }
+  if(wal){
+    // binlogs of the oplog backend are read until cleaned, the ones in
+    // the WAL go on from the last of them
+    this->_oplog_last = this->_last_seq;
+    if(this->_last_seq > 0 && this->find_last(&log) == 1){
+      this->_last_log = log.repr();
+    }
+    std::string val;
+    rocksdb::Status s = db->Get(rocksdb::ReadOptions(), _cfHandles[ColumnFamily::OPLOG],
+				WalBinlogs::last_seq_key(), &val);
+    if(s.ok() && val.size() == sizeof(uint64_t)){
+      this->_saved_seq = *((uint64_t *)val.data());
+      this->_last_seq = std::max<uint64_t>(this->_last_seq, this->_saved_seq);
+    }
+    this->_wal = new WalBinlogs(db);
+    uint64_t first;
+    // the saved seq may be behind, the last binlog in the WAL is not
+    if(this->_wal->load(&first, &log) == 1){
+      this->_last_seq = std::max<uint64_t>(this->_last_seq, log.seq());
+      this->_last_log = log.repr();
+    }else{
+      first = this->_last_seq;
+    }
+    if(this->_last_log.empty() && this->_last_seq > 0){
+      // all purged from the WAL
+      this->_last_log = Binlog(this->_last_seq, BinlogType::NOOP, BinlogCommand::NONE, "").repr();
+    }
+    if(this->_oplog_last == 0){
+      this->_min_seq = first;
+    }
+  }
   if(this->enabled){
-    log_info("binlogs capacity: %d, min: %" PRIu64 ", max: %" PRIu64 ",",
-	     this->_capacity, this->_min_seq, this->_last_seq);
+    log_info("binlogs %s, capacity: %d, min: %" PRIu64 ", max: %" PRIu64 ",",
+	     _wal? "in WAL" : "in oplog", this->_capacity, this->_min_seq, (uint64_t)this->_last_seq);
     // 这个方法有性能问题
     // 但是, 如果不执行清理, 如果将 capacity 修改大, 可能会导致主从同步问题
     //this->clean_obsolete_binlogs();
@@ -214,43 +463,162 @@ BinlogQueue::~BinlogQueue(){
       usleep(10 * 1000);
     }
   }
+  if(_wal && db){
+    save_last_seq();
+  }
   Locking l(&this->mutex);
   db = NULL;
+  delete _wal;
 }
 
 std::string BinlogQueue::stats() const{
   std::string s;
+  s.append("    backend  : " + std::string(_wal? "wal" : "oplog") + "\n");
   s.append("    capacity : " + str(_capacity) + "\n");
   s.append("    min_seq  : " + str(_min_seq) + "\n");
-  s.append("    max_seq  : " + str(_last_seq) + "");
+  s.append("    max_seq  : " + str((uint64_t)_last_seq) + "\n");
+  s.append("    commits  : " + str(_commits) + "\n");
+  s.append("    writes   : " + str(_group_writes) + "");
   return s;
 }
 
 void BinlogQueue::begin(){
-  _tran_seq = _last_seq;
-  _batch.Clear();
+  tls_tran.clear();
 }
 
 void BinlogQueue::rollback(){
-  _tran_seq = 0;
+  tls_tran.clear();
 }
 
+void BinlogQueue::set_group_commit(int max_size, int max_wait_us){
+  std::unique_lock<std::mutex> lock(_commit_mutex);
+  _group_max_size = max_size > 1 ? max_size : 1;
+  _group_max_wait_us = max_wait_us > 0 ? max_wait_us : 0;
+}
+
+void BinlogQueue::set_bulkload(bool on){
+  // a commit reads the mode under this mutex
+  Locking l(&this->mutex);
+  _bulkload = on;
+}
+
+// writes of the bulk load are those to the hash column family only
+bool BinlogQueue::bulk_write(const BinlogTransaction *tran) const{
+  if(!tran->logs.empty()){
+    return false;
+  }
+  ColumnFamilyCheck check(_cfHandles[ColumnFamily::HASH]->GetID());
+  return tran->batch.Iterate(&check).ok() && check.only;
+}
+
+// Committing transactions queue up, the one at front() is the leader. It
+// assigns seqs to a group of them and writes the group with one
+// DB::Write, while the others wait to be told the status. The leader
+// leaves the queue only after its write, so groups are written in seq
+// order and a slave never sees a hole.
 rocksdb::Status BinlogQueue::commit(){
-  rocksdb::Status s = db->Write(_write_opts, &_batch);
+  CommitRequest req;
+  req.tran = &tls_tran;
+  req.done = false;
+
+  std::unique_lock<std::mutex> lock(_commit_mutex);
+  _commit_queue.push_back(&req);
+  _commit_cv.notify_all();
+  while(!req.done && _commit_queue.front() != &req){
+    _commit_cv.wait(lock);
+  }
+  if(req.done){
+    tls_tran.clear();
+    return req.status;
+  }
+
+  if(_group_max_wait_us > 0 && _commit_queue.size() < (size_t)_group_max_size){
+    _commit_cv.wait_for(lock, std::chrono::microseconds(_group_max_wait_us), [this]{
+	return _commit_queue.size() >= (size_t)_group_max_size;
+      });
+  }
+  std::vector<CommitRequest*> group(_commit_queue.begin(),
+				    _commit_queue.begin() + std::min(_commit_queue.size(),
+								     (size_t)_group_max_size));
+  lock.unlock();
+
+  // a group of one is written as is, larger ones are replayed into one batch
+  rocksdb::WriteBatch merged;
+  rocksdb::WriteBatch *batch = &req.tran->batch;
+  BatchAppender appender(&merged, _cfHandles);
+  rocksdb::Status s;
+  if(group.size() > 1){
+    batch = &merged;
+  }
+  uint64_t seq = _last_seq;
+  const std::string *last_log = NULL;
+  // the group goes without WAL if all of it is part of a bulk load
+  bool bulk = _bulkload;
+  for(size_t i=0; i<group.size() && s.ok(); i++){
+    BinlogTransaction *tran = group[i]->tran;
+    bulk = bulk && this->bulk_write(tran);
+    if(batch == &merged){
+      s = tran->batch.Iterate(&appender);
+    }
+    for(size_t j=0; j<tran->logs.size(); j++){
+      std::string &log = tran->logs[j];
+      seq ++;
+      memcpy(&log[0], &seq, sizeof(uint64_t));
+      if(_wal){
+	batch->PutLogData(log);
+	last_log = &log;
+      }else{
+	batch->Put(_cfHandles[ColumnFamily::OPLOG], encode_seq_key(seq), log);
+      }
+    }
+  }
+  if(last_log && batch->Count() == 0){
+    // binlogs alone, like a barrier, a batch of no write may not be kept
+    // in the WAL
+    batch->Put(_cfHandles[ColumnFamily::OPLOG], WalBinlogs::last_seq_key(),
+	       rocksdb::Slice((char *)&seq, sizeof(uint64_t)));
+  }
   if(s.ok()){
-    _last_seq = _tran_seq;
-    _tran_seq = 0;
+    Locking l(&this->mutex);
+    rocksdb::SequenceNumber before = _wal? db->GetLatestSequenceNumber() : 0;
+    rocksdb::WriteOptions write_opts = _write_opts;
+    write_opts.disableWAL = bulk && _bulkload;
+    s = db->Write(write_opts, batch);
+    if(s.ok()){
+      if(last_log){
+	_wal->add(_last_seq + 1, before);
+	_last_log = *last_log;
+      }
+      _last_seq = seq;
+    }
+    _commits += group.size();
+    _group_writes ++;
   }
+  if(s.ok()){
+    // the seq is set before, so a reader that missed it is notified
+    { std::lock_guard<std::mutex> l(_tail_mutex); }
+    _tail_cv.notify_all();
+  }
+
+  lock.lock();
+  for(size_t i=0; i<group.size(); i++){
+    _commit_queue.pop_front();
+    group[i]->status = s;
+    group[i]->done = true;
+  }
+  _commit_cv.notify_all();
+  lock.unlock();
+
+  tls_tran.clear();
   return s;
 }
 
 void BinlogQueue::add_log(char type, char cmd, const rocksdb::Slice &key){
-  if(!enabled){
+  if(!enabled || (_bulkload && cf(key) == _cfHandles[ColumnFamily::HASH])){
     return;
   }
-  _tran_seq ++;
-  Binlog log(_tran_seq, type, cmd, key);
-  _batch.Put(_cfHandles[kOplogCFHandle], encode_seq_key(_tran_seq), log.repr());
+  Binlog log(0, type, cmd, key);
+  tls_tran.logs.push_back(log.repr());
 }
 
 void BinlogQueue::add_log(char type, char cmd, const std::string &key){
@@ -261,22 +629,34 @@ void BinlogQueue::add_log(char type, char cmd, const std::string &key){
   this->add_log(type, cmd, s);
 }
 
+void BinlogQueue::add_log(char type, char cmd, const rocksdb::Slice &key, const rocksdb::Slice &val){
+  if(!enabled || (_bulkload && cf(key) == _cfHandles[ColumnFamily::HASH])){
+    return;
+  }
+  Binlog log(0, type, cmd, key, val);
+  tls_tran.logs.push_back(log.repr());
+}
+
 // rocksdb put
 void BinlogQueue::Put(const rocksdb::Slice& key, const rocksdb::Slice& value){
-  _batch.Put(_cfHandles[kDefaultCFHandle], key, value);
+  tls_tran.batch.Put(cf(key), key, value);
 }
 
 // rocksdb merge
 void BinlogQueue::Merge(const rocksdb::Slice& key, const rocksdb::Slice& value) {
-  _batch.Merge(_cfHandles[kDefaultCFHandle], key, value);
+  tls_tran.batch.Merge(cf(key), key, value);
 }
 
 // rocksdb delete
 void BinlogQueue::Delete(const rocksdb::Slice& key){
-  _batch.Delete(_cfHandles[kDefaultCFHandle], key);
+  tls_tran.batch.Delete(cf(key), key);
 }
 	
 int BinlogQueue::find_next(uint64_t next_seq, Binlog *log) const{
+  if(_wal && next_seq > _oplog_last){
+    WalBinlogReader reader(_wal);
+    return reader.find_next(next_seq, log);
+  }
   if(this->get(next_seq, log) == 1){
     return 1;
   }
@@ -284,7 +664,7 @@ int BinlogQueue::find_next(uint64_t next_seq, Binlog *log) const{
   std::string key_str = encode_seq_key(next_seq);
   rocksdb::ReadOptions iterate_options;
   rocksdb::Iterator *it = db->NewIterator(iterate_options,
-					  _cfHandles[kOplogCFHandle]);
+					  _cfHandles[ColumnFamily::OPLOG]);
   it->Seek(key_str);
   if(it->Valid()){
     rocksdb::Slice key = it->key();
@@ -301,12 +681,26 @@ int BinlogQueue::find_next(uint64_t next_seq, Binlog *log) const{
   return ret;
 }
 
+bool BinlogQueue::wait(uint64_t seq, int timeout_ms){
+  std::unique_lock<std::mutex> lock(_tail_mutex);
+  return _tail_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, seq]{
+      return _last_seq > seq;
+    });
+}
+
 int BinlogQueue::find_last(Binlog *log) const{
+  if(_wal){
+    Locking l(const_cast<Mutex*>(&mutex));
+    if(_last_log.empty()){
+      return 0;
+    }
+    return (log->load(_last_log) == -1)? -1 : 1;
+  }
   uint64_t ret = 0;
   std::string key_str = encode_seq_key(UINT64_MAX);
   rocksdb::ReadOptions iterate_options;
   rocksdb::Iterator *it = db->NewIterator(iterate_options,
-					  _cfHandles[kOplogCFHandle]);
+					  _cfHandles[ColumnFamily::OPLOG]);
   it->Seek(key_str);
   if(!it->Valid()){
     // Iterator::prev requires Valid, so we seek to last
@@ -332,7 +726,7 @@ int BinlogQueue::find_last(Binlog *log) const{
 
 int BinlogQueue::get(uint64_t seq, Binlog *log) const{
   std::string val;
-  rocksdb::Status s = db->Get(rocksdb::ReadOptions(), _cfHandles[kOplogCFHandle],
+  rocksdb::Status s = db->Get(rocksdb::ReadOptions(), _cfHandles[ColumnFamily::OPLOG],
 			      encode_seq_key(seq), &val);
   if(s.ok()){
     if(log->load(val) != -1){
@@ -344,7 +738,7 @@ int BinlogQueue::get(uint64_t seq, Binlog *log) const{
 
 int BinlogQueue::update(uint64_t seq, char type, char cmd, const std::string &key){
   Binlog log(seq, type, cmd, key);
-  rocksdb::Status s = db->Put(_write_opts, _cfHandles[kOplogCFHandle],
+  rocksdb::Status s = db->Put(_write_opts, _cfHandles[ColumnFamily::OPLOG],
 			      encode_seq_key(seq), log.repr());
   if(s.ok()){
     return 0;
@@ -353,7 +747,7 @@ int BinlogQueue::update(uint64_t seq, char type, char cmd, const std::string &ke
 }
 
 int BinlogQueue::del(uint64_t seq){
-  rocksdb::Status s = db->Delete(_write_opts, _cfHandles[kOplogCFHandle],
+  rocksdb::Status s = db->Delete(_write_opts, _cfHandles[ColumnFamily::OPLOG],
 				 encode_seq_key(seq));
   if(!s.ok()){
     return -1;
@@ -362,26 +756,64 @@ int BinlogQueue::del(uint64_t seq){
 }
 
 void BinlogQueue::flush(){
-  del_range(this->_min_seq, this->_last_seq);
+  // the WAL is not cleared, only what is left in the oplog
+  del_range(this->_min_seq, _wal? this->_oplog_last : this->_last_seq.load());
 }
 
-// TBD(kg): Del may use DeleteFilesInRange() ?
+// The seq keys are big endian, so [start, end] is one key range: the
+// files wholly in it are dropped, then only the binlogs left, in the
+// memtables and the files across the ends, get point deletes. No range
+// tombstone, the tailing iterators of BinlogReader do not support them.
+// Not under the mutex, commit() does not wait for the trim.
 int BinlogQueue::del_range(uint64_t start, uint64_t end){
-  while(start <= end){
+  if(start > end){
+    return 0;
+  }
+  rocksdb::DB *db;
+  {
+    Locking l(&this->mutex);
+    db = this->db;
+  }
+  if(!db){
+    return -1;
+  }
+  rocksdb::ColumnFamilyHandle *cf = _cfHandles[ColumnFamily::OPLOG];
+  std::string begin_key = encode_seq_key(start);
+  std::string end_key = encode_seq_key(end);
+  rocksdb::Slice begin_slice(begin_key), end_slice(end_key);
+  rocksdb::Status s = rocksdb::DeleteFilesInRange(db, cf, &begin_slice, &end_slice);
+  if(!s.ok()){
+    log_error("delete binlog files error: %s", s.ToString().c_str());
+  }
+
+  rocksdb::ReadOptions read_opts;
+  read_opts.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(read_opts, cf));
+  it->Seek(begin_slice);
+  bool more = true;
+  while(more){
     rocksdb::WriteBatch batch;
-    for(int count = 0; start <= end && count < 1000; start++, count++){
-      batch.Delete(_cfHandles[kOplogCFHandle], encode_seq_key(start));
+    for(int count = 0; count < 1000; count++, it->Next()){
+      uint64_t seq = it->Valid()? decode_seq_key(it->key()) : 0;
+      if(seq == 0 || seq > end){
+	more = false;
+	break;
+      }
+      batch.Delete(cf, it->key());
     }
-		
-    Locking l(&this->mutex);
-    if(!this->db){
-      return -1;
+    if(batch.Count() == 0){
+      break;
     }
-    rocksdb::Status s = this->db->Write(_write_opts, &batch);
+    s = db->Write(_write_opts, &batch);
     if(!s.ok()){
+      log_error("delete binlogs error: %s", s.ToString().c_str());
       return -1;
     }
   }
+  if(!it->status().ok()){
+    log_error("delete binlogs error: %s", it->status().ToString().c_str());
+    return -1;
+  }
   return 0;
 }
 
@@ -392,6 +824,13 @@ void* BinlogQueue::log_clean_thread_func(void *arg){
     if(!logs->db){
       break;
     }
+    if(logs->_wal){
+      logs->clean_wal();
+      for(int i=0; i<200 && !logs->thread_quit; i++){
+	usleep(50 * 1000);
+      }
+      continue;
+    }
     assert(logs->_last_seq >= logs->_min_seq);
 
     if(logs->_last_seq - logs->_min_seq < logs->_capacity + 10000){
@@ -404,7 +843,7 @@ void* BinlogQueue::log_clean_thread_func(void *arg){
     logs->del_range(start, end);
     logs->_min_seq = end + 1;
     log_info("clean %d logs[%" PRIu64 " ~ %" PRIu64 "], %d left, max: %" PRIu64 "",
-	     end-start+1, start, end, logs->_last_seq - logs->_min_seq + 1, logs->_last_seq);
+	     end-start+1, start, end, logs->_last_seq - logs->_min_seq + 1, (uint64_t)logs->_last_seq);
   }
   log_debug("binlog clean_thread quit");
 	
@@ -412,13 +851,140 @@ void* BinlogQueue::log_clean_thread_func(void *arg){
   return (void *)NULL;
 }
 
+// rocksdb purges the WAL by WAL_ttl_seconds and WAL_size_limit_MB, so
+// only the oplog binlogs from before the switch are deleted here
+void BinlogQueue::save_last_seq(){
+  uint64_t seq = _last_seq;
+  if(seq == _saved_seq){
+    return;
+  }
+  rocksdb::Status s = db->Put(_write_opts, _cfHandles[ColumnFamily::OPLOG],
+			      WalBinlogs::last_seq_key(),
+			      rocksdb::Slice((char *)&seq, sizeof(uint64_t)));
+  if(!s.ok()){
+    log_error("save last seq error: %s", s.ToString().c_str());
+    return;
+  }
+  _saved_seq = seq;
+}
+
+void BinlogQueue::clean_wal(){
+  // well before the WAL files with the binlogs up to it are purged
+  save_last_seq();
+  if(_min_seq <= _oplog_last){
+    if(_last_seq - _min_seq < _capacity + 10000){
+      return;
+    }
+    uint64_t start = _min_seq;
+    uint64_t end = std::min<uint64_t>(_oplog_last, _last_seq - _capacity);
+    del_range(start, end);
+    _min_seq = end + 1;
+    log_info("clean %d oplog binlogs[%" PRIu64 " ~ %" PRIu64 "]", end-start+1, start, end);
+    return;
+  }
+  // 0 if the first batches have no binlog, not that there is none: the
+  // min stays, a slave behind a purged binlog gets a later one instead
+  // and is found out of sync by BackendSync
+  uint64_t first = _wal->trim();
+  if(first > _min_seq){
+    _min_seq = first;
+  }
+}
+
+/* Transaction */
+
+Transaction::Transaction(BinlogQueue *logs){
+  this->logs = logs;
+  for(int i=0; i<logs->key_locks.size(); i++){
+    stripes.push_back(i);
+  }
+  this->lock();
+}
+
+Transaction::Transaction(BinlogQueue *logs, const Bytes &key){
+  this->logs = logs;
+  stripes.push_back(logs->key_locks.stripe(key.data(), key.size()));
+  this->lock();
+}
+
+Transaction::Transaction(BinlogQueue *logs, const std::vector<std::string> &keys){
+  this->logs = logs;
+  for(size_t i=0; i<keys.size(); i++){
+    stripes.push_back(logs->key_locks.stripe(keys[i].data(), keys[i].size()));
+  }
+  this->lock();
+}
+
+// ascending and once per stripe, so two transactions never deadlock
+void Transaction::lock(){
+  std::sort(stripes.begin(), stripes.end());
+  stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+  for(size_t i=0; i<stripes.size(); i++){
+    logs->key_locks.lock(stripes[i]);
+  }
+  logs->begin();
+}
+
+Transaction::~Transaction(){
+  // it is safe to call rollback after commit
+  logs->rollback();
+  for(size_t i=stripes.size(); i>0; i--){
+    logs->key_locks.unlock(stripes[i - 1]);
+  }
+}
+
+BinlogReader::BinlogReader(const BinlogQueue *logs){
+  this->logs = logs;
+  this->wal = logs->_wal? new WalBinlogReader(logs->_wal) : NULL;
+  this->it = this->new_iterator();
+}
+
+rocksdb::Iterator* BinlogReader::new_iterator() const{
+  rocksdb::ReadOptions options;
+  options.tailing = true;
+  options.fill_cache = false;
+  return logs->db->NewIterator(options, logs->_cfHandles[ColumnFamily::OPLOG]);
+}
+
+BinlogReader::~BinlogReader(){
+  delete it;
+  delete wal;
+}
+
+// the binlog after the last one read is usually next, seeks otherwise,
+// so a binlog committed after the iterator passed its place is found
+int BinlogReader::find_next(uint64_t seq, Binlog *log){
+  if(wal && seq > logs->_oplog_last){
+    return wal->find_next(seq, log);
+  }
+  if(!it->Valid() || decode_seq_key(it->key()) != seq){
+    it->Seek(encode_seq_key(seq));
+  }
+  if(!it->status().ok()){
+    // a broken iterator never becomes valid again
+    log_error("binlog reader error: %s", it->status().ToString().c_str());
+    delete it;
+    it = this->new_iterator();
+    it->Seek(encode_seq_key(seq));
+    if(!it->status().ok()){
+      return 0;
+    }
+  }
+  if(!it->Valid() || decode_seq_key(it->key()) == 0){
+    return 0;
+  }
+  int ret = (log->load(it->value()) == -1)? -1 : 1;
+  it->Next();
+  return ret;
+}
+
 // 因为老版本可能产生了断续的binlog
 // 例如, binlog-1 存在, 但后面的被删除了, 然后到 binlog-100000 时又开始存在.
 void BinlogQueue::clean_obsolete_binlogs(){
   std::string key_str = encode_seq_key(this->_min_seq);
   rocksdb::ReadOptions iterate_options;
   rocksdb::Iterator *it = db->NewIterator(iterate_options,
-					  _cfHandles[kOplogCFHandle]);
+					  _cfHandles[ColumnFamily::OPLOG]);
   it->Seek(key_str);
   if(it->Valid()){
     it->Prev();
@@ -454,7 +1020,8 @@ void BinlogQueue::merge(){
   for(; start <= end; start++){
     Binlog log;
     if(this->get(start, &log) == 1){
-      if(log.type() == BinlogType::NOOP){
+      // operands are not replaced by a later one of the key
+      if(log.type() == BinlogType::NOOP || log.cmd() == BinlogCommand::HMERGE){
 	continue;
       }
       std::string key = log.key().String();
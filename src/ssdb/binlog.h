@@ -6,7 +6,12 @@
 #ifndef SSDB_BINLOG_H_
 #define SSDB_BINLOG_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "rocksdb/db.h"
 #include "rocksdb/options.h"
 #include "rocksdb/slice.h"
@@ -14,15 +19,20 @@
 #include "rocksdb/write_batch.h"
 #include "../util/thread.h"
 #include "../util/bytes.h"
+#include "const.h"
 
 
 class Binlog{
  private:
     std::string buf;
     static const unsigned int HEADER_LEN = sizeof(uint64_t) + 2;
+    // size of the value after the key, -1 if the record is malformed
+    int val_size() const;
  public:
     Binlog(){}
     Binlog(uint64_t seq, char type, char cmd, const rocksdb::Slice &key);
+    // a record with a value, [key][val][uint32 size of val]
+    Binlog(uint64_t seq, char type, char cmd, const rocksdb::Slice &key, const rocksdb::Slice &val);
 		
     int load(const Bytes &s);
     int load(const rocksdb::Slice &s);
@@ -32,6 +42,8 @@ class Binlog{
     char type() const;
     char cmd() const;
     const Bytes key() const;
+    // the value of an HMERGE record, empty for the others
+    const Bytes val() const;
 
     const char* data() const{
 	return buf.data();
@@ -45,21 +57,68 @@ class Binlog{
     std::string dumps() const;
 };
 
+// Binlogs sent to a slave as one message: "frame", codec, payload. The
+// payload is records of [uint8 n][uint32 size][data]..., n blocks each,
+// the binlog and its value if any, compressed if the codec is snappy.
+class BinlogFrame{
+ private:
+    std::string buf;
+    int _count;
+    void append(const Bytes &s);
+ public:
+    BinlogFrame() : _count(0){}
+    void add(const Binlog &log);
+    void add(const Binlog &log, const Bytes &val);
+    void clear(){
+	buf.clear();
+	_count = 0;
+    }
+    int count() const{
+	return _count;
+    }
+    int size() const{
+	return (int)buf.size();
+    }
+    // codec is "snappy" if compress and it made the payload smaller,
+    // "none" otherwise
+    void encode(bool compress, std::string *codec, std::string *payload) const;
+    // records point into *buf, -1 if malformed
+    static int decode(const Bytes &codec, const Bytes &payload, std::string *buf,
+		      std::vector<std::vector<Bytes> > *records);
+};
+
+struct CommitRequest;
+struct BinlogTransaction;
+class BinlogReader;
+class WalBinlogs;
+class WalBinlogReader;
+
 // circular queue
 class BinlogQueue{
  private:
+    friend class BinlogReader;
     rocksdb::DB *db;
     rocksdb::WriteOptions _write_opts;
     uint64_t _min_seq;
-    uint64_t _last_seq;
-    uint64_t _tran_seq;
+    // written by the commit leader, read by wait() and the sync clients
+    // without the mutex
+    std::atomic<uint64_t> _last_seq;
     int _capacity;
+    // indexed by ColumnFamily
     std::vector<rocksdb::ColumnFamilyHandle*> _cfHandles;
-    enum {
-	kDefaultCFHandle = 0,
-	kOplogCFHandle = 1
-    };
-    rocksdb::WriteBatch _batch;
+
+    // group commit, see commit()
+    std::mutex _commit_mutex;
+    std::condition_variable _commit_cv;
+    std::deque<CommitRequest*> _commit_queue;
+    int _group_max_size;
+    int _group_max_wait_us;
+    uint64_t _commits;
+    uint64_t _group_writes;
+
+    // readers waiting for a commit, see wait()
+    std::mutex _tail_mutex;
+    std::condition_variable _tail_cv;
 
     volatile bool thread_quit;
     static void* log_clean_thread_func(void *arg);
@@ -70,16 +129,48 @@ class BinlogQueue{
     void clean_obsolete_binlogs();
     void merge();
     bool enabled;
+    // hash writes skip the WAL and the binlog, see set_bulkload()
+    volatile bool _bulkload;
+    bool bulk_write(const BinlogTransaction *tran) const;
+
+    // binlogs are in the WAL instead of the oplog column family if set,
+    // but for the ones up to _oplog_last, written before the switch
+    WalBinlogs *_wal;
+    uint64_t _oplog_last;
+    // the last binlog written to the WAL, for find_last()
+    std::string _last_log;
+    // the seq last saved by save_last_seq()
+    uint64_t _saved_seq;
+    void clean_wal();
 
  public:
+    // guards seq assignment and the write of a commit
     Mutex mutex;
+    // writers lock the stripes of the keys they touch
+    StripedMutex key_locks;
 
     BinlogQueue(rocksdb::DB *db, std::vector<rocksdb::ColumnFamilyHandle*> handles,
-		bool enabled=true, int capacity=20000000);
+		bool enabled=true, int capacity=20000000, bool wal=false);
     ~BinlogQueue();
+    // the batch being built is per thread, so writers on different keys
+    // prepare theirs concurrently, only commit() is serialized
     void begin();
     void rollback();
     rocksdb::Status commit();
+    // commits of up to max_size transactions are written at once, the
+    // leader waits up to max_wait_us for the group to fill, 0 not to wait
+    void set_group_commit(int max_size, int max_wait_us);
+    // hash writes of a bulk load go without WAL and without binlog, so
+    // they are lost on a crash and never synced, the writes to the other
+    // column families go on as usual
+    void set_bulkload(bool on);
+    bool bulkload() const{
+	return _bulkload;
+    }
+    // the column family of a data key
+    rocksdb::ColumnFamilyHandle* cf(const rocksdb::Slice& key) const{
+	return _cfHandles[key.empty()? ColumnFamily::DEFAULT : ColumnFamily::of(key[0])];
+    }
     // rocksdb put
     void Put(const rocksdb::Slice& key, const rocksdb::Slice& value);
     // rocksdb merge
@@ -89,11 +180,16 @@ class BinlogQueue{
     
     void add_log(char type, char cmd, const rocksdb::Slice &key);
     void add_log(char type, char cmd, const std::string &key);
+    // the binlog carries val, so it is synced without a read of the key
+    void add_log(char type, char cmd, const rocksdb::Slice &key, const rocksdb::Slice &val);
 		
     int get(uint64_t seq, Binlog *log) const;
     int update(uint64_t seq, char type, char cmd, const std::string &key);
 		
     void flush();
+    // saves the last seq in the oplog for when the WAL is all purged, by
+    // the clean thread and at close, not with every commit
+    void save_last_seq();
 		
     /** @returns
 	1 : log.seq greater than or equal to seq
@@ -102,6 +198,9 @@ class BinlogQueue{
     */
     int find_next(uint64_t seq, Binlog *log) const;
     int find_last(Binlog *log) const;
+    // waits up to timeout_ms for a binlog after seq to be committed,
+    // false on timeout
+    bool wait(uint64_t seq, int timeout_ms);
 	
     uint64_t min_seq() const{
 	return _min_seq;
@@ -109,25 +208,43 @@ class BinlogQueue{
     uint64_t max_seq() const{
 	return _last_seq;
     }
+    // as saved by save_last_seq(), 0 if never
+    uint64_t saved_seq() const{
+	return _saved_seq;
+    }
 		
     std::string stats() const;
 };
 
+// Reads binlogs in seq order with a tailing iterator on the oplog, it
+// sees later commits without being created again as find_next() does.
+// With the WAL backend it reads the WAL batch after batch instead.
+class BinlogReader{
+ private:
+    const BinlogQueue *logs;
+    rocksdb::Iterator *it;
+    // for the binlogs in the WAL, NULL if they are in the oplog
+    WalBinlogReader *wal;
+    rocksdb::Iterator* new_iterator() const;
+ public:
+    BinlogReader(const BinlogQueue *logs);
+    ~BinlogReader();
+    // as BinlogQueue::find_next()
+    int find_next(uint64_t seq, Binlog *log);
+};
+
 class Transaction{
  private:
     BinlogQueue *logs;
+    std::vector<int> stripes;
+    void lock();
  public:
-    Transaction(BinlogQueue *logs){
-	this->logs = logs;
-	logs->mutex.lock();
-	logs->begin();
-    }
-	
-    ~Transaction(){
-	// it is safe to call rollback after commit
-	logs->rollback();
-	logs->mutex.unlock();
-    }
+    // lock every key, for writes on the whole db
+    Transaction(BinlogQueue *logs);
+    // lock only the given encoded keys
+    Transaction(BinlogQueue *logs, const Bytes &key);
+    Transaction(BinlogQueue *logs, const std::vector<std::string> &keys);
+    ~Transaction();
 };
 
 
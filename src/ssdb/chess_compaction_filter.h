@@ -0,0 +1,110 @@
+#ifndef CHESS_COMPACTION_FILTER_H
+#define CHESS_COMPACTION_FILTER_H
+
+#include <atomic>
+#include <limits>
+#include <stdio.h>
+
+#include "rocksdb/compaction_filter.h"
+#include "../include.h"
+#include "hash_encoder.h"
+#include "t_hash.h"
+#include "t_hash_kernel.h"
+
+// The Compaction Filter
+//
+// Whenever a compaction goes through a hash value, it
+//   - rewrites a v1 value as v2, so a live book is upgraded in the
+//     background, no stop-the-world migration is needed,
+//   - strips 'DEL' entries, which mean nothing in a base value,
+//   - removes the key if no entry is left.
+// Merge operands are left alone: their 'DEL' entries still have to be
+// applied on older values, ChessMergeOperator drops them once merged.
+class ChessCompactionFilter : public rocksdb::CompactionFilter {
+ public:
+  ChessCompactionFilter() :
+    _upgraded(0), _purged_entries(0), _purged_bytes(0), _removed_keys(0) {
+  }
+
+  // level:          (IN)  The level at which this filter is applied.
+  // key:            (IN)  The key of the kv pair.
+  // existing_value: (IN)  The value of the kv pair, never a merge operand.
+  // new_value:      (OUT) The changed value if *value_changed is set.
+  // value_changed:  (OUT) Whether new_value should replace existing_value.
+  //
+  // Return true if the kv pair should be removed from the output. Above
+  // the bottommost level rocksdb turns a removed key into a deletion
+  // marker, so older versions of it can not come back.
+  // It is called from multiple compaction threads, so it must be
+  // thread-safe.
+  virtual bool Filter(int level, const rocksdb::Slice& key,
+		      const rocksdb::Slice& existing_value,
+		      std::string* new_value, bool* value_changed) const {
+    if (key.empty() || key[0] != DataType::HASH) {
+      return false;
+    }
+    Bytes slice(existing_value.data(), existing_value.size());
+    if (slice.empty()) {
+      _removed_keys++;
+      return true;
+    }
+    std::string upgraded;
+    if (!ChessHashEncoder::isV2(slice)) {
+      // keep a corrupted value as is, reading it will report the error
+      if (upgrade_hash_value(slice, &upgraded) == -1) {
+	return false;
+      }
+      _upgraded++;
+      slice = Bytes(upgraded);
+    }
+    if ((slice.size() - 1) % kV2EntryLen != 0) {
+      return false;
+    }
+    const char* entries = slice.data() + 1;
+    int n = (slice.size() - 1) / kV2EntryLen;
+    int live = hash_kernel()->count_live(entries, n);
+    if (live == 0) {
+      _purged_entries += n;
+      _purged_bytes += existing_value.size();
+      _removed_keys++;
+      return true;
+    }
+    if (live < n) {
+      new_value->resize(1 + live * kV2EntryLen);
+      (*new_value)[0] = kHashValueV2;
+      hash_kernel()->filter(entries, n, std::numeric_limits<int16_t>::min(),
+			    kDelScore - 1, &(*new_value)[1]);
+      _purged_entries += n - live;
+      _purged_bytes += (n - live) * kV2EntryLen;
+      *value_changed = true;
+    } else if (!upgraded.empty()) {
+      new_value->swap(upgraded);
+      *value_changed = true;
+    }
+    return false;
+  }
+
+  virtual const char* Name() const {
+    return "ChessCompactionFilter";
+  }
+
+  std::string stats() const {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+	     "    upgraded_values : %" PRIu64 "\n"
+	     "    purged_entries  : %" PRIu64 "\n"
+	     "    purged_bytes    : %" PRIu64 "\n"
+	     "    removed_keys    : %" PRIu64,
+	     _upgraded.load(), _purged_entries.load(),
+	     _purged_bytes.load(), _removed_keys.load());
+    return buf;
+  }
+
+ private:
+  mutable std::atomic<uint64_t> _upgraded;
+  mutable std::atomic<uint64_t> _purged_entries;
+  mutable std::atomic<uint64_t> _purged_bytes;
+  mutable std::atomic<uint64_t> _removed_keys;
+};
+
+#endif
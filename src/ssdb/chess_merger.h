@@ -4,14 +4,177 @@
 
 #include <algorithm>
 #include <deque>
-#include <iostream>
+#include <string>
+#include <vector>
+#include <string.h>
 
 #include "rocksdb/merge_operator.h"
-#include "../include.h"
 #include "hash_encoder.h"
-#include "ssdb.h"
-#include "ssdb_impl.h"
-#include "t_hash.h"
+
+// Dedupe table indexed by move id, one per thread so that concurrent
+// compactions never share it. A slot is live only if its stamp equals
+// the current generation, so reset() is O(1) instead of a 64KB memset.
+//
+// Deltas (kOpAdd) of a move are summed until a score of the move is
+// fed, which they are then added to. A delta with nothing older is
+// added to 0 in a value, and kept as a delta in an operand. The sum is
+// not saturated, only the score it is added to, so the result does not
+// depend on how the operands are grouped into merges.
+class MoveSlots {
+ public:
+  MoveSlots() : _gen(0), _count(0) {
+    memset(_stamps, 0, sizeof(_stamps));
+  }
+
+  void reset() {
+    if (++_gen == 0) { // wrapped around, stale stamps could match again
+      memset(_stamps, 0, sizeof(_stamps));
+      _gen = 1;
+    }
+    _count = 0;
+  }
+
+  // entries must be fed newest first, the first score of a move wins
+  void add(int move, int16_t score) {
+    if (_stamps[move] != _gen) {
+      _stamps[move] = _gen;
+      _scores[move] = score;
+      _ops[move] = kOpSet;
+      _moves[_count++] = move;
+    } else if (_ops[move] == kOpAdd) {
+      _scores[move] = saturate((score == kDelScore ? 0 : score) + _scores[move]);
+      _ops[move] = kOpSet;
+    }
+  }
+
+  void add_delta(int move, int16_t delta) {
+    if (_stamps[move] != _gen) {
+      _stamps[move] = _gen;
+      _scores[move] = delta;
+      _ops[move] = kOpAdd;
+      _moves[_count++] = move;
+    } else if (_ops[move] == kOpAdd) {
+      _scores[move] += delta;
+    }
+  }
+
+  // v2 value sorted by move id, empty if no entry left. A value (full)
+  // drops tombstones and applies deltas to 0, an operand keeps both.
+  // -1 if a delta sum of an operand does not fit in an entry
+  int encode(bool full, std::string* new_value) {
+    new_value->clear();
+    if (_count == 0) {
+      return 0;
+    }
+    if (!full) {
+      for (int i = 0; i < _count; i++) {
+	int move = _moves[i];
+	if (_ops[move] == kOpAdd && (_scores[move] < -kScoreMax || _scores[move] > kScoreMax)) {
+	  return -1;
+	}
+      }
+    }
+    new_value->resize(1 + _count * kV2EntryLen);
+    char* buf = &(*new_value)[0];
+    *buf++ = kHashValueV2;
+    // sparse: sort the touched moves, dense: sweep the whole table
+    if (_count * 16 < kMoveIdCount) {
+      std::sort(_moves, _moves + _count);
+      for (int i = 0; i < _count; i++) {
+	buf = put(buf, _moves[i], full);
+      }
+    } else {
+      for (int move = 0; move < kMoveIdCount; move++) {
+	if (_stamps[move] == _gen) {
+	  buf = put(buf, move, full);
+	}
+      }
+    }
+    new_value->resize(buf - new_value->data());
+    if (new_value->size() == 1) {
+      new_value->clear();
+    }
+    return 0;
+  }
+
+  // feed one operand or existing value, -1 if malformed
+  int add_value(const char* data, size_t size) {
+    return ChessHashEncoder::for_each_entry(data, size, [this](int move, int16_t score, int op) {
+	if (op == kOpAdd) {
+	  add_delta(move, score);
+	} else {
+	  add(move, score);
+	}
+      });
+  }
+
+  static MoveSlots* local() {
+    static thread_local MoveSlots slots;
+    return &slots;
+  }
+
+ private:
+  char* put(char* buf, int move, bool full) {
+    if (_ops[move] == kOpAdd) {
+      if (full) {
+	ChessHashEncoder::put_entry(buf, move, saturate(_scores[move]));
+      } else {
+	ChessHashEncoder::put_entry(buf, move | (kOpAdd << kOpShift), static_cast<int16_t>(_scores[move]));
+      }
+      return buf + kV2EntryLen;
+    }
+    if (full && _scores[move] == kDelScore) {
+      return buf;
+    }
+    ChessHashEncoder::put_entry(buf, move, static_cast<int16_t>(_scores[move]));
+    return buf + kV2EntryLen;
+  }
+
+  static int16_t saturate(int score) {
+    return static_cast<int16_t>(std::max(-kScoreMax, std::min(kScoreMax, score)));
+  }
+
+  uint32_t _gen;
+  int _count;
+  uint32_t _stamps[kMoveIdCount];
+  // a score, or a delta sum while the op is kOpAdd
+  int32_t _scores[kMoveIdCount];
+  uint8_t _ops[kMoveIdCount];
+  uint16_t _moves[kMoveIdCount];
+};
+
+// Operand chains merged by FullMergeV2 on this thread, while a read has
+// armed it, see MergeCollapser. Compactions merge on their own threads,
+// which are never armed.
+struct MergeChainLog {
+  bool armed = false;
+  size_t threshold = 0;
+  uint64_t merges = 0;
+  uint64_t operands = 0;
+  // keys whose chain reached the threshold
+  std::vector<std::string> long_keys;
+
+  void arm(size_t threshold) {
+    this->armed = true;
+    this->threshold = threshold;
+    merges = 0;
+    operands = 0;
+    long_keys.clear();
+  }
+
+  void add(const rocksdb::Slice& key, size_t n) {
+    merges++;
+    operands += n;
+    if (n >= threshold) {
+      long_keys.push_back(key.ToString());
+    }
+  }
+
+  static MergeChainLog* local() {
+    static thread_local MergeChainLog log;
+    return &log;
+  }
+};
 
 // The Merge Operator
 //
@@ -20,14 +183,6 @@
 // concatenation, edit data structure, ... , anything.
 class ChessMergeOperator : public rocksdb::MergeOperator {
  public:
-  ChessMergeOperator() {
-    _encoder = new ChessHashEncoder;
-  }
-	
-  virtual ~ChessMergeOperator() {
-    delete _encoder;
-  }
-
   // Gives the client a way to express the read -> modify -> write semantics
   // key:      (IN)    The key that's associated with this merge operation.
   //                   Client could multiplex the merge operator based on it
@@ -48,60 +203,31 @@ class ChessMergeOperator : public rocksdb::MergeOperator {
   // Also make use of the *logger for error messages.
   virtual bool FullMergeV2(const MergeOperationInput& merge_in,
 			   MergeOperationOutput* merge_out) const {
-    // keep newest at front() in arr
-    std::deque<StrPair> arr;
-    static const int kExtraLen = 4;
-    int len = 0;
-    // items at back() are newer ones, items at begin() will be
-    // overwritten by ones at back()
-    for (int i = merge_in.operand_list.size() - 1; i >= -1; i--) {
-      std::deque<StrPair> exists;
-      if (i >= 0) {
-	const auto& item = merge_in.operand_list[i];
-	Bytes slice(item.data(), item.size());
-	if (get_hash_values(slice, exists) == -1) {
-	  return false;
-	}
-      } else if (merge_in.existing_value && !merge_in.existing_value->empty()) {
-	// filter existing value as well
-	Bytes slice(merge_in.existing_value->data(), merge_in.existing_value->size());
-	if (get_hash_values(slice, exists) == -1) {
-	  return false;
-	}
-      } else {
-	break;
-      }
-      for (auto& item : exists) {
-	auto it = std::find_if(arr.begin(), arr.end(), [&item](const StrPair& p) {
-	    return (p.first == item.first);
-	  });
-	if (it == arr.end()) {
-	  arr.push_back(std::make_pair(item.first, item.second));
-	  len += item.first.length() + item.second.length() + kExtraLen;
-	}
-      }
+    MergeChainLog* chains = MergeChainLog::local();
+    if (chains->armed) {
+      chains->add(merge_in.key, merge_in.operand_list.size());
     }
-    std::string& new_value = merge_out->new_value;
-    new_value.clear();  new_value.reserve(len);
-    len = 0;
-    for (auto& item : arr) {
-      if (!isDeleted(item.first, item.second)) {
-	std::string val = _encoder->encode_value(item.first, item.second);
-	new_value.append(val.data(), val.size());
-	new_value.append(1, ';');
-	len += val.size() + 1;
+    MoveSlots* slots = MoveSlots::local();
+    slots->reset();
+    // items at back() are newer ones, they overwrite the ones at begin()
+    for (int i = merge_in.operand_list.size() - 1; i >= 0; i--) {
+      const auto& item = merge_in.operand_list[i];
+      if (slots->add_value(item.data(), item.size()) == -1) {
+	return false;
       }
     }
-    if (!new_value.empty()) {
-      new_value.resize(len - 1);  // skip the last ';'
+    if (merge_in.existing_value) {
+      // filter existing value as well
+      const auto& item = *merge_in.existing_value;
+      if (slots->add_value(item.data(), item.size()) == -1) {
+	return false;
+      }
     }
+    // always written as v2, so v1 values are upgraded once merged
+    slots->encode(true, &merge_out->new_value);
     return true;
   }
 
-  bool isDeleted(const std::string& field, const std::string& value) const {
-    return (value == kDelTag);
-  }
-
   // This function performs merge(left_op, right_op)
   // when both the operands are themselves merge operation types
   // that you would have passed to a DB::Merge() call in the same order
@@ -135,47 +261,44 @@ class ChessMergeOperator : public rocksdb::MergeOperator {
   // always return false.
   virtual bool PartialMerge(const rocksdb::Slice& key, const rocksdb::Slice& left_operand,
 			    const rocksdb::Slice& right_operand, std::string* new_value,
-			    Logger* logger) const {
-    std::deque<StrPair> arr;
-    static const int kExtraLen = 4;
-    int len = 0;
-    for (int i = 0; i < 2; i++) {
-      std::deque<StrPair> exists;
-      if (i == 0) { // right is newer
-	Bytes slice(right_operand.data(), right_operand.size());
-	if (get_hash_values(slice, exists) == -1) {
-	  return false;
-	}
-      } else {
-	Bytes slice(left_operand.data(), left_operand.size());
-	if (get_hash_values(slice, exists) == -1) {
-	  return false;
-	}
-      }
-      for (auto& item : exists) {
-	auto it = std::find_if(arr.begin(), arr.end(), [&item](const StrPair& p) {
-	    return (p.first == item.first);
-	  });
-	if (it == arr.end()) {
-	  arr.push_back(std::make_pair(item.first, item.second));
-	  len += item.first.length() + item.second.length() + kExtraLen;
-	}
-      }
+			    rocksdb::Logger* logger) const {
+    MoveSlots* slots = MoveSlots::local();
+    slots->reset();
+    // right is newer
+    if (slots->add_value(right_operand.data(), right_operand.size()) == -1 ||
+	slots->add_value(left_operand.data(), left_operand.size()) == -1) {
+      return false;
     }
-    new_value->clear();  new_value->reserve(len);
-    len = 0;
-    for (auto& item : arr) {
-      //if (!isDeleted(item.first, item.second)) {
-      std::string val = _encoder->encode_value(item.first, item.second);
-      new_value->append(val.data(), val.size());
-      new_value->append(1, ';');
-      len += val.size() + 1;
-      //}
-    }
-    if (!new_value->empty()) {
-      new_value->resize(len - 1); // skip the last ';'
+    // keep 'DEL' so that it could be applied on older values. Deltas
+    // that no longer fit are left to the full merge, unsaturated
+    return slots->encode(false, new_value) == 0;
+  }
+
+  // This function performs merge when all the operands are themselves merge
+  // operation types that you would have passed to a DB::Merge() call in the
+  // same order (front() first)
+  // (i.e. DB::Merge(key, operand_list[0]), followed by
+  //  DB::Merge(key, operand_list[1]), ...)
+  //
+  // PartialMergeMulti should combine them into a single merge operation that is
+  // saved into *new_value, and then it should return true.  *new_value should
+  // be constructed such that a call to DB::Merge(key, *new_value) would yield
+  // the same result as subquential individual calls to DB::Merge(key, operand)
+  // for each operand in operand_list from front() to back().
+  //
+  // The string that new_value is pointing to will be empty.
+  virtual bool PartialMergeMulti(const rocksdb::Slice& key,
+				 const std::deque<rocksdb::Slice>& operand_list,
+				 std::string* new_value, rocksdb::Logger* logger) const {
+    MoveSlots* slots = MoveSlots::local();
+    slots->reset();
+    for (int i = operand_list.size() - 1; i >= 0; i--) {
+      const auto& item = operand_list[i];
+      if (slots->add_value(item.data(), item.size()) == -1) {
+	return false;
+      }
     }
-    return true;
+    return slots->encode(false, new_value) == 0;
   }
 
   // The name of the MergeOperator. Used to check for MergeOperator
@@ -184,9 +307,6 @@ class ChessMergeOperator : public rocksdb::MergeOperator {
   virtual const char* Name() const {
     return "Chessmergeoperator";
   }
-	
- private:
-  HashEncoder* _encoder;
 };
 
 #endif
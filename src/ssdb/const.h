@@ -24,6 +24,35 @@ public:
 	static const char MAX_PREFIX = ZSET;
 };
 
+// the column families of a db, see SSDB::open(), a data key lives in
+// the one of the type in its first byte
+class ColumnFamily{
+public:
+	static const int DEFAULT	= 0; // kv, and keys of no known type
+	static const int OPLOG		= 1; // binlogs
+	static const int HASH		= 2;
+	static const int ZSET		= 3;
+	static const int QUEUE		= 4;
+	static const int COUNT		= 5;
+
+	static int of(char type){
+		switch(type){
+			case DataType::HASH:
+			case DataType::HSIZE:
+				return HASH;
+			case DataType::ZSET:
+			case DataType::ZSCORE:
+			case DataType::ZSIZE:
+				return ZSET;
+			case DataType::QUEUE:
+			case DataType::QSIZE:
+				return QUEUE;
+			default:
+				return DEFAULT;
+		}
+	}
+};
+
 class BinlogType{
 public:
 	static const char NOOP		= 0;
@@ -48,6 +77,8 @@ public:
 	static const char QPOP_BACK		= 12;
 	static const char QPOP_FRONT	= 13;
 	static const char QSET			= 14;
+	// a hash merge operand, carried in the binlog, see Binlog::val()
+	static const char HMERGE		= 15;
 	
 	static const char BEGIN  = 7;
 	static const char END    = 8;
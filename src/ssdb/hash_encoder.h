@@ -1,4 +1,3 @@
-
 #ifndef HASH_ENCODER_
 #define HASH_ENCODER_
 
@@ -17,6 +16,36 @@ class HashEncoder {
 
 
 static const std::string kDelTag = "32767";
+static const int16_t kDelScore = 32767;
+
+// Packed hash value formats
+//
+// v1: [entry];[entry];...;[entry]
+//     entry: [field 2 bytes][score int16 little-endian]
+//     field: (file - 'a') << 4 | (rank - '0'), once per square
+//
+// v2: [kHashValueV2][entry][entry]...[entry]
+//     entry: [move id uint16 little-endian][score int16 little-endian]
+//     move id: from_square * 90 + to_square, square = file * 10 + rank,
+//     entries are sorted by move id, no separator.
+//
+// A v2 merge operand may also carry an opcode in the top 3 bits of the
+// move id word, kOpSet (0) or kOpAdd. Stored values never do.
+//
+// The first byte of a v1 value is a field byte whose high nibble is a
+// file in [0, 8], so kHashValueV2 can never start a v1 value. An empty
+// value means no entries in both formats.
+static const char kHashValueV2 = '\xF2';
+static const int kV1EntryLen = 5; // including the ';' delimiter
+static const int kV2EntryLen = 4;
+static const int kBoardFiles = 9;
+static const int kBoardRanks = 10;
+static const int kBoardSquares = kBoardFiles * kBoardRanks;
+static const int kMoveIdCount = kBoardSquares * kBoardSquares; // < 2^13
+static const int kOpShift = 13;
+static const int kOpSet = 0; // the score, kDelScore deletes
+static const int kOpAdd = 1; // a delta added to the score
+static const int kScoreMax = 30000; // scores saturate at +-kScoreMax
 
 class ChessHashEncoder : public HashEncoder {
  public:
@@ -38,41 +67,40 @@ class ChessHashEncoder : public HashEncoder {
 		}
 		return 0;
     }
-	
+
 	static const int kFieldLen = 2;
 	static const int kValueLen = 2;
+
+	// one-entry v2 value, which is also what a merge operand looks like
     std::string encode_value(const Bytes& field, const Bytes& value) override {
-		std::string buf;
-		buf.resize(kFieldLen + kValueLen);
-		int i = 0;
-		{
-			if (!isFieldValid(field)) { // empty means invalid input
-				return std::string();
-			}
-			// format: [a ~ i][0 ~ 9][a ~ i][0 ~ 9]
-			// -> [0 ~ 9] * 4, each with 4 bit
-			const char* arr = field.data();
-			char ifield_1st = (arr[0] - 'a') << 4 | (arr[1] - '0');
-			char ifield_2nd = (arr[2] - 'a') << 4 | (arr[3] - '0');
-			buf[i++] = ifield_1st & 0xFF;
-			buf[i++] = ifield_2nd & 0xFF;
-		}
-		{
-			// use little-endian right now
-			int val = atoi(value.data());
-			if (val < -30000 ||
-				(val > 30000 && value != kDelTag)) {
-				return std::string();
-			}
-			int16_t ival = static_cast<int16_t>(val);
-			//int16_t ival = static_cast<int16_t>(atoi(value.data()));
-			buf[i++] = ival & 0xFF;
-			buf[i++] = (ival >> 8) & 0xFF;
+		std::string entry = encode_entry(field, value);
+		if (entry.empty()) {
+			return entry;
 		}
+		std::string buf;
+		buf.reserve(1 + kV2EntryLen);
+		buf.append(1, kHashValueV2);
+		buf.append(entry);
 		return buf;
     }
 
+	// decode the first entry of a v1 or v2 value
     int decode_value(const Bytes& slice, std::string* field, std::string* value) override {
+		if (slice.empty()) {
+			return -1;
+		}
+		if (slice.data()[0] == kHashValueV2) {
+			if (slice.size() < 1 + kV2EntryLen) {
+				return -1;
+			}
+			const char* arr = slice.data() + 1;
+			move_field(entry_move(arr), field);
+			*value = std::to_string(entry_score(arr));
+			return 0;
+		}
+		if (slice.size() < kFieldLen + kValueLen) {
+			return -1;
+		}
 		const char* arr = slice.data();
 		{
 			int i = 0;
@@ -82,15 +110,28 @@ class ChessHashEncoder : public HashEncoder {
 			(*field)[i++] = ((arr[1] >> 4) & 0xF) + 'a';
 			(*field)[i++] = (arr[1] & 0xF) + '0';
 		}
-		{
-			int i = kFieldLen;
-			int16_t ival = arr[i++] & 0xFF;
-			ival |=	(arr[i++] << 8) & 0xFF00;
-			*value = std::to_string(ival);
-		}
+		*value = std::to_string(entry_score(arr));
 		return 0;
     }
 
+	// [move id][score], empty means invalid input
+	std::string encode_entry(const Bytes& field, const Bytes& value) {
+		int move = move_id(field);
+		if (move == -1) {
+			return std::string();
+		}
+		// use little-endian right now
+		int val = atoi(value.data());
+		if (val < -30000 ||
+			(val > 30000 && value != kDelTag)) {
+			return std::string();
+		}
+		std::string buf;
+		buf.resize(kV2EntryLen);
+		put_entry(&buf[0], move, static_cast<int16_t>(val));
+		return buf;
+	}
+
 	bool isFieldValid(const Bytes& field) {
 		if (field.size() != 4) {
 			return false;
@@ -104,6 +145,106 @@ class ChessHashEncoder : public HashEncoder {
 		}
 		return false;
 	}
+
+	// format: [a ~ i][0 ~ 9][a ~ i][0 ~ 9] -> from * 90 + to, -1 if invalid
+	static int move_id(const Bytes& field) {
+		if (field.size() != 4) {
+			return -1;
+		}
+		const char* arr = field.data();
+		if (arr[0] < 'a' || arr[0] > 'i' || arr[2] < 'a' || arr[2] > 'i' ||
+			arr[1] < '0' || arr[1] > '9' || arr[3] < '0' || arr[3] > '9') {
+			return -1;
+		}
+		int from = (arr[0] - 'a') * kBoardRanks + (arr[1] - '0');
+		int to = (arr[2] - 'a') * kBoardRanks + (arr[3] - '0');
+		return from * kBoardSquares + to;
+	}
+
+	static void move_field(int move, std::string* field) {
+		int from = move / kBoardSquares;
+		int to = move % kBoardSquares;
+		field->resize(4);
+		(*field)[0] = from / kBoardRanks + 'a';
+		(*field)[1] = from % kBoardRanks + '0';
+		(*field)[2] = to / kBoardRanks + 'a';
+		(*field)[3] = to % kBoardRanks + '0';
+	}
+
+	// the same move on the board mirrored left-right, file a <-> i
+	static int mirror_move(int move) {
+		int from = move / kBoardSquares;
+		int to = move % kBoardSquares;
+		from = (kBoardFiles - 1 - from / kBoardRanks) * kBoardRanks + from % kBoardRanks;
+		to = (kBoardFiles - 1 - to / kBoardRanks) * kBoardRanks + to % kBoardRanks;
+		return from * kBoardSquares + to;
+	}
+
+	// v1 field bytes -> move id, -1 if a nibble is off the board
+	static int v1_move_id(const char* arr) {
+		if (((arr[0] >> 4) & 0xF) >= kBoardFiles || (arr[0] & 0xF) >= kBoardRanks ||
+			((arr[1] >> 4) & 0xF) >= kBoardFiles || (arr[1] & 0xF) >= kBoardRanks) {
+			return -1;
+		}
+		int from = ((arr[0] >> 4) & 0xF) * kBoardRanks + (arr[0] & 0xF);
+		int to = ((arr[1] >> 4) & 0xF) * kBoardRanks + (arr[1] & 0xF);
+		return from * kBoardSquares + to;
+	}
+
+	static int entry_move(const char* arr) {
+		return (arr[0] & 0xFF) | ((arr[1] & 0xFF) << 8);
+	}
+
+	static int16_t entry_score(const char* arr) {
+		return static_cast<int16_t>((arr[2] & 0xFF) | ((arr[3] & 0xFF) << 8));
+	}
+
+	static void put_entry(char* arr, int move, int16_t score) {
+		arr[0] = move & 0xFF;
+		arr[1] = (move >> 8) & 0xFF;
+		arr[2] = score & 0xFF;
+		arr[3] = (score >> 8) & 0xFF;
+	}
+
+	static bool isV2(const Bytes& slice) {
+		return !slice.empty() && slice.data()[0] == kHashValueV2;
+	}
+
+	// call fn(move id, score, op) on each entry of a v1 or v2 value or
+	// operand in stored order, without any allocation, -1 if malformed
+	template <typename Fn>
+	static int for_each_entry(const char* data, size_t size, Fn fn) {
+		if (size == 0) {
+			return 0;
+		}
+		if (data[0] == kHashValueV2) {
+			if ((size - 1) % kV2EntryLen != 0) {
+				return -1;
+			}
+			for (size_t i = 1; i < size; i += kV2EntryLen) {
+				int word = entry_move(data + i);
+				int move = word & ((1 << kOpShift) - 1);
+				int op = word >> kOpShift;
+				if (move >= kMoveIdCount || op > kOpAdd) {
+					return -1;
+				}
+				fn(move, entry_score(data + i), op);
+			}
+			return 0;
+		}
+		if ((size + 1) % kV1EntryLen != 0) {
+			return -1;
+		}
+		for (size_t i = 0; i < size; i += kV1EntryLen) {
+			const char* p = data + i;
+			int move = v1_move_id(p);
+			if (move == -1) {
+				return -1;
+			}
+			fn(move, entry_score(p), kOpSet);
+		}
+		return 0;
+	}
 };
 
 #endif
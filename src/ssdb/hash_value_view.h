@@ -0,0 +1,107 @@
+#ifndef SSDB_HASH_VALUE_VIEW_H_
+#define SSDB_HASH_VALUE_VIEW_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "rocksdb/slice.h"
+#include "../util/bytes.h"
+#include "hash_encoder.h"
+
+// Read-only view over a packed hash value, entries are read in place.
+// The value is either pinned by rocksdb (Get into pinnable(), then
+// load()), shared with the position cache (hold()), or borrowed from an
+// iterator with assign(). A v1 value is upgraded into an owned buffer
+// first, it may repeat a move.
+class HashValueView {
+ public:
+  HashValueView() : _entries(NULL), _count(0) {}
+
+  // reset for the next Get()
+  rocksdb::PinnableSlice* pinnable() {
+    clear();
+    _held.reset();
+    _pinned.Reset();
+    return &_pinned;
+  }
+
+  // keep a cached value alive while it is viewed
+  int hold(const std::shared_ptr<const std::string>& value) {
+    _held = value;
+    return assign(Bytes(*_held));
+  }
+
+  // -1 if the pinned value is malformed
+  int load() {
+    return assign(Bytes(_pinned.data(), _pinned.size()));
+  }
+
+  // view a value owned by the caller, -1 if malformed
+  int assign(const Bytes& value);
+
+  void clear() {
+    _value = Bytes();
+    _entries = NULL;
+    _count = 0;
+  }
+
+  // the value as assigned, before any upgrade
+  const Bytes& value() const {
+    return _value;
+  }
+
+  // entries sorted by move id, tombstones included
+  int count() const {
+    return _count;
+  }
+
+  int move(int i) const {
+    return ChessHashEncoder::entry_move(_entries + i * kV2EntryLen);
+  }
+
+  int16_t score(int i) const {
+    return ChessHashEncoder::entry_score(_entries + i * kV2EntryLen);
+  }
+
+  bool live(int i) const {
+    return score(i) != kDelScore;
+  }
+
+  int count_live() const;
+
+  // 1 and the score if the move is live, 0 if not
+  int find(int move, int16_t* score) const;
+
+  // view the moves mirrored left-right, into an owned buffer
+  void mirror();
+
+  // up to n live entries with the highest (lowest if !desc) scores,
+  // best first, ties by move id, copied to *out as v2 entries
+  int best(int n, bool desc, std::string* out) const;
+
+  // live entries with lo <= score <= hi, by move id, copied to *out as
+  // v2 entries
+  int filter(int16_t lo, int16_t hi, std::string* out) const;
+
+ private:
+  HashValueView(const HashValueView&);
+  HashValueView& operator=(const HashValueView&);
+
+  rocksdb::PinnableSlice _pinned;
+  std::shared_ptr<const std::string> _held;
+  std::string _upgraded;
+  Bytes _value;
+  const char* _entries;
+  int _count;
+};
+
+// values of a batch of keys read by one MultiGet, views[i] is the value
+// of the i-th key, empty if it is not found
+struct HashValueBatch {
+  explicit HashValueBatch(size_t n) : pinned(n), views(n) {}
+
+  std::vector<rocksdb::PinnableSlice> pinned; // cache misses, sorted by key
+  std::vector<HashValueView> views;
+};
+
+#endif
@@ -12,8 +12,130 @@
 #include "t_queue.h"
 #include "../util/log.h"
 #include "../util/config.h"
+#include "rocksdb/db.h"
 #include "rocksdb/iterator.h"
 
+class MergingIterator : public rocksdb::Iterator{
+ public:
+  MergingIterator(const std::vector<rocksdb::Iterator*> &children,
+		  rocksdb::DB *db, const rocksdb::Snapshot *snapshot)
+    : children(children), current(NULL), forward(true), db(db), snapshot(snapshot){
+  }
+  virtual ~MergingIterator(){
+    for(size_t i=0; i<children.size(); i++){
+      delete children[i];
+    }
+    if(snapshot){
+      db->ReleaseSnapshot(snapshot);
+    }
+  }
+
+  virtual bool Valid() const{
+    return current != NULL;
+  }
+  virtual void SeekToFirst(){
+    for(size_t i=0; i<children.size(); i++){
+      children[i]->SeekToFirst();
+    }
+    find_smallest();
+  }
+  virtual void SeekToLast(){
+    for(size_t i=0; i<children.size(); i++){
+      children[i]->SeekToLast();
+    }
+    find_largest();
+  }
+  virtual void Seek(const rocksdb::Slice& target){
+    for(size_t i=0; i<children.size(); i++){
+      children[i]->Seek(target);
+    }
+    find_smallest();
+  }
+  virtual void SeekForPrev(const rocksdb::Slice& target){
+    for(size_t i=0; i<children.size(); i++){
+      children[i]->SeekForPrev(target);
+    }
+    find_largest();
+  }
+  // the other children are behind the current key after a Prev(), bring
+  // them after it
+  virtual void Next(){
+    if(!forward){
+      std::string key = current->key().ToString();
+      for(size_t i=0; i<children.size(); i++){
+	if(children[i] != current){
+	  children[i]->Seek(key);
+	}
+      }
+    }
+    current->Next();
+    find_smallest();
+  }
+  virtual void Prev(){
+    if(forward){
+      std::string key = current->key().ToString();
+      for(size_t i=0; i<children.size(); i++){
+	if(children[i] != current){
+	  children[i]->Seek(key);
+	  if(children[i]->Valid()){
+	    children[i]->Prev();
+	  }else{
+	    children[i]->SeekToLast();
+	  }
+	}
+      }
+    }
+    current->Prev();
+    find_largest();
+  }
+  virtual rocksdb::Slice key() const{
+    return current->key();
+  }
+  virtual rocksdb::Slice value() const{
+    return current->value();
+  }
+  virtual rocksdb::Status status() const{
+    for(size_t i=0; i<children.size(); i++){
+      rocksdb::Status s = children[i]->status();
+      if(!s.ok()){
+	return s;
+      }
+    }
+    return rocksdb::Status::OK();
+  }
+
+ private:
+  std::vector<rocksdb::Iterator*> children;
+  rocksdb::Iterator *current;
+  bool forward;
+  rocksdb::DB *db;
+  const rocksdb::Snapshot *snapshot;
+
+  void find_smallest(){
+    forward = true;
+    current = NULL;
+    for(size_t i=0; i<children.size(); i++){
+      if(children[i]->Valid() && (!current || children[i]->key().compare(current->key()) < 0)){
+	current = children[i];
+      }
+    }
+  }
+  void find_largest(){
+    forward = false;
+    current = NULL;
+    for(size_t i=0; i<children.size(); i++){
+      if(children[i]->Valid() && (!current || children[i]->key().compare(current->key()) > 0)){
+	current = children[i];
+      }
+    }
+  }
+};
+
+rocksdb::Iterator* new_merging_iterator(const std::vector<rocksdb::Iterator*> &children,
+					rocksdb::DB *db, const rocksdb::Snapshot *snapshot){
+  return new MergingIterator(children, db, snapshot);
+}
+
 Iterator::Iterator(rocksdb::Iterator *it,
 		   const std::string &end,
 		   uint64_t limit,
@@ -121,56 +243,45 @@ bool KIterator::next(){
 /* HASH */
 // by employing 'key', iterator could only reply
 // all {fields, value} under one key
-HIterator::HIterator(Iterator *it, const Bytes &key, HashEncoder* encoder) {
-  this->_valid = false;
-  this->_it = it;
+HIterator::HIterator(const Bytes &key, const Bytes &start, const Bytes &end,
+		     uint64_t limit) {
   this->_key.assign(key.data(), key.size());
-  this->_encoder = encoder;
+  this->_start.assign(start.data(), start.size());
+  this->_end.assign(end.data(), end.size());
+  this->_limit = limit;
   this->_return_val = true;
   this->_index = -1;
-  this->_values.clear();
 }
 
 HIterator::~HIterator(){
-  delete _it;
 }
 
 void HIterator::return_val(bool onoff){
   this->_return_val = onoff;
 }
 
+// entries are sorted by move id, which is also the order of field names
 bool HIterator::next() {
-  if (_index == -1) { // init first, mutex TBD
-    _index = 0;
-    //HashEncoder* encoder = new ChessHashEncoder;
-    if (_it->next()) {
-      Bytes ks = _it->key();
-      std::string key;
-      if (ks.data()[0] != DataType::HASH ||
-	  _encoder->decode_key(ks, &key) == -1 ||
-	  key != this->_key) {
-	_valid = false;
-	return _valid;
-      }
-
-      if (_return_val) {
-	Bytes vs = _it->val();
-	if (get_hash_values(Bytes(vs), _values) == -1) {
-	  _valid = false;
-	  return _valid;
-	}
-      }
-      _valid = true;
+  while (_limit > 0 && ++_index < _view.count()) {
+    if (!_view.live(_index)) {
+      continue;
     }
-  }
-  if (_index >= _values.size() || !_valid) {
-    return false;
-  } else {
-    _field = _values[_index].first;
-    _value = _values[_index].second;
-    _index++;
+    ChessHashEncoder::move_field(_view.move(_index), &_field);
+    if (!_start.empty() && _field <= _start) {
+      continue;
+    }
+    if (!_end.empty() && _field > _end) {
+      break;
+    }
+    if (_return_val) {
+      char buf[8];
+      _value.assign(buf, snprintf(buf, sizeof(buf), "%d", _view.score(_index)));
+    }
+    _limit--;
     return true;
   }
+  _index = _view.count();
+  return false;
 }
 
 /* ZSET */
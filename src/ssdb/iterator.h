@@ -9,14 +9,24 @@ found in the LICENSE file.
 #include <inttypes.h>
 #include <deque>
 #include <string>
+#include <vector>
 #include "../include.h"
 #include "../util/bytes.h"
+#include "hash_value_view.h"
 
 namespace rocksdb{
+    class DB;
     class Iterator;
+    class Snapshot;
 }
 
-class HashEncoder;
+// children in key order, as one iterator, like rocksdb's internal
+// merging iterator. Keys are unique across the children, they come from
+// column families that split the key space. Takes the children over,
+// and the snapshot they read, released on db when deleted.
+rocksdb::Iterator* new_merging_iterator(const std::vector<rocksdb::Iterator*> &children,
+					rocksdb::DB *db, const rocksdb::Snapshot *snapshot);
+
 class Iterator{
  public:
     enum Direction{
@@ -61,17 +71,29 @@ class HIterator{
     std::string _field;
     std::string _value;
 
-    HIterator(Iterator *it, const Bytes &key, HashEncoder*);
+    // fields in (start, end], at most limit of them
+    HIterator(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit);
     ~HIterator();
     void return_val(bool onoff);
     bool next();
+    // the value of _key, loaded by the creator
+    HashValueView* view(){
+	return &_view;
+    }
+    // the current entry, without formatting _field and _value
+    int move() const{
+	return _view.move(_index);
+    }
+    int16_t score() const{
+	return _view.score(_index);
+    }
  private:
-    HashEncoder *_encoder;
-    Iterator *_it;
+    HashValueView _view;
+    std::string _start;
+    std::string _end;
+    uint64_t _limit;
     bool _return_val;
-    bool _valid;
-    int _index = -1;
-    std::deque<StrPair> _values;
+    int _index;
 };
 
 
@@ -0,0 +1,137 @@
+/*
+  Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+  Use of this source code is governed by a BSD-style license that can be
+  found in the LICENSE file.
+*/
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../util/log.h"
+#include "merge_collapser.h"
+
+// positions waiting to be rewritten, more are dropped
+static const size_t kMaxQueued = 10000;
+
+MergeCollapser::MergeCollapser(rocksdb::DB *db, rocksdb::ColumnFamilyHandle *cf, BinlogQueue *logs, int threshold, int max_rate){
+    this->db = db;
+    this->cf = cf;
+    this->logs = logs;
+    this->_threshold = threshold;
+    this->_interval_us = (max_rate > 0)? 1000 * 1000 / max_rate : 0;
+    this->_reads = 0;
+    this->_operands = 0;
+    this->_collapses = 0;
+    this->_dropped = 0;
+    this->thread_quit = false;
+    int err = pthread_create(&tid, NULL, &MergeCollapser::thread_func, this);
+    if(err != 0){
+	log_fatal("can't create thread: %s", strerror(err));
+	exit(0);
+    }
+}
+
+MergeCollapser::~MergeCollapser(){
+    thread_quit = true;
+    pthread_join(tid, NULL);
+}
+
+void MergeCollapser::collect(MergeChainLog *chains){
+    if(chains->merges == 0){
+	return;
+    }
+    _reads += chains->merges;
+    _operands += chains->operands;
+    if(chains->long_keys.empty()){
+	return;
+    }
+    Locking l(&mutex);
+    for(size_t i=0; i<chains->long_keys.size(); i++){
+	const std::string &key = chains->long_keys[i];
+	if(queued.count(key)){
+	    continue;
+	}
+	if(queue.size() >= kMaxQueued){
+	    _dropped++;
+	    continue;
+	}
+	queued.insert(key);
+	queue.push_back(key);
+    }
+}
+
+// the merged value as one Put, through the binlog queue so that it is
+// ordered with the writes of other threads, but without a binlog, the
+// position does not change
+int MergeCollapser::collapse(const std::string &dbkey){
+    Transaction trans(logs, dbkey);
+    std::string value;
+    rocksdb::Status s = db->Get(rocksdb::ReadOptions(), cf, dbkey, &value);
+    if(s.IsNotFound()){
+	return 0;
+    }
+    if(!s.ok()){
+	log_error("collapse error: %s", s.ToString().c_str());
+	return -1;
+    }
+    logs->Put(dbkey, value);
+    s = logs->commit();
+    if(!s.ok()){
+	log_error("collapse error: %s", s.ToString().c_str());
+	return -1;
+    }
+    return 1;
+}
+
+void* MergeCollapser::thread_func(void *arg){
+    MergeCollapser *collapser = (MergeCollapser *)arg;
+
+    while(!collapser->thread_quit){
+	std::string key;
+	{
+	    Locking l(&collapser->mutex);
+	    if(!collapser->queue.empty()){
+		key = collapser->queue.front();
+		collapser->queue.pop_front();
+	    }
+	}
+	if(key.empty()){
+	    usleep(10 * 1000);
+	    continue;
+	}
+	if(collapser->collapse(key) == 1){
+	    collapser->_collapses++;
+	}
+	{
+	    Locking l(&collapser->mutex);
+	    collapser->queued.erase(key);
+	}
+	if(collapser->_interval_us > 0){
+	    usleep(collapser->_interval_us);
+	}
+    }
+
+    log_debug("MergeCollapser thread quit");
+    return (void *)NULL;
+}
+
+std::string MergeCollapser::stats() const{
+    uint64_t reads = _reads;
+    uint64_t operands = _operands;
+    size_t pending;
+    {
+	Locking l(const_cast<Mutex*>(&mutex));
+	pending = queue.size();
+    }
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+	     "    threshold : %d\n"
+	     "    collapses : %" PRIu64 "\n"
+	     "    queued    : %" PRIu64 "\n"
+	     "    dropped   : %" PRIu64 "\n"
+	     "    merges    : %" PRIu64 "\n"
+	     "    avg chain : %.2f",
+	     _threshold, (uint64_t)_collapses, (uint64_t)pending, (uint64_t)_dropped,
+	     reads, reads? (double)operands / reads : 0.0);
+    return buf;
+}
@@ -0,0 +1,88 @@
+/*
+  Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+  Use of this source code is governed by a BSD-style license that can be
+  found in the LICENSE file.
+*/
+#ifndef SSDB_MERGE_COLLAPSER_H_
+#define SSDB_MERGE_COLLAPSER_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <unordered_set>
+#include "rocksdb/db.h"
+#include "../util/thread.h"
+#include "binlog.h"
+#include "chess_merger.h"
+
+// Writes the merged value of a position back as a Put once a read had
+// to merge a chain of at least threshold operands for it, so the reads
+// that follow stop merging that chain again until compaction does.
+//
+// A position is queued once however often it is read, and rewritten by
+// a background thread at most max_rate times a second, under its key
+// stripe so no write of the position is lost.
+class MergeCollapser{
+ public:
+    MergeCollapser(rocksdb::DB *db, rocksdb::ColumnFamilyHandle *cf, BinlogQueue *logs, int threshold, int max_rate);
+    ~MergeCollapser();
+
+    // what the reads of this thread merged since MergeChainLog::arm()
+    void collect(MergeChainLog *chains);
+    std::string stats() const;
+
+    int threshold() const{
+	return _threshold;
+    }
+
+ private:
+    rocksdb::DB *db;
+    rocksdb::ColumnFamilyHandle *cf;
+    BinlogQueue *logs;
+    int _threshold;
+    int _interval_us;
+
+    Mutex mutex;
+    std::deque<std::string> queue;
+    // queued or being rewritten
+    std::unordered_set<std::string> queued;
+
+    std::atomic<uint64_t> _reads;
+    std::atomic<uint64_t> _operands;
+    std::atomic<uint64_t> _collapses;
+    std::atomic<uint64_t> _dropped;
+
+    volatile bool thread_quit;
+    pthread_t tid;
+
+    int collapse(const std::string &dbkey);
+    static void* thread_func(void *arg);
+
+    // No copying allowed
+    MergeCollapser(const MergeCollapser&);
+    void operator=(const MergeCollapser&);
+};
+
+// Arms the merge chain log of this thread for one read, and hands what
+// the read merged to the collapser, if any, when it goes out of scope.
+class MergeChainWatch{
+ public:
+    explicit MergeChainWatch(MergeCollapser *collapser){
+	this->collapser = collapser;
+	if(collapser){
+	    MergeChainLog::local()->arm(collapser->threshold());
+	}
+    }
+    ~MergeChainWatch(){
+	if(collapser){
+	    MergeChainLog *chains = MergeChainLog::local();
+	    chains->armed = false;
+	    collapser->collect(chains);
+	}
+    }
+ private:
+    MergeCollapser *collapser;
+};
+
+#endif
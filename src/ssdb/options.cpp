@@ -3,6 +3,7 @@
   Use of this source code is governed by a BSD-style license that can be
   found in the LICENSE file.
 */
+#include <stdlib.h>
 #include "options.h"
 #include "../util/strings.h"
 
@@ -19,18 +20,101 @@ Options::Options(){
 
 void Options::load(const Config &conf){
     cache_size         = (size_t)conf.get_int64("leveldb.cache_size");
+    position_cache_size = (size_t)conf.get_int64("leveldb.position_cache");
     max_open_files     = (size_t)conf.get_int64("leveldb.max_open_files");
     write_buffer_size  = (size_t)conf.get_int64("leveldb.write_buffer_size");
     block_size         = (size_t)conf.get_int64("leveldb.block_size");
     compaction_speed   = conf.get_num("leveldb.compaction_speed");
     compression        = conf.get_str("leveldb.compression");
+    zstd_level         = conf.get_num("leveldb.zstd.level");
+    zstd_dict_size     = conf.get_num("leveldb.zstd.max_dict_bytes");
+    zstd_train_size    = conf.get_num("leveldb.zstd.max_train_bytes");
+    profile            = conf.get_str("leveldb.profile");
+    block_cache        = conf.get_str("leveldb.block_cache");
+    canonical          = conf.get_str("leveldb.canonical");
+    table_format       = conf.get_str("leveldb.table_format");
+    terark_temp_dir    = conf.get_str("leveldb.terark.local_temp_dir");
+    terark_index_nest_level  = conf.get_num("leveldb.terark.index_nest_level");
+    terark_index_cache_ratio = atof(conf.get_str("leveldb.terark.index_cache_ratio"));
+    terark_sample_ratio      = atof(conf.get_str("leveldb.terark.sample_ratio"));
+    terark_small_task_memory = (size_t)conf.get_int64("leveldb.terark.small_task_memory");
+    terark_soft_zip_memory   = (size_t)conf.get_int64("leveldb.terark.soft_zip_memory");
+    terark_hard_zip_memory   = (size_t)conf.get_int64("leveldb.terark.hard_zip_memory");
+    terark_min_dict_zip_value_size  = (size_t)conf.get_int64("leveldb.terark.min_dict_zip_value_size");
+    terark_offset_array_block_units = conf.get_num("leveldb.terark.offset_array_block_units");
+    collapse_threshold = conf.get_num("leveldb.collapse.threshold");
+    collapse_rate      = conf.get_num("leveldb.collapse.max_rate");
     std::string binlog = conf.get_str("replication.binlog");
     binlog_capacity    = (size_t)conf.get_num("replication.binlog.capacity");
+    binlog_backend     = conf.get_str("replication.binlog.backend");
+    wal_ttl            = conf.get_num("replication.binlog.wal_ttl");
+    wal_size_limit     = conf.get_num("replication.binlog.wal_size_limit");
+    group_commit_size  = conf.get_num("leveldb.group_commit.max_size");
+    group_commit_wait  = conf.get_num("leveldb.group_commit.max_wait");
 
     strtolower(&compression);
-    if (compression != "no") {
+    if (compression != "no" && compression != "zstd") {
         compression = "yes";
     }
+    if (zstd_level <= 0) {
+        zstd_level = 3;
+    }
+    if (zstd_dict_size <= 0) {
+        zstd_dict_size = 16 * 1024;
+    }
+    // zstd trains best on about 100 times the dictionary size
+    if (zstd_train_size < zstd_dict_size) {
+        zstd_train_size = zstd_dict_size * 100;
+    }
+    strtolower(&profile);
+    if (profile != "scan" && profile != "bulk") {
+        profile = "point_lookup";
+    }
+    strtolower(&block_cache);
+    if (block_cache != "clock") {
+        block_cache = "lru";
+    }
+    strtolower(&canonical);
+    if (canonical != "mirror") {
+        canonical = "none";
+    }
+    strtolower(&table_format);
+    if (table_format != "terark") {
+        table_format = "block";
+    }
+    if (terark_temp_dir.empty()) {
+        terark_temp_dir = "/tmp";
+    }
+    if (terark_index_nest_level <= 0) {
+        terark_index_nest_level = 4;
+    }
+    if (terark_index_cache_ratio < 0) {
+        terark_index_cache_ratio = 0;
+    }
+    if (terark_sample_ratio <= 0) {
+        terark_sample_ratio = 0.015;
+    }
+    if (terark_small_task_memory <= 0) {
+        terark_small_task_memory = 1024;
+    }
+    if (terark_soft_zip_memory <= 0) {
+        terark_soft_zip_memory = 16 * 1024;
+    }
+    if (terark_hard_zip_memory < terark_soft_zip_memory) {
+        terark_hard_zip_memory = terark_soft_zip_memory * 2;
+    }
+    if (terark_min_dict_zip_value_size <= 0) {
+        terark_min_dict_zip_value_size = 1024;
+    }
+    if (terark_offset_array_block_units != 64 && terark_offset_array_block_units != 128) {
+        terark_offset_array_block_units = 0;
+    }
+    if (collapse_threshold < 0) {
+        collapse_threshold = 0;
+    }
+    if (collapse_rate <= 0) {
+        collapse_rate = 100;
+    }
     strtolower(&binlog);
     if (binlog != "yes") {
         this->binlog = false;
@@ -40,6 +124,22 @@ void Options::load(const Config &conf){
     if (binlog_capacity <= 0) {
         binlog_capacity = LOG_QUEUE_SIZE;
     }
+    strtolower(&binlog_backend);
+    if (binlog_backend != "wal") {
+        binlog_backend = "oplog";
+    }
+    if (wal_ttl <= 0) {
+        wal_ttl = 86400;
+    }
+    if (wal_size_limit <= 0) {
+        wal_size_limit = 10240;
+    }
+    if (group_commit_size <= 0) {
+        group_commit_size = 64;
+    }
+    if (group_commit_wait < 0) {
+        group_commit_wait = 0;
+    }
 
     if (cache_size <= 0) {
         cache_size = 16;
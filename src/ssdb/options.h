@@ -17,13 +17,50 @@ class Options
     void load(const Config &conf);
 
     size_t cache_size = 0;
+    size_t position_cache_size = 0;
     size_t max_open_files = 0;
     size_t write_buffer_size = 0;
     size_t block_size = 0;
     int compaction_speed = 0;
+    // no, yes (snappy) or zstd: zstd with a dictionary trained per
+    // table for the hash column family, snappy for the others
     std::string compression;
+    int zstd_level = 0;
+    // in bytes
+    int zstd_dict_size = 0;
+    int zstd_train_size = 0;
+    // table profile: point_lookup, scan or bulk
+    std::string profile;
+    // block cache: lru or clock
+    std::string block_cache;
+    // hash names stored as is (none) or folded with their mirror (mirror)
+    std::string canonical;
+    // table format of the data column family: block or terark
+    std::string table_format;
+    // TerarkZipTable tuning, memory sizes in MB
+    std::string terark_temp_dir;
+    int terark_index_nest_level = 0;
+    double terark_index_cache_ratio = 0;
+    double terark_sample_ratio = 0;
+    size_t terark_small_task_memory = 0;
+    size_t terark_soft_zip_memory = 0;
+    size_t terark_hard_zip_memory = 0;
+    size_t terark_min_dict_zip_value_size = 0;
+    int terark_offset_array_block_units = 0;
+    // a read merging at least collapse_threshold operands of a position
+    // has it rewritten as one value, at most collapse_rate a second, 0:
+    // disabled
+    int collapse_threshold = 0;
+    int collapse_rate = 0;
     bool binlog = 0;
     size_t binlog_capacity = 0;
+    // oplog or wal: binlogs in the oplog column family or in the WAL,
+    // which rocksdb keeps for wal_ttl seconds, up to wal_size_limit MB
+    std::string binlog_backend;
+    int wal_ttl = 0;
+    int wal_size_limit = 0;
+    int group_commit_size = 0;
+    int group_commit_wait = 0;
 };
 
 #endif
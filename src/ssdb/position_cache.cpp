@@ -0,0 +1,280 @@
+/*
+  Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+  Use of this source code is governed by a BSD-style license that can be
+  found in the LICENSE file.
+*/
+#include <inttypes.h>
+#include <stdio.h>
+#include <functional>
+
+#include "position_cache.h"
+
+// per entry bookkeeping on top of key and value, roughly
+static const size_t kEntryOverhead = 96;
+
+// count-min sketch of 4 rows of counters saturating at 15
+class FrequencySketch{
+ public:
+    explicit FrequencySketch(size_t width){
+	_width = 1024;
+	while(_width < width){
+	    _width <<= 1;
+	}
+	_table.assign(_width * kRows, 0);
+	_additions = 0;
+    }
+
+    void increment(size_t hash){
+	for(int row=0; row<kRows; row++){
+	    uint8_t &c = _table[row * _width + index(hash, row)];
+	    if(c < 15){
+		c++;
+	    }
+	}
+	// age the counts, so what was hot long ago does not stay forever
+	if(++_additions >= _width * 10){
+	    for(size_t i=0; i<_table.size(); i++){
+		_table[i] >>= 1;
+	    }
+	    _additions /= 2;
+	}
+    }
+
+    int estimate(size_t hash) const{
+	int ret = 15;
+	for(int row=0; row<kRows; row++){
+	    int c = _table[row * _width + index(hash, row)];
+	    if(c < ret){
+		ret = c;
+	    }
+	}
+	return ret;
+    }
+
+ private:
+    static const int kRows = 4;
+
+    size_t index(size_t hash, int row) const{
+	uint64_t x = ((uint64_t)hash + row * 0x9E3779B97F4A7C15ULL) * 0xC2B2AE3D27D4EB4FULL;
+	return (x >> 32) & (_width - 1);
+    }
+
+    size_t _width;
+    std::vector<uint8_t> _table;
+    size_t _additions;
+};
+
+class PositionCache::Shard{
+ public:
+    explicit Shard(size_t capacity)
+	: sketch(capacity / 256){
+	this->window_cap = capacity / 100;
+	this->main_cap = capacity - window_cap;
+	this->protected_cap = main_cap / 5 * 4;
+	this->epoch = 0;
+	for(int i=0; i<3; i++){
+	    this->bytes[i] = 0;
+	}
+	this->hits = 0;
+	this->misses = 0;
+	this->evictions = 0;
+    }
+
+    bool lookup(const std::string &key, size_t hash, Value *value, uint64_t *epoch){
+	Locking l(&mutex);
+	sketch.increment(hash);
+	Map::iterator it = map.find(key);
+	if(it == map.end()){
+	    misses++;
+	    *epoch = this->epoch;
+	    return false;
+	}
+	hits++;
+	Node node = it->second;
+	if(node->segment == PROBATION){
+	    move(node, PROTECTED);
+	    // keep protected in budget, its LRU goes back on probation
+	    while(bytes[PROTECTED] > protected_cap){
+		move(--lists[PROTECTED].end(), PROBATION);
+	    }
+	}else{
+	    lists[node->segment].splice(lists[node->segment].begin(),
+					lists[node->segment], node);
+	}
+	*value = node->value;
+	return true;
+    }
+
+    void insert(const std::string &key, size_t hash, const Value &value, uint64_t epoch){
+	Locking l(&mutex);
+	if(epoch != this->epoch){
+	    return; // written since the value was read
+	}
+	Map::iterator it = map.find(key);
+	if(it != map.end()){
+	    Node node = it->second;
+	    bytes[node->segment] -= node->charge;
+	    node->value = value;
+	    node->charge = key.size() + value->size() + kEntryOverhead;
+	    bytes[node->segment] += node->charge;
+	}else{
+	    Entry entry;
+	    entry.key = key;
+	    entry.hash = hash;
+	    entry.value = value;
+	    entry.charge = key.size() + value->size() + kEntryOverhead;
+	    entry.segment = WINDOW;
+	    lists[WINDOW].push_front(entry);
+	    bytes[WINDOW] += entry.charge;
+	    map[key] = lists[WINDOW].begin();
+	}
+	evict();
+    }
+
+    void erase(const std::string &key){
+	Locking l(&mutex);
+	epoch++;
+	Map::iterator it = map.find(key);
+	if(it != map.end()){
+	    remove(it->second);
+	}
+    }
+
+    void clear(){
+	Locking l(&mutex);
+	epoch++;
+	map.clear();
+	for(int i=0; i<3; i++){
+	    lists[i].clear();
+	    bytes[i] = 0;
+	}
+    }
+
+    void add_stats(uint64_t *counts){
+	Locking l(&mutex);
+	counts[0] += hits;
+	counts[1] += misses;
+	counts[2] += evictions;
+	counts[3] += map.size();
+	counts[4] += bytes[WINDOW] + bytes[PROBATION] + bytes[PROTECTED];
+    }
+
+ private:
+    enum Segment{
+	WINDOW = 0, PROBATION = 1, PROTECTED = 2
+    };
+    struct Entry{
+	std::string key;
+	size_t hash;
+	Value value;
+	size_t charge;
+	int segment;
+    };
+    typedef std::list<Entry>::iterator Node;
+    typedef std::unordered_map<std::string, Node> Map;
+
+    void move(Node node, int segment){
+	bytes[node->segment] -= node->charge;
+	bytes[segment] += node->charge;
+	lists[segment].splice(lists[segment].begin(), lists[node->segment], node);
+	node->segment = segment;
+    }
+
+    void remove(Node node){
+	bytes[node->segment] -= node->charge;
+	map.erase(node->key);
+	lists[node->segment].erase(node);
+    }
+
+    // window overflow goes on probation, then the main LRU victim and the
+    // newcomer compete on frequency until main is back in budget
+    void evict(){
+	while(bytes[WINDOW] > window_cap){
+	    Node candidate = --lists[WINDOW].end();
+	    move(candidate, PROBATION);
+	    while(bytes[PROBATION] + bytes[PROTECTED] > main_cap){
+		Node victim = --lists[PROBATION].end();
+		if(victim == candidate){
+		    break;
+		}
+		if(sketch.estimate(candidate->hash) > sketch.estimate(victim->hash)){
+		    remove(victim);
+		    evictions++;
+		}else{
+		    remove(candidate);
+		    evictions++;
+		    break;
+		}
+	    }
+	}
+	// a lone entry larger than main
+	while(bytes[PROBATION] + bytes[PROTECTED] > main_cap && !lists[PROBATION].empty()){
+	    remove(--lists[PROBATION].end());
+	    evictions++;
+	}
+    }
+
+    Mutex mutex;
+    FrequencySketch sketch;
+    std::list<Entry> lists[3];
+    size_t bytes[3];
+    Map map;
+    size_t window_cap;
+    size_t main_cap;
+    size_t protected_cap;
+    uint64_t epoch;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+PositionCache::PositionCache(size_t capacity, int shards){
+    this->_capacity = capacity;
+    for(int i=0; i<shards; i++){
+	_shards.push_back(new Shard(capacity / shards));
+    }
+}
+
+PositionCache::~PositionCache(){
+    for(size_t i=0; i<_shards.size(); i++){
+	delete _shards[i];
+    }
+}
+
+bool PositionCache::lookup(const std::string &key, Value *value, uint64_t *epoch){
+    size_t hash = std::hash<std::string>()(key);
+    return shard(hash)->lookup(key, hash, value, epoch);
+}
+
+void PositionCache::insert(const std::string &key, const Value &value, uint64_t epoch){
+    size_t hash = std::hash<std::string>()(key);
+    shard(hash)->insert(key, hash, value, epoch);
+}
+
+void PositionCache::erase(const std::string &key){
+    size_t hash = std::hash<std::string>()(key);
+    shard(hash)->erase(key);
+}
+
+void PositionCache::clear(){
+    for(size_t i=0; i<_shards.size(); i++){
+	_shards[i]->clear();
+    }
+}
+
+std::string PositionCache::stats() const{
+    uint64_t counts[5] = {0, 0, 0, 0, 0};
+    for(size_t i=0; i<_shards.size(); i++){
+	_shards[i]->add_stats(counts);
+    }
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+	     "    capacity  : %" PRIu64 "\n"
+	     "    hits      : %" PRIu64 "\n"
+	     "    misses    : %" PRIu64 "\n"
+	     "    evictions : %" PRIu64 "\n"
+	     "    entries   : %" PRIu64 "\n"
+	     "    bytes     : %" PRIu64,
+	     (uint64_t)_capacity, counts[0], counts[1], counts[2], counts[3], counts[4]);
+    return buf;
+}
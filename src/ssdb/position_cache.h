@@ -0,0 +1,65 @@
+/*
+  Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+  Use of this source code is governed by a BSD-style license that can be
+  found in the LICENSE file.
+*/
+#ifndef SSDB_POSITION_CACHE_H_
+#define SSDB_POSITION_CACHE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../util/thread.h"
+
+// In-process cache of packed hash values, keyed by the encoded position.
+//
+// Admission is W-TinyLFU: a new value enters a small LRU window, and
+// when it falls out of the window it only replaces the LRU victim of the
+// main segmented LRU if it has been asked for more often, as estimated
+// by a count-min sketch that is halved periodically. A burst of one-off
+// positions churns the window only, the hot book stays.
+//
+// Values are shared_ptr, a hit hands out a reference instead of a copy.
+//
+// A reader that misses gets the shard epoch and passes it back to
+// insert(). Writers erase() after their commit, which bumps the epoch,
+// so a value read from rocksdb before a write can not be cached after it.
+class PositionCache{
+ public:
+    typedef std::shared_ptr<const std::string> Value;
+
+    // capacity in bytes, split evenly between the shards
+    explicit PositionCache(size_t capacity, int shards=64);
+    ~PositionCache();
+
+    // true on hit, on miss *epoch is what to give back to insert()
+    bool lookup(const std::string &key, Value *value, uint64_t *epoch);
+    void insert(const std::string &key, const Value &value, uint64_t epoch);
+    void erase(const std::string &key);
+    void clear();
+
+    size_t capacity() const{
+	return _capacity;
+    }
+    std::string stats() const;
+
+ private:
+    class Shard;
+
+    Shard* shard(size_t hash) const{
+	return _shards[hash % _shards.size()];
+    }
+
+    size_t _capacity;
+    std::vector<Shard*> _shards;
+
+    // No copying allowed
+    PositionCache(const PositionCache&);
+    void operator=(const PositionCache&);
+};
+
+#endif
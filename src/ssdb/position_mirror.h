@@ -0,0 +1,82 @@
+#ifndef SSDB_POSITION_MIRROR_H_
+#define SSDB_POSITION_MIRROR_H_
+
+#include <algorithm>
+#include <string>
+#include "../util/bytes.h"
+#include "hash_encoder.h"
+
+// Picks the orientation a position is stored in. A position and its
+// left-right mirror (file a <-> i) have the same scores on mirrored
+// moves, so only one of the two is kept, and the fields of the other
+// are mirrored on the way in and out.
+class PositionMirror {
+ public:
+  virtual ~PositionMirror() {}
+
+  // 1 if the position is stored as its mirror, 0 if as is. *stored is
+  // the name it is stored under either way.
+  virtual int canonical(const Bytes& name, std::string* stored) = 0;
+};
+
+// FEN-like names: 10 ranks of 9 files separated by '/', a digit for a
+// run of empty squares, then anything after a space (side to move...),
+// which is kept. The smaller of a board and its mirror is stored, names
+// that are not such a board are stored as is.
+class FenMirror : public PositionMirror {
+ public:
+  int canonical(const Bytes& name, std::string* stored) override {
+    stored->assign(name.data(), name.size());
+    std::string::size_type board = stored->find(' ');
+    if (board == std::string::npos) {
+      board = stored->size();
+    }
+    if (!valid_board(stored->data(), board)) {
+      return 0;
+    }
+    std::string mirrored(*stored);
+    // reversing each rank mirrors it, a run count is a single digit
+    std::string::size_type start = 0;
+    while (start < board) {
+      std::string::size_type end = mirrored.find('/', start);
+      if (end == std::string::npos || end > board) {
+	end = board;
+      }
+      std::reverse(mirrored.begin() + start, mirrored.begin() + end);
+      start = end + 1;
+    }
+    if (mirrored.compare(0, board, *stored, 0, board) >= 0) {
+      return 0;
+    }
+    stored->swap(mirrored);
+    return 1;
+  }
+
+ private:
+  static bool valid_board(const char* p, size_t size) {
+    int ranks = 1;
+    int files = 0;
+    for (size_t i = 0; i < size; i++) {
+      char c = p[i];
+      if (c == '/') {
+	if (files != kBoardFiles) {
+	  return false;
+	}
+	ranks++;
+	files = 0;
+      } else if (c >= '1' && c <= '9') {
+	files += c - '0';
+      } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+	files++;
+      } else {
+	return false;
+      }
+      if (files > kBoardFiles) {
+	return false;
+      }
+    }
+    return ranks == kBoardRanks && files == kBoardFiles;
+  }
+};
+
+#endif
@@ -31,6 +31,15 @@ class SSDB{
     virtual uint64_t size() = 0;
     virtual std::vector<std::string> info() = 0;
     virtual void compact() = 0;
+    // ingest sst files of hash values, made by tools/ssdb-ingest, into
+    // the hash column family, they are moved there. Not written to the
+    // binlog, an INGEST barrier is, slaves copy all the data again then.
+    // -1: error, 1: ok
+    virtual int ingest(const std::vector<std::string> &files) = 0;
+    // in bulk load mode writes skip the WAL and the binlog, and the hash
+    // column family stalls less, leaving it flushes and compacts it.
+    // -1: error, 0: already in that mode, 1: ok
+    virtual int bulkload(bool on) = 0;
     virtual int key_range(std::vector<std::string> *keys) = 0;
 
     /* raw operates */
@@ -60,15 +69,25 @@ class SSDB{
     /* hash */
     virtual int hset(const Bytes &name, const Bytes &key, const Bytes &val, char log_type=BinlogType::SYNC) = 0;
     virtual int hset(const Bytes &key, const Bytes &val, char log_type=BinlogType::SYNC) = 0;
+    // merges an operand into the position stored under key, as is
+    virtual int hmerge(const Bytes &key, const Bytes &operand, char log_type=BinlogType::SYNC) = 0;
     virtual int hdel(const Bytes &name, const Bytes &key, char log_type=BinlogType::SYNC) = 0;
-    // -1: error, 1: ok, 0: value is not an integer or out of range
+    // -1: error, 1: ok, 0: value is not an integer or out of range.
+    // new_val NULL keeps it a blind write, the score is not read back
     virtual int hincr(const Bytes &name, const Bytes &key, int64_t by, int64_t *new_val, char log_type=BinlogType::SYNC) = 0;
+    // one merge operand for all fields, @return -1: error, other: number of fields
+    virtual int multi_hset(const Bytes &name, const std::vector<Bytes> &kvs, int offset=0, char log_type=BinlogType::SYNC) = 0;
+    virtual int multi_hdel(const Bytes &name, const std::vector<Bytes> &keys, int offset=0, char log_type=BinlogType::SYNC) = 0;
     virtual int migrate_hset(const std::vector<Bytes>& items, char log_type=BinlogType::SYNC) = 0;
 
     virtual int64_t hsize(const Bytes &name) = 0;
     virtual int64_t hclear(const Bytes &name) = 0;
     virtual int hget(const Bytes& key, std::string* val) = 0;
     virtual int hget(const Bytes& key, const Bytes& field, std::string* val) = 0;
+    virtual int hexists(const Bytes& key, const Bytes& field) = 0;
+    // values of keys[offset...] with one MultiGet, batch sized to match
+    // @return -1: error, other: number of keys found
+    virtual int multi_hget_values(const std::vector<Bytes> &keys, int offset, HashValueBatch *batch) = 0;
     virtual int hlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 		      std::vector<std::string> *list) = 0;
     virtual int hrlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
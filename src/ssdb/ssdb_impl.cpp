@@ -8,8 +8,18 @@
 #include "rocksdb/iterator.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/filter_policy.h"
+#include "rocksdb/rate_limiter.h"
+#include "rocksdb/table.h"
+#include "rocksdb/version.h"
+#ifdef SSDB_WITH_TERARK
+#include "table/terark_zip_table.h"
+#endif
 
+#include "chess_compaction_filter.h"
 #include "chess_merger.h"
+#include "position_cache.h"
+#include "position_mirror.h"
+#include "merge_collapser.h"
 #include "iterator.h"
 #include "t_kv.h"
 #include "t_hash.h"
@@ -19,10 +29,18 @@
 SSDBImpl::SSDBImpl(){
   ldb = NULL;
   _binlogs = NULL;
+  _compaction_filter = NULL;
+  _pos_cache = NULL;
+  _mirror = NULL;
+  _collapser = NULL;
   _encoder = new ChessHashEncoder;
 }
 
 SSDBImpl::~SSDBImpl() {
+  // its thread writes through _binlogs
+  if (_collapser) {
+    delete _collapser;
+  }
   if (_binlogs) {
     delete _binlogs;
   }
@@ -32,6 +50,15 @@ SSDBImpl::~SSDBImpl() {
     }
     delete ldb;
   }
+  if (_compaction_filter) {
+    delete _compaction_filter;
+  }
+  if (_pos_cache) {
+    delete _pos_cache;
+  }
+  if (_mirror) {
+    delete _mirror;
+  }
 	
   /*if(options.block_cache){
     delete options.block_cache;
@@ -41,42 +68,229 @@ SSDBImpl::~SSDBImpl() {
     }*/
 }
 
+static std::shared_ptr<rocksdb::Cache> new_block_cache(const Options &opt){
+  size_t capacity = opt.cache_size * 1024 * 1024;
+#if ROCKSDB_MAJOR < 8
+  if (opt.block_cache == "clock") {
+    // null if rocksdb was built without tbb
+    std::shared_ptr<rocksdb::Cache> cache = rocksdb::NewClockCache(capacity);
+    if (cache) {
+      return cache;
+    }
+    log_warn("clock cache not supported, use lru");
+  }
+#endif
+  return rocksdb::NewLRUCache(capacity);
+}
+
+// Table options of a profile.
+//   point_lookup: full-key bloom filters, a hash index inside data
+//                 blocks, so a Get() seldom touches more than one block
+//   scan:         plain binary search blocks, four times as large
+//   bulk:         point_lookup tables, with write buffers and L0
+//                 triggers raised for loading, see apply_profile()
+static rocksdb::BlockBasedTableOptions table_options(const std::string &profile,
+						     const Options &opt,
+						     const std::shared_ptr<rocksdb::Cache> &cache){
+  rocksdb::BlockBasedTableOptions table;
+  table.block_cache = cache;
+  table.block_size = opt.block_size * 1024;
+  table.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, false));
+  table.whole_key_filtering = true;
+  // index and filters compete with data in the cache, but L0 ones are
+  // read by every lookup, keep them in
+  table.cache_index_and_filter_blocks = true;
+  table.pin_l0_filter_and_index_blocks_in_cache = true;
+  if (profile == "scan") {
+    table.block_size *= 4;
+  } else {
+    table.data_block_index_type = rocksdb::BlockBasedTableOptions::kDataBlockBinaryAndHash;
+    table.data_block_hash_table_util_ratio = 0.75;
+  }
+  return table;
+}
+
+static void apply_profile(const std::string &profile, const Options &opt,
+			  const std::shared_ptr<rocksdb::Cache> &cache,
+			  rocksdb::ColumnFamilyOptions *cf){
+  cf->write_buffer_size = opt.write_buffer_size * 1024 * 1024;
+  cf->compression = (opt.compression == "no")? rocksdb::kNoCompression : rocksdb::kSnappyCompression;
+  cf->table_factory.reset(rocksdb::NewBlockBasedTableFactory(
+      table_options(profile, opt, cache)));
+  if (profile == "point_lookup") {
+    cf->memtable_whole_key_filtering = true;
+    cf->memtable_prefix_bloom_size_ratio = 0.02;
+  } else if (profile == "bulk") {
+    cf->write_buffer_size *= 4;
+    cf->max_write_buffer_number = 6;
+    cf->level0_file_num_compaction_trigger = 8;
+    cf->level0_slowdown_writes_trigger = 40;
+    cf->level0_stop_writes_trigger = 60;
+  }
+}
+
+// Packed positions are a few dozen bytes of the same move codes and close
+// scores, too small for snappy to find repeats within one of them. zstd
+// with a dictionary trained on samples of each table compresses them
+// against all the others. TerarkZipTable does its own compression.
+static void apply_compression(const Options &opt, rocksdb::ColumnFamilyOptions *cf){
+  if (opt.compression != "zstd") {
+    return;
+  }
+  cf->compression = rocksdb::kZSTD;
+  cf->compression_opts.level = opt.zstd_level;
+  cf->compression_opts.max_dict_bytes = opt.zstd_dict_size;
+  cf->compression_opts.zstd_max_train_bytes = opt.zstd_train_size;
+}
+
+// Put the data column family on TerarkZipTable. The block based factory
+// stays as the fallback, tables written before the switch are still read
+// through it until compaction rewrites them.
+static void apply_table_format(const Options &opt, rocksdb::ColumnFamilyOptions *cf){
+  if (opt.table_format != "terark") {
+    return;
+  }
+#ifdef SSDB_WITH_TERARK
+  rocksdb::TerarkZipTableOptions tzo;
+  tzo.localTempDir = opt.terark_temp_dir;
+  tzo.indexNestLevel = opt.terark_index_nest_level;
+  tzo.indexCacheRatio = opt.terark_index_cache_ratio;
+  tzo.sampleRatio = opt.terark_sample_ratio;
+  tzo.smallTaskMemory = opt.terark_small_task_memory << 20;
+  tzo.softZipWorkingMemLimit = opt.terark_soft_zip_memory << 20;
+  tzo.hardZipWorkingMemLimit = opt.terark_hard_zip_memory << 20;
+  tzo.minDictZipValueSize = opt.terark_min_dict_zip_value_size;
+  tzo.offsetArrayBlockUnits = opt.terark_offset_array_block_units;
+  cf->table_factory.reset(rocksdb::NewTerarkZipTableFactory(tzo, cf->table_factory));
+#else
+  log_warn("built without terark, table_format falls back to block");
+#endif
+}
+
+// Before every data type had its own column family, all of them lived in
+// the default one, move the keys of the other types out. Values are read
+// merged, pending merges of a position are resolved on the way.
+static int split_column_families(rocksdb::DB *db,
+				 const std::vector<rocksdb::ColumnFamilyHandle*> &handles){
+  static const char types[] = {
+    DataType::HASH, DataType::HSIZE, DataType::ZSET, DataType::ZSCORE,
+    DataType::ZSIZE, DataType::QUEUE, DataType::QSIZE
+  };
+  rocksdb::ReadOptions iterate_options;
+  iterate_options.fill_cache = false;
+  rocksdb::Iterator *it = db->NewIterator(iterate_options, handles[ColumnFamily::DEFAULT]);
+  rocksdb::WriteBatch batch;
+  rocksdb::Status s;
+  int64_t moved = 0;
+  for (size_t i = 0; i < sizeof(types) && s.ok(); i++) {
+    rocksdb::ColumnFamilyHandle *cf = handles[ColumnFamily::of(types[i])];
+    for (it->Seek(std::string(1, types[i])); it->Valid(); it->Next()) {
+      if (it->key()[0] != types[i]) {
+	break;
+      }
+      batch.Put(cf, it->key(), it->value());
+      batch.Delete(handles[ColumnFamily::DEFAULT], it->key());
+      if (++moved % 10000 == 0) {
+	s = db->Write(rocksdb::WriteOptions(), &batch);
+	batch.Clear();
+	if (!s.ok()) {
+	  break;
+	}
+	log_info("moved %" PRId64 " keys to their column families", moved);
+      }
+    }
+  }
+  if (s.ok()) {
+    s = it->status();
+  }
+  delete it;
+  if (s.ok() && batch.Count() > 0) {
+    s = db->Write(rocksdb::WriteOptions(), &batch);
+  }
+  if (!s.ok()) {
+    log_error("split column families error: %s", s.ToString().c_str());
+    return -1;
+  }
+  if (moved > 0) {
+    log_info("moved %" PRId64 " keys to their column families", moved);
+  }
+  return 0;
+}
+
 SSDB* SSDB::open(const Options &opt, const std::string &dir){
   SSDBImpl *ssdb = new SSDBImpl();
+  // one block cache for all column families
+  std::shared_ptr<rocksdb::Cache> cache = new_block_cache(opt);
   ssdb->options.create_if_missing = true;
+  ssdb->options.max_open_files = opt.max_open_files;
+  if (opt.compaction_speed > 0) {
+    ssdb->options.rate_limiter.reset(rocksdb::NewGenericRateLimiter(
+	(int64_t)opt.compaction_speed * 1024 * 1024));
+  }
+  ssdb->options.create_missing_column_families = true;
+  if (opt.binlog && opt.binlog_backend == "wal") {
+    // the binlogs are read from the WAL, so it is kept after flushes
+    ssdb->options.WAL_ttl_seconds = opt.wal_ttl;
+    ssdb->options.WAL_size_limit_MB = opt.wal_size_limit;
+  }
+  // kv, the profile of the config
+  apply_profile(opt.profile, opt, cache, &ssdb->options);
+  // hashes of a db from before the column families were split are read
+  // through it once, see split_column_families()
   ssdb->options.merge_operator = std::make_shared<ChessMergeOperator>();
-  static const std::string kOplogCF = "oplogCF";
+  // chess positions: the profile and table format of the config, merged
+  // writes, emptied positions dropped by compactions
+  rocksdb::ColumnFamilyOptions hashOption(ssdb->options);
+  apply_compression(opt, &hashOption);
+  apply_table_format(opt, &hashOption);
+  ssdb->_compaction_filter = new ChessCompactionFilter;
+  hashOption.compaction_filter = ssdb->_compaction_filter;
+  // zset scores are scanned in order, the ttl list is one of them
+  rocksdb::ColumnFamilyOptions zsetOption;
+  apply_profile("scan", opt, cache, &zsetOption);
+  // queue items are read one by one, by seq
+  rocksdb::ColumnFamilyOptions queueOption;
+  apply_profile("point_lookup", opt, cache, &queueOption);
+  // binlogs are read in seq order, never looked up at random, they stay
+  // block based whatever the table format of the data
   rocksdb::ColumnFamilyOptions oplogOption;
   oplogOption.write_buffer_size = opt.write_buffer_size * 1024 * 1024;
   oplogOption.target_file_size_base = oplogOption.write_buffer_size;
+  oplogOption.table_factory.reset(rocksdb::NewBlockBasedTableFactory(
+      table_options("scan", opt, cache)));
+  // in ColumnFamily order
   std::vector<rocksdb::ColumnFamilyDescriptor> cfDescriptors = {
     rocksdb::ColumnFamilyDescriptor(rocksdb::kDefaultColumnFamilyName, ssdb->options),
-    rocksdb::ColumnFamilyDescriptor(kOplogCF, oplogOption)
+    rocksdb::ColumnFamilyDescriptor("oplogCF", oplogOption),
+    rocksdb::ColumnFamilyDescriptor("hashCF", hashOption),
+    rocksdb::ColumnFamilyDescriptor("zsetCF", zsetOption),
+    rocksdb::ColumnFamilyDescriptor("queueCF", queueOption)
   };
   rocksdb::DB* db = nullptr;
-  rocksdb::Status status;
-  int cnt = 0;
-  while (cnt < 2) {
-    status = rocksdb::DB::Open(ssdb->options, dir, cfDescriptors, &ssdb->_cfHandles, &db);
-    if (!status.ok()) {
-      status = rocksdb::DB::OpenForReadOnly(ssdb->options, dir, &db);
-      assert(status.ok());
-      rocksdb::ColumnFamilyHandle* cf = nullptr;
-      status = db->CreateColumnFamily(oplogOption, kOplogCF, &cf);
-      assert(status.ok());
-      delete cf;
-      delete db;
-      cnt ++;
-    } else {
-      break;
-    }
-  }
+  rocksdb::Status status = rocksdb::DB::Open(ssdb->options, dir, cfDescriptors,
+					     &ssdb->_cfHandles, &db);
   if (!status.ok()) {
     log_error("open db failed: %s", status.ToString().c_str());
     goto err;
   }
   ssdb->ldb = db;
-  ssdb->_binlogs = new BinlogQueue(ssdb->ldb, ssdb->_cfHandles, opt.binlog, opt.binlog_capacity);
+  if (split_column_families(db, ssdb->_cfHandles) == -1) {
+    goto err;
+  }
+  ssdb->_binlogs = new BinlogQueue(ssdb->ldb, ssdb->_cfHandles, opt.binlog, opt.binlog_capacity,
+				   opt.binlog_backend == "wal");
+  ssdb->_binlogs->set_group_commit(opt.group_commit_size, opt.group_commit_wait);
+  if (opt.position_cache_size > 0) {
+    ssdb->_pos_cache = new PositionCache(opt.position_cache_size * 1024 * 1024);
+  }
+  if (opt.canonical == "mirror") {
+    ssdb->_mirror = new FenMirror;
+  }
+  if (opt.collapse_threshold > 0) {
+    ssdb->_collapser = new MergeCollapser(ssdb->ldb, ssdb->_cfHandles[ColumnFamily::HASH],
+					  ssdb->_binlogs,
+					  opt.collapse_threshold, opt.collapse_rate);
+  }
 
   return ssdb;
  err:
@@ -89,50 +303,71 @@ SSDB* SSDB::open(const Options &opt, const std::string &dir){
 int SSDBImpl::flushdb(){
   Transaction trans(_binlogs);
   int ret = 0;
-  bool stop = false;
-  while(!stop){
-    rocksdb::Iterator *it;
-    rocksdb::ReadOptions iterate_options;
-    iterate_options.fill_cache = false;
-    rocksdb::WriteOptions write_opts;
-
-    it = ldb->NewIterator(iterate_options);
-    it->SeekToFirst();
-    for(int i=0; i<10000; i++){
-      if(!it->Valid()){
-	stop = true;
-	break;
-      }
-      //log_debug("%s", hexmem(it->key().data(), it->key().size()).c_str());
-      rocksdb::Status s = ldb->Delete(write_opts, it->key());
-      if(!s.ok()){
-	log_error("del error: %s", s.ToString().c_str());
-	stop = true;
-	ret = -1;
-	break;
+  for(int cf=0; cf<ColumnFamily::COUNT && ret == 0; cf++){
+    if(cf == ColumnFamily::OPLOG){
+      continue;
+    }
+    bool stop = false;
+    while(!stop){
+      rocksdb::Iterator *it;
+      rocksdb::ReadOptions iterate_options;
+      iterate_options.fill_cache = false;
+      rocksdb::WriteOptions write_opts;
+
+      it = ldb->NewIterator(iterate_options, _cfHandles[cf]);
+      it->SeekToFirst();
+      for(int i=0; i<10000; i++){
+	if(!it->Valid()){
+	  stop = true;
+	  break;
+	}
+	//log_debug("%s", hexmem(it->key().data(), it->key().size()).c_str());
+	rocksdb::Status s = ldb->Delete(write_opts, _cfHandles[cf], it->key());
+	if(!s.ok()){
+	  log_error("del error: %s", s.ToString().c_str());
+	  stop = true;
+	  ret = -1;
+	  break;
+	}
+	it->Next();
       }
-      it->Next();
+      delete it;
     }
-    delete it;
   }
   _binlogs->flush();
+  if (_pos_cache) {
+    _pos_cache->clear();
+  }
   return ret;
 }
 
-Iterator* SSDBImpl::iterator(const std::string &start, const std::string &end, uint64_t limit){
-  rocksdb::Iterator *it;
+// the keys of one type are in its column family, wider ranges merge the
+// iterators of all of them
+rocksdb::Iterator* SSDBImpl::new_iterator(const std::string &start, const std::string &end){
   rocksdb::ReadOptions iterate_options;
   iterate_options.fill_cache = false;
-  it = ldb->NewIterator(iterate_options);
+  if(!start.empty() && !end.empty() && start[0] == end[0]){
+    return ldb->NewIterator(iterate_options, cf(start));
+  }
+  // one snapshot, so a scan across the families sees one state of the db
+  iterate_options.snapshot = ldb->GetSnapshot();
+  std::vector<rocksdb::Iterator*> children;
+  for(int i=0; i<ColumnFamily::COUNT; i++){
+    if(i != ColumnFamily::OPLOG){
+      children.push_back(ldb->NewIterator(iterate_options, _cfHandles[i]));
+    }
+  }
+  return new_merging_iterator(children, ldb, iterate_options.snapshot);
+}
+
+Iterator* SSDBImpl::iterator(const std::string &start, const std::string &end, uint64_t limit){
+  rocksdb::Iterator *it = new_iterator(start, end);
   it->Seek(start);
   return new Iterator(it, end, limit);
 }
 
 Iterator* SSDBImpl::rev_iterator(const std::string &start, const std::string &end, uint64_t limit){
-  rocksdb::Iterator *it;
-  rocksdb::ReadOptions iterate_options;
-  iterate_options.fill_cache = false;
-  it = ldb->NewIterator(iterate_options);
+  rocksdb::Iterator *it = new_iterator(start, end);
   it->Seek(start);
   if(!it->Valid()){
     it->SeekToLast();
@@ -146,7 +381,10 @@ Iterator* SSDBImpl::rev_iterator(const std::string &start, const std::string &en
 
 int SSDBImpl::raw_set(const Bytes &key, const Bytes &val){
   rocksdb::WriteOptions write_opts;
-  rocksdb::Status s = ldb->Put(write_opts, slice(key), slice(val));
+  rocksdb::Status s = ldb->Put(write_opts, cf(key), slice(key), slice(val));
+  if(_pos_cache){
+    _pos_cache->erase(key.String());
+  }
   if(!s.ok()){
     log_error("set error: %s", s.ToString().c_str());
     return -1;
@@ -156,7 +394,10 @@ int SSDBImpl::raw_set(const Bytes &key, const Bytes &val){
 
 int SSDBImpl::raw_del(const Bytes &key){
   rocksdb::WriteOptions write_opts;
-  rocksdb::Status s = ldb->Delete(write_opts, slice(key));
+  rocksdb::Status s = ldb->Delete(write_opts, cf(key), slice(key));
+  if(_pos_cache){
+    _pos_cache->erase(key.String());
+  }
   if(!s.ok()){
     log_error("del error: %s", s.ToString().c_str());
     return -1;
@@ -167,7 +408,7 @@ int SSDBImpl::raw_del(const Bytes &key){
 int SSDBImpl::raw_get(const Bytes &key, std::string *val){
   rocksdb::ReadOptions opts;
   opts.fill_cache = false;
-  rocksdb::Status s = ldb->Get(opts, slice(key), val);
+  rocksdb::Status s = ldb->Get(opts, cf(key), slice(key), val);
   if(s.IsNotFound()){
     return 0;
   }
@@ -183,9 +424,16 @@ uint64_t SSDBImpl::size(){
   std::string e(1, 'z' + 1);
   rocksdb::Range ranges[1];
   ranges[0] = rocksdb::Range(s, e);
-  uint64_t sizes[1];
-  ldb->GetApproximateSizes(ranges, 1, sizes);
-  return sizes[0];
+  uint64_t ret = 0;
+  for(int i=0; i<ColumnFamily::COUNT; i++){
+    if(i == ColumnFamily::OPLOG){
+      continue;
+    }
+    uint64_t sizes[1];
+    ldb->GetApproximateSizes(_cfHandles[i], ranges, 1, sizes);
+    ret += sizes[0];
+  }
+  return ret;
 }
 
 std::vector<std::string> SSDBImpl::info(){
@@ -215,6 +463,35 @@ std::vector<std::string> SSDBImpl::info(){
       info.push_back(val);
     }
   }
+  // each column family flushes and compacts on its own
+  for(size_t i=0; i<_cfHandles.size(); i++){
+    uint64_t keys = 0, sst = 0, mem = 0, pending = 0;
+    ldb->GetIntProperty(_cfHandles[i], "rocksdb.estimate-num-keys", &keys);
+    ldb->GetIntProperty(_cfHandles[i], "rocksdb.total-sst-files-size", &sst);
+    ldb->GetIntProperty(_cfHandles[i], "rocksdb.cur-size-all-mem-tables", &mem);
+    ldb->GetIntProperty(_cfHandles[i], "rocksdb.estimate-pending-compaction-bytes", &pending);
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+	     "    keys      : %" PRIu64 "\n"
+	     "    sst       : %.2f MB\n"
+	     "    memtables : %.2f MB\n"
+	     "    pending compaction : %.2f MB",
+	     keys, sst / 1024.0 / 1024.0, mem / 1024.0 / 1024.0, pending / 1024.0 / 1024.0);
+    info.push_back("rocksdb.cf." + _cfHandles[i]->GetName());
+    info.push_back(buf);
+  }
+  if (_compaction_filter) {
+    info.push_back("chess.compaction");
+    info.push_back(_compaction_filter->stats());
+  }
+  if (_pos_cache) {
+    info.push_back("chess.position_cache");
+    info.push_back(_pos_cache->stats());
+  }
+  if (_collapser) {
+    info.push_back("chess.merge_collapse");
+    info.push_back(_collapser->stats());
+  }
 
   return info;
 }
@@ -226,6 +503,109 @@ void SSDBImpl::compact(){
   }
 }
 
+// Values in the files are either whole positions, which replace the
+// stored ones, or merge operands applied on top of them.
+int SSDBImpl::ingest(const std::vector<std::string> &files){
+  rocksdb::IngestExternalFileOptions opts;
+  opts.move_files = true;
+  rocksdb::Status s = ldb->IngestExternalFile(_cfHandles[ColumnFamily::HASH], files, opts);
+  // readers that missed before the ingest do not insert what they read
+  if (_pos_cache) {
+    _pos_cache->clear();
+  }
+  if(!s.ok()){
+    log_error("ingest error: %s", s.ToString().c_str());
+    return -1;
+  }
+  // the files are not in the binlog, slaves copy the data again from here
+  {
+    Transaction trans(_binlogs);
+    _binlogs->add_log(BinlogType::CTRL, BinlogCommand::NONE, std::string("INGEST"));
+    s = _binlogs->commit();
+  }
+  if(!s.ok()){
+    log_error("ingest binlog error: %s", s.ToString().c_str());
+    return -1;
+  }
+  return 1;
+}
+
+// hash options of the bulk load mode, memtables are only flushed when
+// large, L0 files pile up without stalling writes, and are compacted
+// once at the end of the load. The memtable rep can not be changed on a
+// live column family, it stays a skip list.
+static const char *kBulkOptions[][2] = {
+  {"write_buffer_size", NULL},
+  {"max_write_buffer_number", "6"},
+  {"level0_slowdown_writes_trigger", "1000"},
+  {"level0_stop_writes_trigger", "2000"},
+  {"disable_auto_compactions", "true"},
+};
+static const int kBulkOptionCount = sizeof(kBulkOptions) / sizeof(kBulkOptions[0]);
+
+int SSDBImpl::bulkload(bool on){
+  Locking l(&_bulk_mutex);
+  if (on == _binlogs->bulkload()) {
+    return 0;
+  }
+  rocksdb::ColumnFamilyHandle *hash = _cfHandles[ColumnFamily::HASH];
+  rocksdb::Status s;
+  if (on) {
+    rocksdb::Options current = ldb->GetOptions(hash);
+    _bulk_saved.clear();
+    _bulk_saved["write_buffer_size"] = str((uint64_t)current.write_buffer_size);
+    _bulk_saved["max_write_buffer_number"] = str(current.max_write_buffer_number);
+    _bulk_saved["level0_slowdown_writes_trigger"] = str(current.level0_slowdown_writes_trigger);
+    _bulk_saved["level0_stop_writes_trigger"] = str(current.level0_stop_writes_trigger);
+    _bulk_saved["disable_auto_compactions"] = current.disable_auto_compactions? "true" : "false";
+    std::unordered_map<std::string, std::string> bulk;
+    for (int i = 0; i < kBulkOptionCount; i++) {
+      bulk[kBulkOptions[i][0]] = kBulkOptions[i][1]? kBulkOptions[i][1]
+	: str((uint64_t)current.write_buffer_size * 4);
+    }
+    s = ldb->SetOptions(hash, bulk);
+    if (!s.ok()) {
+      log_error("bulkload begin error: %s", s.ToString().c_str());
+      return -1;
+    }
+    _binlogs->set_bulkload(true);
+    log_info("bulkload begin, WAL and binlog off");
+    return 1;
+  }
+
+  _binlogs->set_bulkload(false);
+  // what was written without WAL is durable only once flushed
+  for (size_t i = 0; i < _cfHandles.size(); i++) {
+    s = ldb->Flush(rocksdb::FlushOptions(), _cfHandles[i]);
+    if (!s.ok()) {
+      log_error("bulkload end flush error: %s", s.ToString().c_str());
+      return -1;
+    }
+  }
+  s = ldb->SetOptions(hash, _bulk_saved);
+  if (!s.ok()) {
+    log_error("bulkload end error: %s", s.ToString().c_str());
+    return -1;
+  }
+  log_info("bulkload end, compacting");
+  s = ldb->CompactRange(rocksdb::CompactRangeOptions(), hash, NULL, NULL);
+  if (!s.ok()) {
+    log_error("bulkload end compact error: %s", s.ToString().c_str());
+  }
+  // slaves missed the load, this marks where in the binlog it ended
+  {
+    Transaction trans(_binlogs);
+    _binlogs->add_log(BinlogType::CTRL, BinlogCommand::NONE, std::string("BULKLOAD"));
+    s = _binlogs->commit();
+  }
+  if (!s.ok()) {
+    log_error("bulkload end binlog error: %s", s.ToString().c_str());
+    return -1;
+  }
+  log_info("bulkload end");
+  return 1;
+}
+
 int SSDBImpl::key_range(std::vector<std::string> *keys){
   int ret = 0;
   std::string kstart, kend;
@@ -6,7 +6,7 @@
 #ifndef SSDB_IMPL_H_
 #define SSDB_IMPL_H_
 
-#include <mutex>
+#include <unordered_map>
 #include "rocksdb/db.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/options.h"
@@ -21,20 +21,32 @@
 #include "t_zset.h"
 #include "t_queue.h"
 #include "hash_encoder.h"
+#include "const.h"
 
 inline
 static rocksdb::Slice slice(const Bytes &b){
     return rocksdb::Slice(b.data(), b.size());
 }
 
+class ChessCompactionFilter;
+class PositionCache;
+class PositionMirror;
+class MergeCollapser;
+
 class SSDBImpl : public SSDB {
  private:
     friend class SSDB;
     rocksdb::DB* ldb;
     rocksdb::Options options;
     std::vector<rocksdb::ColumnFamilyHandle*> _cfHandles;
-    std::mutex _mutex;
+    ChessCompactionFilter* _compaction_filter;
+    PositionCache* _pos_cache;
+    PositionMirror* _mirror;
+    MergeCollapser* _collapser;
 	HashEncoder* _encoder;
+    // guards the bulk load mode, and the hash options it replaced
+    Mutex _bulk_mutex;
+    std::unordered_map<std::string, std::string> _bulk_saved;
     
     SSDBImpl();
  public:
@@ -52,6 +64,8 @@ class SSDBImpl : public SSDB {
     virtual uint64_t size();
     virtual std::vector<std::string> info();
     virtual void compact();
+    virtual int ingest(const std::vector<std::string> &files);
+    virtual int bulkload(bool on);
     virtual int key_range(std::vector<std::string> *keys);
 	
     /* raw operates */
@@ -83,17 +97,21 @@ class SSDBImpl : public SSDB {
 
     virtual int hset(const Bytes &name, const Bytes &key, const Bytes &val, char log_type=BinlogType::SYNC);
     virtual int hset(const Bytes &key, const Bytes &val, char log_type=BinlogType::SYNC);
+    virtual int hmerge(const Bytes &key, const Bytes &operand, char log_type=BinlogType::SYNC);
     virtual int hdel(const Bytes &name, const Bytes &key, char log_type=BinlogType::SYNC);
-    // -1: error, 1: ok, 0: value is not an integer or out of range
+    // -1: error, 1: ok, 0: not a move or by out of range, a blind write,
+    // new_val is not set
     virtual int hincr(const Bytes &name, const Bytes &key, int64_t by, int64_t *new_val, char log_type=BinlogType::SYNC);
-    //int multi_hset(const Bytes &name, const std::vector<Bytes> &kvs, int offset=0, char log_type=BinlogType::SYNC);
-    //int multi_hdel(const Bytes &name, const std::vector<Bytes> &keys, int offset=0, char log_type=BinlogType::SYNC);
+    virtual int multi_hset(const Bytes &name, const std::vector<Bytes> &kvs, int offset=0, char log_type=BinlogType::SYNC);
+    virtual int multi_hdel(const Bytes &name, const std::vector<Bytes> &keys, int offset=0, char log_type=BinlogType::SYNC);
     virtual int migrate_hset(const std::vector<Bytes>& items, char log_type=BinlogType::SYNC);
 
     virtual int64_t hsize(const Bytes &name);
     virtual int64_t hclear(const Bytes &name);
     virtual int hget(const Bytes& key, std::string* val);
     virtual int hget(const Bytes& key, const Bytes& field, std::string* val);
+    virtual int hexists(const Bytes& key, const Bytes& field);
+    virtual int multi_hget_values(const std::vector<Bytes> &keys, int offset, HashValueBatch *batch);
     virtual int hlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 		      std::vector<std::string> *list);
     virtual int hrlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
@@ -156,6 +174,20 @@ class SSDBImpl : public SSDB {
     virtual int qset_by_seq(const Bytes &name, uint64_t seq, const Bytes &item, char log_type=BinlogType::SYNC);
 
  private:
+    // the column family of a data key
+    rocksdb::ColumnFamilyHandle* cf(const Bytes &key) const{
+	return _cfHandles[key.empty()? ColumnFamily::DEFAULT : ColumnFamily::of(key.data()[0])];
+    }
+    // over the column families the keys in [start, end] may be in
+    rocksdb::Iterator* new_iterator(const std::string &start, const std::string &end);
+    // the name a hash is stored under, 1 if its fields are mirrored
+    int hname(const Bytes &name, std::string *stored);
+    // 1 and the value of dbkey in view, 0 if not found, -1 on error
+    int hread(const std::string &dbkey, HashValueView *view);
+    // drop dbkey from the position cache, after a write is committed
+    void hash_written(const std::string &dbkey);
+    // 1 and the score if the field is set, 0 if not, -1 on error
+    int hfind(const Bytes &key, const Bytes &field, int16_t *score);
     int64_t _qpush(const Bytes &name, const Bytes &item, uint64_t front_or_back_seq, char log_type=BinlogType::SYNC);
     int _qpop(const Bytes &name, std::string *item, uint64_t front_or_back_seq, char log_type=BinlogType::SYNC);
 };
@@ -3,9 +3,18 @@
   Use of this source code is governed by a BSD-style license that can be
   found in the LICENSE file.
 */
+#include <algorithm>
+#include <functional>
 #include <iostream>
 
+#include "rocksdb/version.h"
+
 #include "t_hash.h"
+#include "t_hash_kernel.h"
+#include "chess_merger.h"
+#include "position_cache.h"
+#include "position_mirror.h"
+#include "merge_collapser.h"
 
 using std::cout;
 using std::endl;
@@ -15,17 +24,41 @@ static HashEncoder* gEncoder = new ChessHashEncoder;
 static int hset_one(SSDBImpl *ssdb, const Bytes &key, const Bytes &field, const Bytes &val, char log_type);
 static int hset_one(SSDBImpl *ssdb, const Bytes &key, const Bytes &val, char log_type);
 static int hdel_one(SSDBImpl *ssdb, const Bytes &key, const Bytes &field, char log_type);
+static int hmerge_one(SSDBImpl *ssdb, const Bytes &key, const std::vector<Bytes> &items,
+		      int offset, int step, bool mirrored, char log_type);
 //static int incr_hsize(SSDBImpl *ssdb, const Bytes &name, int64_t incr);
 
+// the field as stored under a mirrored name
+static std::string mirror_field(const Bytes &field) {
+  int move = ChessHashEncoder::move_id(field);
+  if (move == -1) {
+    return field.String();
+  }
+  std::string ret;
+  ChessHashEncoder::move_field(ChessHashEncoder::mirror_move(move), &ret);
+  return ret;
+}
+
+int SSDBImpl::hname(const Bytes &name, std::string *stored) {
+  if (!_mirror) {
+    stored->assign(name.data(), name.size());
+    return 0;
+  }
+  return _mirror->canonical(name, stored);
+}
+
 /**
  * @return -1: error, 0: item updated, 1: new item inserted
  */
 int SSDBImpl::hset(const Bytes &name, const Bytes &key, const Bytes &val, char log_type) {
-  std::unique_lock<std::mutex> lock(_mutex);
-  Transaction trans(_binlogs);
-  int ret = hset_one(this, name, key, val, log_type);
+  std::string stored;
+  std::string field = hname(name, &stored) ? mirror_field(key) : key.String();
+  std::string hkey = gEncoder->encode_key(stored);
+  Transaction trans(_binlogs, hkey);
+  int ret = hset_one(this, stored, field, val, log_type);
   if (ret >= 0) {
     rocksdb::Status s = _binlogs->commit();
+    hash_written(hkey);
     if (!s.ok()) {
       return -1;
     }
@@ -33,13 +66,14 @@ int SSDBImpl::hset(const Bytes &name, const Bytes &key, const Bytes &val, char l
   return ret;
 }
 
-// hreplace actually
+// hreplace actually, key and val come from the binlog as stored
 int SSDBImpl::hset(const Bytes &key, const Bytes &val, char log_type) {
-  std::unique_lock<std::mutex> lock(_mutex);
-  Transaction trans(_binlogs);
+  std::string hkey = gEncoder->encode_key(key);
+  Transaction trans(_binlogs, hkey);
   int ret = hset_one(this, key, val, log_type);
   if (ret >= 0) {
     rocksdb::Status s = _binlogs->commit();
+    hash_written(hkey);
     if (!s.ok()) {
       return -1;
     }
@@ -47,12 +81,40 @@ int SSDBImpl::hset(const Bytes &key, const Bytes &val, char log_type) {
   return ret;
 }
 
+// an operand synced from the master, the key is already the stored
+// name, not mirrored again
+int SSDBImpl::hmerge(const Bytes &key, const Bytes &operand, char log_type) {
+  if (key.empty() || key.size() > SSDB_KEY_LEN_MAX) {
+    log_error("empty or too long key! %s", hexmem(key.data(), key.size()).c_str());
+    return -1;
+  }
+  if (operand.empty() || ChessHashEncoder::for_each_entry(operand.data(), operand.size(),
+	[](int move, int16_t score, int op) {}) == -1) {
+    log_error("invalid operand %s", hexmem(operand.data(), operand.size()).c_str());
+    return -1;
+  }
+  std::string hkey = gEncoder->encode_key(key);
+  Transaction trans(_binlogs, hkey);
+  _binlogs->Merge(hkey, slice(operand));
+  _binlogs->add_log(log_type, BinlogCommand::HMERGE, hkey, slice(operand));
+  rocksdb::Status s = _binlogs->commit();
+  hash_written(hkey);
+  if (!s.ok()) {
+    log_error("hmerge error: %s", s.ToString().c_str());
+    return -1;
+  }
+  return 1;
+}
+
 int SSDBImpl::hdel(const Bytes &name, const Bytes &key, char log_type) {
-  std::unique_lock<std::mutex> lock(_mutex);
-  Transaction trans(_binlogs);
-  int ret = hdel_one(this, name, key, log_type);
+  std::string stored;
+  std::string field = hname(name, &stored) ? mirror_field(key) : key.String();
+  std::string hkey = gEncoder->encode_key(stored);
+  Transaction trans(_binlogs, hkey);
+  int ret = hdel_one(this, stored, field, log_type);
   if (ret >= 0) {
     rocksdb::Status s = _binlogs->commit();
+    hash_written(hkey);
     if (!s.ok()) {
       return -1;
     }
@@ -60,13 +122,55 @@ int SSDBImpl::hdel(const Bytes &name, const Bytes &key, char log_type) {
   return ret;
 }
 
+// all fields of kvs[offset...] go into one merge operand and one binlog
+int SSDBImpl::multi_hset(const Bytes &name, const std::vector<Bytes> &kvs, int offset, char log_type) {
+  assert((kvs.size() - offset) % 2 == 0);
+  std::string stored;
+  int mirrored = hname(name, &stored);
+  std::string hkey = gEncoder->encode_key(stored);
+  Transaction trans(_binlogs, hkey);
+  int ret = hmerge_one(this, stored, kvs, offset, 2, mirrored, log_type);
+  if (ret >= 0) {
+    rocksdb::Status s = _binlogs->commit();
+    hash_written(hkey);
+    if (!s.ok()) {
+      log_error("multi_hset error: %s", s.ToString().c_str());
+      return -1;
+    }
+  }
+  return ret;
+}
+
+int SSDBImpl::multi_hdel(const Bytes &name, const std::vector<Bytes> &keys, int offset, char log_type) {
+  std::string stored;
+  int mirrored = hname(name, &stored);
+  std::string hkey = gEncoder->encode_key(stored);
+  Transaction trans(_binlogs, hkey);
+  int ret = hmerge_one(this, stored, keys, offset, 1, mirrored, log_type);
+  if (ret >= 0) {
+    rocksdb::Status s = _binlogs->commit();
+    hash_written(hkey);
+    if (!s.ok()) {
+      log_error("multi_hdel error: %s", s.ToString().c_str());
+      return -1;
+    }
+  }
+  return ret;
+}
+
 // only used during migration...
 int SSDBImpl::migrate_hset(const std::vector<Bytes>& items, char log_type) {
-  std::unique_lock<std::mutex> lock(_mutex);
-  Transaction trans(_binlogs);
-  bool suc = true;
+  std::vector<std::string> names, fields, lock_keys;
   for (int i = 0; i < items.size(); i += 3) {
-    int ret = hset_one(this, items[i], items[i + 1], items[i + 2], log_type);
+    std::string stored;
+    fields.push_back(hname(items[i], &stored) ? mirror_field(items[i + 1]) : items[i + 1].String());
+    names.push_back(stored);
+    lock_keys.push_back(gEncoder->encode_key(stored));
+  }
+  Transaction trans(_binlogs, lock_keys);
+  bool suc = true;
+  for (int i = 0; i < names.size(); i++) {
+    int ret = hset_one(this, names[i], fields[i], items[i * 3 + 2], log_type);
     if (ret == -1) {
       suc = false;
       break;
@@ -74,6 +178,9 @@ int SSDBImpl::migrate_hset(const std::vector<Bytes>& items, char log_type) {
   }
   if (suc) {
     rocksdb::Status s = _binlogs->commit();
+    for (int i = 0; i < lock_keys.size(); i++) {
+      hash_written(lock_keys[i]);
+    }
     if (!s.ok()) {
       return -1;
     }
@@ -81,35 +188,114 @@ int SSDBImpl::migrate_hset(const std::vector<Bytes>& items, char log_type) {
   return items.size() / 3;
 }
 
+// a blind write: one kOpAdd operand, the merge operator adds it to the
+// score. *new_val, if asked for, is read back while the key stripe is
+// still held, so it is the score right after this add
 int SSDBImpl::hincr(const Bytes &name, const Bytes &key, int64_t by, int64_t *new_val, char log_type){
-  assert(0);
-  return 0;
+  if (name.empty() || name.size() > SSDB_KEY_LEN_MAX) {
+    log_error("empty or too long key! %s", hexmem(name.data(), name.size()).c_str());
+    return -1;
+  }
+  int move = ChessHashEncoder::move_id(key);
+  if (move == -1 || by < -kScoreMax || by > kScoreMax) {
+    return 0;
+  }
+  std::string stored;
+  if (hname(name, &stored)) {
+    move = ChessHashEncoder::mirror_move(move);
+  }
+  std::string hkey = gEncoder->encode_key(stored);
+  std::string operand(1 + kV2EntryLen, kHashValueV2);
+  ChessHashEncoder::put_entry(&operand[1], move | (kOpAdd << kOpShift), static_cast<int16_t>(by));
+
+  Transaction trans(_binlogs, hkey);
+  _binlogs->Merge(hkey, slice(operand));
+  _binlogs->add_log(log_type, BinlogCommand::HMERGE, hkey, slice(operand));
+  rocksdb::Status s = _binlogs->commit();
+  hash_written(hkey);
+  if (!s.ok()) {
+    log_error("hincr error: %s", s.ToString().c_str());
+    return -1;
+  }
+  if (new_val == NULL) {
+    return 1;
+  }
+  int16_t score = 0;
+  if (hfind(name, key, &score) == -1) {
+    return -1;
+  }
+  *new_val = score;
+  return 1;
 }
 
 // field count under the key
 int64_t SSDBImpl::hsize(const Bytes &key) {
-  std::string dbkey = gEncoder->encode_key(key);
-  std::string val;
-  rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), dbkey, &val);
+  std::string stored;
+  hname(key, &stored);
+  HashValueView view;
+  int ret = hread(gEncoder->encode_key(stored), &view);
+  if (ret <= 0) {
+    return ret;
+  }
+  return view.count_live();
+}
+
+// the value of dbkey, through the position cache if there is one
+int SSDBImpl::hread(const std::string &dbkey, HashValueView *view) {
+  PositionCache::Value cached;
+  uint64_t epoch = 0;
+  if (_pos_cache && _pos_cache->lookup(dbkey, &cached, &epoch)) {
+    if (view->hold(cached) == -1) {
+      log_error("bad hash value of %s", hexmem(dbkey.data(), dbkey.size()).c_str());
+      return -1;
+    }
+    return 1;
+  }
+  MergeChainWatch watch(_collapser);
+  rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), _cfHandles[ColumnFamily::HASH],
+			       dbkey, view->pinnable());
   if (s.IsNotFound()) {
     return 0;
-  } else if(!s.ok()) {
+  }
+  if (!s.ok()) {
+    log_error("%s", s.ToString().c_str());
     return -1;
-  } else {
-    return get_hash_value_count(val);
+  }
+  if (view->load() == -1) {
+    log_error("bad hash value of %s", hexmem(dbkey.data(), dbkey.size()).c_str());
+    return -1;
+  }
+  if (_pos_cache) {
+    const Bytes &value = view->value();
+    _pos_cache->insert(dbkey, std::make_shared<const std::string>(value.data(), value.size()),
+		       epoch);
+  }
+  return 1;
+}
+
+// call after the commit of a write on dbkey
+void SSDBImpl::hash_written(const std::string &dbkey) {
+  if (_pos_cache) {
+    _pos_cache->erase(dbkey);
   }
 }
 
 // remove key
 int64_t SSDBImpl::hclear(const Bytes &key) {
-  std::string dbkey = gEncoder->encode_key(key);
-  ldb->Delete(rocksdb::WriteOptions(), dbkey);
+  std::string stored;
+  hname(key, &stored);
+  std::string dbkey = gEncoder->encode_key(stored);
+  ldb->Delete(rocksdb::WriteOptions(), cf(dbkey), dbkey);
+  hash_written(dbkey);
   return 0;
 }
 
+// the packed value as stored, not mirrored
 int SSDBImpl::hget(const Bytes &key, std::string *val) {
-  std::string dbkey = gEncoder->encode_key(key);
-  rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), dbkey, val);
+  std::string stored;
+  hname(key, &stored);
+  std::string dbkey = gEncoder->encode_key(stored);
+  rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), cf(dbkey), dbkey, val);
   if (s.IsNotFound()) {
     return 0;
   }
@@ -121,24 +307,129 @@ int SSDBImpl::hget(const Bytes &key, std::string *val) {
 }
 
 int SSDBImpl::hget(const Bytes &key, const Bytes &field, std::string *val) {
-  std::string dbkey = gEncoder->encode_key(key);
-  std::string dbval;
-  rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), dbkey, &dbval);
-  if (s.IsNotFound()) {
+  int16_t score;
+  int ret = hfind(key, field, &score);
+  if (ret == 1) {
+    *val = std::to_string(score);
+  }
+  return ret;
+}
+
+int SSDBImpl::hexists(const Bytes &key, const Bytes &field) {
+  int16_t score;
+  return hfind(key, field, &score);
+}
+
+int SSDBImpl::hfind(const Bytes &key, const Bytes &field, int16_t *score) {
+  int move = ChessHashEncoder::move_id(field);
+  if (move == -1) {
     return 0;
   }
-  if (!s.ok()) {
-    log_error("%s", s.ToString().c_str());
-    return -1;
+  std::string stored;
+  if (hname(key, &stored)) {
+    move = ChessHashEncoder::mirror_move(move);
+  }
+  HashValueView view;
+  int ret = hread(gEncoder->encode_key(stored), &view);
+  if (ret <= 0) {
+    return ret;
   }
-  return get_hash_value(Bytes(dbval), field, val);
+  return view.find(move, score);
 }
 
-// only support iter within one key right now
+// keys[offset...] in one MultiGet, after the position cache. Sorted
+// keys let rocksdb batch the block cache lookups and coalesce reads of
+// the same block.
+int SSDBImpl::multi_hget_values(const std::vector<Bytes> &keys, int offset,
+				HashValueBatch *batch) {
+  size_t n = keys.size() - offset;
+  assert(batch->views.size() == n);
+  int found = 0;
+  std::vector<std::string> dbkeys(n);
+  std::vector<uint64_t> epochs(n);
+  std::vector<char> mirrored(n);
+  std::vector<size_t> order;
+  for (size_t i = 0; i < n; i++) {
+    std::string stored;
+    mirrored[i] = hname(keys[offset + i], &stored);
+    dbkeys[i] = gEncoder->encode_key(stored);
+    batch->views[i].clear();
+    PositionCache::Value cached;
+    if (_pos_cache && _pos_cache->lookup(dbkeys[i], &cached, &epochs[i])) {
+      if (batch->views[i].hold(cached) == -1) {
+	log_error("bad hash value of %s", hexmem(dbkeys[i].data(), dbkeys[i].size()).c_str());
+	return -1;
+      }
+      if (mirrored[i]) {
+	batch->views[i].mirror();
+      }
+      found++;
+    } else {
+      order.push_back(i);
+    }
+  }
+  size_t m = order.size();
+  if (m == 0) {
+    return found;
+  }
+  std::sort(order.begin(), order.end(), [&dbkeys](size_t a, size_t b) {
+      return dbkeys[a] < dbkeys[b];
+    });
+  std::vector<rocksdb::Slice> slices(m);
+  for (size_t j = 0; j < m; j++) {
+    slices[j] = dbkeys[order[j]];
+  }
+
+  rocksdb::ReadOptions opts;
+#if ROCKSDB_MAJOR > 7 || (ROCKSDB_MAJOR == 7 && ROCKSDB_MINOR >= 6)
+  opts.async_io = true;
+#endif
+  std::vector<rocksdb::Status> statuses(m);
+  {
+    MergeChainWatch watch(_collapser);
+    ldb->MultiGet(opts, _cfHandles[ColumnFamily::HASH], m, &slices[0],
+		  &batch->pinned[0], &statuses[0], true);
+  }
+
+  for (size_t j = 0; j < m; j++) {
+    size_t i = order[j];
+    if (statuses[j].IsNotFound()) {
+      continue;
+    }
+    if (!statuses[j].ok()) {
+      log_error("%s", statuses[j].ToString().c_str());
+      return -1;
+    }
+    const rocksdb::PinnableSlice &value = batch->pinned[j];
+    if (batch->views[i].assign(Bytes(value.data(), value.size())) == -1) {
+      log_error("bad hash value of %s", hexmem(slices[j].data(), slices[j].size()).c_str());
+      return -1;
+    }
+    if (_pos_cache) {
+      _pos_cache->insert(dbkeys[i], std::make_shared<const std::string>(value.data(), value.size()),
+			 epochs[i]);
+    }
+    if (mirrored[i]) {
+      batch->views[i].mirror();
+    }
+    found++;
+  }
+  return found;
+}
+
+// fields of one key in (start, end], the value is read in place
 HIterator* SSDBImpl::hscan(const Bytes &key, const Bytes &start, const Bytes &end,
 			   uint64_t limit) {
-  std::string key_start = gEncoder->encode_key(key);
-  return new HIterator(this->iterator(key_start, "", limit), key, gEncoder);
+  HIterator* it = new HIterator(key, start, end, limit);
+  std::string stored;
+  int mirrored = hname(key, &stored);
+  int ret = hread(gEncoder->encode_key(stored), it->view());
+  if (ret == -1) {
+    it->view()->clear();
+  } else if (ret == 1 && mirrored) {
+    it->view()->mirror();
+  }
+  return it;
 }
 
 HIterator* SSDBImpl::hrscan(const Bytes &name, 
@@ -203,7 +494,7 @@ static int hset_one(SSDBImpl *ssdb, const Bytes &key, const Bytes &field, const
     return -1;
   }
   ssdb->_binlogs->Merge(hkey, slice(new_value));
-  ssdb->_binlogs->add_log(log_type, BinlogCommand::HSET, hkey);
+  ssdb->_binlogs->add_log(log_type, BinlogCommand::HMERGE, hkey, slice(new_value));
 
   return 0;
 }
@@ -244,50 +535,263 @@ static int hdel_one(SSDBImpl *ssdb, const Bytes &key, const Bytes &field, char l
     return -1;
   }
   ssdb->_binlogs->Merge(hkey, slice(new_value));
-  ssdb->_binlogs->add_log(log_type, BinlogCommand::HSET, hkey);
+  ssdb->_binlogs->add_log(log_type, BinlogCommand::HMERGE, hkey, slice(new_value));
 
   return 0;
 }
 
-int get_hash_value(const Bytes& slice, const Bytes& field, std::string* value) {
-  if (slice.empty()) {
+// items are [field][value] pairs if step is 2, fields to delete if 1.
+// returns the number of fields, nothing is written if any is invalid
+static int hmerge_one(SSDBImpl *ssdb, const Bytes &key, const std::vector<Bytes> &items,
+		      int offset, int step, bool mirrored, char log_type) {
+  if (key.empty()) {
+    log_error("empty key or field!");
+    return -1;
+  }
+  if (key.size() > SSDB_KEY_LEN_MAX) {
+    log_error("key too long! %s", hexmem(key.data(), key.size()).c_str());
+    return -1;
+  }
+  int cnt = (items.size() - offset) / step;
+  if (cnt <= 0) {
     return 0;
   }
-  for (int i = 0; i < slice.size(); ) {
-    std::string elem_field, elem_value;
-    gEncoder->decode_value(slice.data() + i, &elem_field, &elem_value);
-    if (Bytes(elem_field) == Bytes(field)) {
-      *value = elem_value;
-      return 1;
+  // fed from the back, so a later field of the same move wins
+  MoveSlots* slots = MoveSlots::local();
+  slots->reset();
+  for (int i = offset + (cnt - 1) * step; i >= offset; i -= step) {
+    const Bytes &field = items[i];
+    const Bytes &val = (step == 2) ? items[i + 1] : Bytes(kDelTag);
+    int move = ChessHashEncoder::move_id(field);
+    int score = atoi(val.data());
+    if (move == -1 || score < -30000 || (score > 30000 && val != kDelTag)) {
+      log_error("invalid field/value %s, %s", field.String().c_str(), val.String().c_str());
+      return -1;
+    }
+    if (mirrored) {
+      move = ChessHashEncoder::mirror_move(move);
     }
-    i += 5; // plus ';' as delimiter
+    slots->add(move, static_cast<int16_t>(score));
   }
-  return 0;
+  // deletes are kept, they have to hide older entries when merged
+  std::string operand;
+  slots->encode(false, &operand);
+  std::string hkey = gEncoder->encode_key(key);
+  ssdb->_binlogs->Merge(hkey, slice(operand));
+  ssdb->_binlogs->add_log(log_type, BinlogCommand::HMERGE, hkey, slice(operand));
+
+  return cnt;
+}
+
+// longest run of v2 entries handed to the scan kernel, binary search
+// narrows larger values down to it
+static const int kKernelScanMax = 64;
+
+// index of the move in sorted v2 entries, -1 if not found
+static int find_v2_entry(const char* base, int n, int move) {
+  int lo = 0;
+  while (n > kKernelScanMax) {
+    int half = n / 2;
+    if (ChessHashEncoder::entry_move(base + (lo + half) * kV2EntryLen) <= move) {
+      lo += half;
+      n -= half;
+    } else {
+      n = half;
+    }
+  }
+  int i = hash_kernel()->find(base + lo * kV2EntryLen, n, move);
+  return i == -1 ? -1 : lo + i;
 }
 
-int get_hash_values(const Bytes& slice, std::deque<StrPair>& values) {
+int find_hash_score(const Bytes& slice, int move, int16_t* score) {
   if (slice.empty()) {
     return 0;
   }
-  for (int i = 0; i < slice.size(); ) {
-    std::string elem_field, elem_value;
-    gEncoder->decode_value(slice.data() + i, &elem_field, &elem_value);
-    values.push_back(std::make_pair(elem_field, elem_value));
-    i += 5; // plus ';' as delimiter
+  if (ChessHashEncoder::isV2(slice)) {
+    const char* base = slice.data() + 1;
+    int i = find_v2_entry(base, (slice.size() - 1) / kV2EntryLen, move);
+    if (i == -1) {
+      return 0;
+    }
+    *score = ChessHashEncoder::entry_score(base + i * kV2EntryLen);
+    return *score != kDelScore;
+  }
+  for (int i = 0; i + kV1EntryLen - 1 <= slice.size(); i += kV1EntryLen) {
+    const char* p = slice.data() + i;
+    if (ChessHashEncoder::v1_move_id(p) == move) {
+      *score = ChessHashEncoder::entry_score(p);
+      return *score != kDelScore;
+    }
   }
   return 0;
 }
 
+int get_hash_value(const Bytes& slice, const Bytes& field, std::string* value) {
+  int move = ChessHashEncoder::move_id(field);
+  if (move == -1) {
+    return 0;
+  }
+  int16_t score;
+  if (find_hash_score(slice, move, &score) != 1) {
+    return 0;
+  }
+  *value = std::to_string(score);
+  return 1;
+}
+
 int get_hash_value_count(const Bytes& slice) {
-  int cnt = 0;
   if (slice.empty()) {
-    return cnt;
+    return 0;
+  }
+  if (ChessHashEncoder::isV2(slice)) {
+    return hash_kernel()->count_live(slice.data() + 1, (slice.size() - 1) / kV2EntryLen);
   }
-  for (int i = 0; i < slice.size(); ) {
-    std::string elem_field, elem_value;
-    gEncoder->decode_value(slice.data() + i, &elem_field, &elem_value);
-    i += 5; // plus ';' as delimiter
-    cnt ++;
+  int cnt = 0;
+  for (int i = 0; i + kV1EntryLen - 1 <= slice.size(); i += kV1EntryLen) {
+    cnt += (ChessHashEncoder::entry_score(slice.data() + i) != kDelScore);
   }
   return cnt;
 }
+
+int upgrade_hash_value(const Bytes& slice, std::string* value) {
+  value->clear();
+  if (slice.empty()) {
+    return 0;
+  }
+  if (ChessHashEncoder::isV2(slice)) {
+    value->assign(slice.data(), slice.size());
+    return 0;
+  }
+  if ((slice.size() + 1) % kV1EntryLen != 0) {
+    return -1;
+  }
+  // (move id << 16 | score), the first one of a move wins as v1 merges
+  // kept the newest entry at front
+  std::vector<uint32_t> entries;
+  entries.reserve((slice.size() + 1) / kV1EntryLen);
+  for (int i = 0; i < slice.size(); i += kV1EntryLen) {
+    const char* p = slice.data() + i;
+    int move = ChessHashEncoder::v1_move_id(p);
+    if (move == -1) {
+      // would run into the opcode bits of the v2 move id word
+      return -1;
+    }
+    uint16_t score = ChessHashEncoder::entry_score(p);
+    entries.push_back((move << 16) | score);
+  }
+  std::stable_sort(entries.begin(), entries.end(), [](uint32_t a, uint32_t b) {
+      return (a >> 16) < (b >> 16);
+    });
+  value->reserve(1 + entries.size() * kV2EntryLen);
+  value->append(1, kHashValueV2);
+  char buf[kV2EntryLen];
+  int last = -1;
+  for (uint32_t e : entries) {
+    int move = e >> 16;
+    if (move == last) {
+      continue;
+    }
+    last = move;
+    ChessHashEncoder::put_entry(buf, move, static_cast<int16_t>(e & 0xFFFF));
+    value->append(buf, kV2EntryLen);
+  }
+  return 0;
+}
+
+int HashValueView::assign(const Bytes& value) {
+  clear();
+  _value = value;
+  Bytes slice = value;
+  if (!ChessHashEncoder::isV2(slice)) {
+    if (upgrade_hash_value(slice, &_upgraded) == -1) {
+      return -1;
+    }
+    slice = Bytes(_upgraded);
+  }
+  if (slice.empty()) {
+    return 0;
+  }
+  if ((slice.size() - 1) % kV2EntryLen != 0) {
+    return -1;
+  }
+  _entries = slice.data() + 1;
+  _count = (slice.size() - 1) / kV2EntryLen;
+  return 0;
+}
+
+int HashValueView::count_live() const {
+  return _count == 0 ? 0 : hash_kernel()->count_live(_entries, _count);
+}
+
+int HashValueView::find(int move, int16_t* score) const {
+  if (_count == 0) {
+    return 0;
+  }
+  int i = find_v2_entry(_entries, _count, move);
+  if (i == -1) {
+    return 0;
+  }
+  *score = this->score(i);
+  return *score != kDelScore;
+}
+
+void HashValueView::mirror() {
+  MoveSlots* slots = MoveSlots::local();
+  slots->reset();
+  for (int i = 0; i < _count; i++) {
+    slots->add(ChessHashEncoder::mirror_move(move(i)), score(i));
+  }
+  // _entries may point into _upgraded
+  std::string mirrored;
+  slots->encode(false, &mirrored);
+  _upgraded.swap(mirrored);
+  _entries = _upgraded.empty() ? NULL : _upgraded.data() + 1;
+}
+
+int HashValueView::best(int n, bool desc, std::string* out) const {
+  out->clear();
+  if (n <= 0 || _count == 0) {
+    return 0;
+  }
+  n = std::min(n, _count);
+  // rank: (biased score << 16 | inverted move), higher is better, kept
+  // in a min-heap of the n best seen so far
+  std::vector<uint32_t> heap;
+  heap.reserve(n);
+  std::greater<uint32_t> worse;
+  for (int i = 0; i < _count; i++) {
+    int16_t s = score(i);
+    if (s == kDelScore) {
+      continue;
+    }
+    uint32_t biased = desc ? (uint32_t)(s + 32768) : (uint32_t)(32767 - s);
+    uint32_t rank = (biased << 16) | (0xFFFF - move(i));
+    if ((int)heap.size() < n) {
+      heap.push_back(rank);
+      std::push_heap(heap.begin(), heap.end(), worse);
+    } else if (rank > heap.front()) {
+      std::pop_heap(heap.begin(), heap.end(), worse);
+      heap.back() = rank;
+      std::push_heap(heap.begin(), heap.end(), worse);
+    }
+  }
+  std::sort_heap(heap.begin(), heap.end(), worse);
+  out->resize(heap.size() * kV2EntryLen);
+  for (size_t i = 0; i < heap.size(); i++) {
+    uint32_t biased = heap[i] >> 16;
+    int16_t s = desc ? (int16_t)((int)biased - 32768) : (int16_t)(32767 - (int)biased);
+    ChessHashEncoder::put_entry(&(*out)[i * kV2EntryLen], 0xFFFF - (heap[i] & 0xFFFF), s);
+  }
+  return heap.size();
+}
+
+int HashValueView::filter(int16_t lo, int16_t hi, std::string* out) const {
+  out->clear();
+  if (_count == 0 || lo > hi) {
+    return 0;
+  }
+  out->resize(_count * kV2EntryLen);
+  int n = hash_kernel()->filter(_entries, _count, lo, hi, &(*out)[0]);
+  out->resize(n * kV2EntryLen);
+  return n;
+}
@@ -8,6 +8,7 @@
 
 #include "../include.h"
 #include "ssdb_impl.h"
+#include "hash_value_view.h"
 
 static const int kKeyByteLen = 1;
 static const int kFieldByteLen = 1;
@@ -22,10 +23,14 @@ static const int kTotalByteLen = 2;
 
 //int decode_hash_value(const Bytes& slice, std::string* field, std::string* value);
 
-int get_hash_value(const Bytes& slice, const Bytes& field, std::string* value);
+// 1 and the score if the move is in the value, 0 if not, no allocation
+int find_hash_score(const Bytes& slice, int move, int16_t* score);
 
-int get_hash_values(const Bytes& slice, std::deque<StrPair>& values);
+int get_hash_value(const Bytes& slice, const Bytes& field, std::string* value);
 
 int get_hash_value_count(const Bytes& slice);
 
+// rewrite a v1 value as v2, v2 values are copied as is
+int upgrade_hash_value(const Bytes& slice, std::string* value);
+
 #endif
@@ -0,0 +1,126 @@
+// micro benchmark of the hash value kernels against the old per-entry
+// string decoding, on positions of 50 ~ 500 moves
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "hash_encoder.h"
+#include "t_hash_kernel.h"
+
+static const int kRounds = 200000;
+static volatile int gSink;
+
+static double now_ns() {
+  return std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// n distinct random moves as a v2 value and as a v1 value
+static void make_values(int n, std::vector<int>* moves, std::string* v2, std::string* v1) {
+  std::vector<int> all(kMoveIdCount);
+  for (int i = 0; i < kMoveIdCount; i++) {
+    all[i] = i;
+  }
+  std::random_shuffle(all.begin(), all.end());
+  moves->assign(all.begin(), all.begin() + n);
+  std::sort(moves->begin(), moves->end());
+
+  ChessHashEncoder encoder;
+  v2->assign(1, kHashValueV2);
+  v1->clear();
+  for (int move : *moves) {
+    char buf[kV2EntryLen];
+    ChessHashEncoder::put_entry(buf, move, rand() % 60001 - 30000);
+    v2->append(buf, kV2EntryLen);
+    std::string field;
+    ChessHashEncoder::move_field(move, &field);
+    if (!v1->empty()) {
+      v1->append(1, ';');
+    }
+    v1->append(1, ((field[0] - 'a') << 4) | (field[1] - '0'));
+    v1->append(1, ((field[2] - 'a') << 4) | (field[3] - '0'));
+    v1->append(buf + 2, 2);
+  }
+}
+
+// what get_hash_value() and get_hash_value_count() used to do
+static int legacy_find(ChessHashEncoder& encoder, const std::string& v1, const std::string& field) {
+  for (int i = 0; i < v1.size(); i += kV1EntryLen) {
+    std::string elem_field, elem_value;
+    encoder.decode_value(Bytes(v1.data() + i, kV1EntryLen - 1), &elem_field, &elem_value);
+    if (elem_field == field) {
+      return i / kV1EntryLen;
+    }
+  }
+  return -1;
+}
+
+static int legacy_count(ChessHashEncoder& encoder, const std::string& v1) {
+  int cnt = 0;
+  for (int i = 0; i < v1.size(); i += kV1EntryLen) {
+    std::string elem_field, elem_value;
+    encoder.decode_value(Bytes(v1.data() + i, kV1EntryLen - 1), &elem_field, &elem_value);
+    cnt++;
+  }
+  return cnt;
+}
+
+int main() {
+  srand(20161017);
+  const char* names[] = { "scalar", "sse2", "avx2" };
+  ChessHashEncoder encoder;
+  printf("%-8s %5s %12s %12s %12s\n", "kernel", "moves", "find ns", "count ns", "filter ns");
+
+  for (int n : { 50, 100, 200, 500 }) {
+    std::vector<int> moves;
+    std::string v2, v1;
+    make_values(n, &moves, &v2, &v1);
+    const char* entries = v2.data() + 1;
+    std::vector<char> out(n * kV2EntryLen);
+
+    std::vector<std::string> fields(moves.size());
+    for (int i = 0; i < moves.size(); i++) {
+      ChessHashEncoder::move_field(moves[i], &fields[i]);
+    }
+    {
+      int rounds = kRounds / 10;
+      double t0 = now_ns();
+      for (int r = 0; r < rounds; r++) {
+	gSink = legacy_find(encoder, v1, fields[r % n]);
+      }
+      double t1 = now_ns();
+      for (int r = 0; r < rounds; r++) {
+	gSink = legacy_count(encoder, v1);
+      }
+      double t2 = now_ns();
+      printf("%-8s %5d %12.1f %12.1f %12s\n", "legacy", n,
+	     (t1 - t0) / rounds, (t2 - t1) / rounds, "-");
+    }
+    for (const char* name : names) {
+      const HashKernel* kernel = hash_kernel_by_name(name);
+      if (!kernel) {
+	continue;
+      }
+      double t0 = now_ns();
+      for (int r = 0; r < kRounds; r++) {
+	gSink = kernel->find(entries, n, moves[r % n]);
+      }
+      double t1 = now_ns();
+      for (int r = 0; r < kRounds; r++) {
+	gSink = kernel->count_live(entries, n);
+      }
+      double t2 = now_ns();
+      for (int r = 0; r < kRounds; r++) {
+	gSink = kernel->filter(entries, n, -100 - r % 1000, 100 + r % 1000, &out[0]);
+      }
+      double t3 = now_ns();
+      printf("%-8s %5d %12.1f %12.1f %12.1f\n", name, n,
+	     (t1 - t0) / kRounds, (t2 - t1) / kRounds, (t3 - t2) / kRounds);
+    }
+  }
+  printf("dispatched: %s\n", hash_kernel()->name);
+  return 0;
+}
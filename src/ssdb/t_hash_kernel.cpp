@@ -0,0 +1,214 @@
+/*
+  Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+  Use of this source code is governed by a BSD-style license that can be
+  found in the LICENSE file.
+*/
+#include <string.h>
+
+#include "t_hash_kernel.h"
+#include "hash_encoder.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HASH_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+// tombstones sit above any valid score, so clamping hi drops them
+static inline int clamp_hi(int16_t hi) {
+  return hi >= kDelScore ? kDelScore - 1 : hi;
+}
+
+static int scalar_find(const char* entries, int n, int move) {
+  for (int i = 0; i < n; i++) {
+    if (ChessHashEncoder::entry_move(entries + i * kV2EntryLen) == move) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int scalar_count_live(const char* entries, int n) {
+  int cnt = 0;
+  for (int i = 0; i < n; i++) {
+    cnt += (ChessHashEncoder::entry_score(entries + i * kV2EntryLen) != kDelScore);
+  }
+  return cnt;
+}
+
+static int scalar_filter(const char* entries, int n, int16_t lo, int16_t hi, char* out) {
+  int top = clamp_hi(hi);
+  int cnt = 0;
+  for (int i = 0; i < n; i++) {
+    const char* p = entries + i * kV2EntryLen;
+    int score = ChessHashEncoder::entry_score(p);
+    if (lo <= score && score <= top) {
+      memcpy(out + cnt * kV2EntryLen, p, kV2EntryLen);
+      cnt++;
+    }
+  }
+  return cnt;
+}
+
+static const HashKernel kScalarKernel = {
+  "scalar", scalar_find, scalar_count_live, scalar_filter
+};
+
+#ifdef HASH_KERNEL_X86
+
+// One 32-bit lane per entry: move id in the low half, score in the high
+// half, as x86 is little-endian. Tails shorter than a vector go scalar,
+// avx2 ones too so that no legacy sse code runs after 256-bit registers.
+
+__attribute__((target("sse2")))
+static int sse2_find(const char* entries, int n, int move) {
+  const __m128i key = _mm_set1_epi32(move);
+  const __m128i low = _mm_set1_epi32(0xFFFF);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(entries + i * kV2EntryLen));
+    __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(v, low), key);
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  int ret = scalar_find(entries + i * kV2EntryLen, n - i, move);
+  return ret == -1 ? -1 : i + ret;
+}
+
+__attribute__((target("sse2")))
+static int sse2_count_live(const char* entries, int n) {
+  const __m128i del = _mm_set1_epi32(kDelScore);
+  __m128i dead = _mm_setzero_si128(); // a matching lane is -1
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(entries + i * kV2EntryLen));
+    dead = _mm_sub_epi32(dead, _mm_cmpeq_epi32(_mm_srli_epi32(v, 16), del));
+  }
+  int32_t lanes[4];
+  _mm_storeu_si128((__m128i*)lanes, dead);
+  return i - (lanes[0] + lanes[1] + lanes[2] + lanes[3])
+    + scalar_count_live(entries + i * kV2EntryLen, n - i);
+}
+
+__attribute__((target("sse2")))
+static int sse2_filter(const char* entries, int n, int16_t lo, int16_t hi, char* out) {
+  const __m128i below = _mm_set1_epi32(lo - 1);
+  const __m128i above = _mm_set1_epi32(clamp_hi(hi) + 1);
+  int cnt = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const char* p = entries + i * kV2EntryLen;
+    __m128i s = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)p), 16);
+    __m128i in = _mm_and_si128(_mm_cmpgt_epi32(s, below), _mm_cmpgt_epi32(above, s));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(in));
+    while (mask) {
+      int k = __builtin_ctz(mask);
+      memcpy(out + cnt * kV2EntryLen, p + k * kV2EntryLen, kV2EntryLen);
+      cnt++;
+      mask &= mask - 1;
+    }
+  }
+  return cnt + scalar_filter(entries + i * kV2EntryLen, n - i, lo, hi,
+			     out + cnt * kV2EntryLen);
+}
+
+__attribute__((target("avx2")))
+static int avx2_find(const char* entries, int n, int move) {
+  const __m256i key = _mm256_set1_epi32(move);
+  const __m256i low = _mm256_set1_epi32(0xFFFF);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(entries + i * kV2EntryLen));
+    __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(v, low), key);
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  int ret = scalar_find(entries + i * kV2EntryLen, n - i, move);
+  return ret == -1 ? -1 : i + ret;
+}
+
+__attribute__((target("avx2")))
+static int avx2_count_live(const char* entries, int n) {
+  const __m256i del = _mm256_set1_epi32(kDelScore);
+  __m256i dead = _mm256_setzero_si256(); // a matching lane is -1
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(entries + i * kV2EntryLen));
+    dead = _mm256_sub_epi32(dead, _mm256_cmpeq_epi32(_mm256_srli_epi32(v, 16), del));
+  }
+  int32_t lanes[8];
+  _mm256_storeu_si256((__m256i*)lanes, dead);
+  int sum = 0;
+  for (int k = 0; k < 8; k++) {
+    sum += lanes[k];
+  }
+  return i - sum + scalar_count_live(entries + i * kV2EntryLen, n - i);
+}
+
+__attribute__((target("avx2")))
+static int avx2_filter(const char* entries, int n, int16_t lo, int16_t hi, char* out) {
+  const __m256i below = _mm256_set1_epi32(lo - 1);
+  const __m256i above = _mm256_set1_epi32(clamp_hi(hi) + 1);
+  int cnt = 0;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const char* p = entries + i * kV2EntryLen;
+    __m256i s = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)p), 16);
+    __m256i in = _mm256_and_si256(_mm256_cmpgt_epi32(s, below),
+				  _mm256_cmpgt_epi32(above, s));
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(in));
+    while (mask) {
+      int k = __builtin_ctz(mask);
+      memcpy(out + cnt * kV2EntryLen, p + k * kV2EntryLen, kV2EntryLen);
+      cnt++;
+      mask &= mask - 1;
+    }
+  }
+  return cnt + scalar_filter(entries + i * kV2EntryLen, n - i, lo, hi,
+			   out + cnt * kV2EntryLen);
+}
+
+static const HashKernel kSse2Kernel = {
+  "sse2", sse2_find, sse2_count_live, sse2_filter
+};
+
+static const HashKernel kAvx2Kernel = {
+  "avx2", avx2_find, avx2_count_live, avx2_filter
+};
+
+#endif
+
+const HashKernel* hash_kernel_by_name(const char* name) {
+  if (strcmp(name, kScalarKernel.name) == 0) {
+    return &kScalarKernel;
+  }
+#ifdef HASH_KERNEL_X86
+  __builtin_cpu_init();
+  if (strcmp(name, kSse2Kernel.name) == 0 && __builtin_cpu_supports("sse2")) {
+    return &kSse2Kernel;
+  }
+  if (strcmp(name, kAvx2Kernel.name) == 0 && __builtin_cpu_supports("avx2")) {
+    return &kAvx2Kernel;
+  }
+#endif
+  return NULL;
+}
+
+static const HashKernel* choose_kernel() {
+  static const char* names[] = { "avx2", "sse2" };
+  for (const char* name : names) {
+    const HashKernel* kernel = hash_kernel_by_name(name);
+    if (kernel) {
+      return kernel;
+    }
+  }
+  return &kScalarKernel;
+}
+
+const HashKernel* hash_kernel() {
+  static const HashKernel* kernel = choose_kernel();
+  return kernel;
+}
@@ -0,0 +1,32 @@
+/*
+  Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+  Use of this source code is governed by a BSD-style license that can be
+  found in the LICENSE file.
+*/
+#ifndef SSDB_HASH_KERNEL_H_
+#define SSDB_HASH_KERNEL_H_
+
+#include <inttypes.h>
+
+// Kernels on the entries of a v2 hash value, i.e. the bytes after the
+// version header: n entries of [move id uint16][score int16], both
+// little-endian. They never allocate and read only n * 4 bytes.
+struct HashKernel {
+    const char* name;
+    // index of the entry with the given move id, -1 if not found
+    int (*find)(const char* entries, int n, int move);
+    // number of entries whose score is not kDelScore
+    int (*count_live)(const char* entries, int n);
+    // copy entries with lo <= score <= hi to out, tombstones are never
+    // copied, returns the number of entries copied
+    int (*filter)(const char* entries, int n, int16_t lo, int16_t hi, char* out);
+};
+
+// the best kernel for the running cpu, chosen once at first call
+const HashKernel* hash_kernel();
+
+// "scalar", "sse2" or "avx2", NULL if not built in or not supported
+// by the running cpu
+const HashKernel* hash_kernel_by_name(const char* name);
+
+#endif
@@ -1,10 +1,20 @@
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
 #include "../include.h"
 #include "const.h"
 #include "ssdb.h"
 #include "ssdb_impl.h"
 #include "t_hash.h"
+#include "t_kv.h"
 #include "hash_encoder.h"
 #include "chess_merger.h"
+#include "chess_compaction_filter.h"
+#include "t_hash_kernel.h"
+#include "position_cache.h"
+#include "position_mirror.h"
+#include "merge_collapser.h"
 
 int Factorial(int n) {
   if (n == 1 || n == 2) return 1;
@@ -17,11 +27,34 @@ using std::endl;
 static HashEncoder* gEncoder = new ChessHashEncoder;
 const std::string kDBPath = "./testdb";
 
+// v2 value made of the entries of one-entry values, in the given order
+static std::string packed(std::initializer_list<std::string> values) {
+  std::string buf(1, kHashValueV2);
+  for (auto& v : values) {
+    buf.append(v.data() + 1, v.size() - 1);
+  }
+  return buf;
+}
+
+// v1 entry, [field 2 bytes][score int16 little-endian]
+static std::string v1_entry(const std::string& field, int16_t score) {
+  std::string buf(4, '\0');
+  buf[0] = ((field[0] - 'a') << 4) | (field[1] - '0');
+  buf[1] = ((field[2] - 'a') << 4) | (field[3] - '0');
+  buf[2] = score & 0xFF;
+  buf[3] = (score >> 8) & 0xFF;
+  return buf;
+}
+
 rocksdb::DB* _db;
 SSDB *_ssdb;
 
 void SetUp(const std::string& msg) {
   Options options;
+  // small, so writes are checked against cached values too
+  options.position_cache_size = 1;
+  // only FEN names are folded, the other tests do not use any
+  options.canonical = "mirror";
   _ssdb = SSDB::open(options, kDBPath);
   //rocksdb::Status s = rocksdb::DB::Open(options, kDBPath, &_db);
   //assert(s.ok());
@@ -118,6 +151,66 @@ void THashTest_DelAndCnt() {
   TearDown("\tdone\n");
 }
 
+void THashTest_MultiSetAndDel() {
+  SetUp("==== THashTest_MultiSetAndDel start\n");
+
+  std::string key1 = "key1";
+  std::vector<Bytes> kvs = { "a0a1", "10", "b2c3", "20", "a0a1", "30", "i9i8", "-40" };
+  assert(4 == _ssdb->multi_hset(key1, kvs, 0, BinlogCommand::HSET));
+  assert(3 == _ssdb->hsize(key1));
+  std::string val;
+  // the later field of a move wins
+  assert(1 == _ssdb->hget(key1, "a0a1", &val) && val == "30");
+  assert(1 == _ssdb->hget(key1, "i9i8", &val) && val == "-40");
+
+  // one operand for the whole batch
+  std::string dbval;
+  assert(1 == _ssdb->hget(key1, &dbval));
+  assert(dbval.size() == 1 + 3 * kV2EntryLen);
+
+  // an invalid field rejects the batch
+  std::vector<Bytes> bad = { "c0c1", "1", "z0z1", "2" };
+  assert(-1 == _ssdb->multi_hset(key1, bad, 0, BinlogCommand::HSET));
+  assert(0 == _ssdb->hexists(key1, "c0c1"));
+
+  std::vector<Bytes> fields = { "a0a1", "i9i8", "e5e6" };
+  assert(3 == _ssdb->multi_hdel(key1, fields, 0, BinlogCommand::HSET));
+  assert(1 == _ssdb->hsize(key1));
+  assert(1 == _ssdb->hget(key1, "b2c3", &val) && val == "20");
+
+  _ssdb->hclear(key1);
+  TearDown("\tdone\n");
+}
+
+void THashTest_ConcurrentSet() {
+  SetUp("==== THashTest_ConcurrentSet start\n");
+
+  // 8 writers, two of them on each key, all on distinct fields
+  const int kThreads = 8, kFields = 200;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.push_back(std::thread([t]() {
+	  std::string key = "key" + std::to_string(t / 2), field;
+	  for (int i = 0; i < kFields; i++) {
+	    ChessHashEncoder::move_field((t % 2) * kFields + i, &field);
+	    int ret = _ssdb->hset(key, field, std::to_string(i), BinlogCommand::HSET);
+	    assert(-1 != ret);
+	  }
+	}));
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+  for (int k = 0; k < kThreads / 2; k++) {
+    assert(2 * kFields == _ssdb->hsize("key" + std::to_string(k)));
+  }
+  std::string field, result;
+  ChessHashEncoder::move_field(kFields + 7, &field);
+  _ssdb->hget("key0", field, &result);
+  assert("7" == result);
+
+  TearDown("\tdone\n");
+}
 
 void THashTest_ListKeys() {
   SetUp("==== THashTest_ListKeys start\n");
@@ -168,6 +261,371 @@ void THashTest_Scan() {
   TearDown("\tdone\n");
 }
 
+void THashTest_ColumnFamilies() {
+  SetUp("==== THashTest_ColumnFamilies start\n");
+
+  std::string result;
+  assert(-1 != _ssdb->set("k1", "v1"));
+  assert(-1 != _ssdb->hset("key1", "a0a1", "12"));
+  assert(-1 != _ssdb->zset("z1", "m1", "3"));
+  assert(0 < _ssdb->qpush_back("q1", "i1"));
+  // each read from the column family of its type
+  assert(1 == _ssdb->get("k1", &result) && result == "v1");
+  assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "12");
+  assert(1 == _ssdb->zget("z1", "m1", &result) && result == "3");
+  assert(1 == _ssdb->qfront("q1", &result) && result == "i1");
+
+  // the whole db, merged in key order both ways
+  std::vector<std::string> keys;
+  Iterator *it = _ssdb->iterator("", "", -1);
+  while (it->next()) {
+    keys.push_back(it->key().String());
+  }
+  delete it;
+  assert(keys.size() > 4);
+  assert(std::is_sorted(keys.begin(), keys.end()));
+  std::vector<std::string> rkeys;
+  it = _ssdb->rev_iterator("\xff", "", -1);
+  while (it->next()) {
+    rkeys.push_back(it->key().String());
+  }
+  delete it;
+  std::reverse(rkeys.begin(), rkeys.end());
+  assert(rkeys == keys);
+  // from the middle, switching direction
+  it = _ssdb->iterator(std::string(1, DataType::KV), "", 2);
+  assert(it->next() && it->key().data()[0] == DataType::KV);
+  assert(it->next() && it->key().data()[0] == DataType::QUEUE);
+  delete it;
+
+  _ssdb->del("k1");
+  _ssdb->hclear("key1");
+  _ssdb->zdel("z1", "m1");
+  _ssdb->qpop_front("q1", &result);
+  TearDown("\tdone\n");
+}
+
+void THashTest_BulkLoad() {
+  SetUp("==== THashTest_BulkLoad start\n");
+
+  // with binlogs, to see which writes have one
+  delete _ssdb;
+  Options options;
+  options.binlog = true;
+  _ssdb = SSDB::open(options, kDBPath);
+  BinlogQueue *logs = ((SSDBImpl *)_ssdb)->_binlogs;
+  std::string result;
+  assert(1 == _ssdb->bulkload(true));
+  assert(0 == _ssdb->bulkload(true));
+  uint64_t seq = logs->max_seq();
+  assert(-1 != _ssdb->hset("key1", "a0a1", "12"));
+  assert(-1 != _ssdb->hset("key1", "b0b1", "7"));
+  assert(seq == logs->max_seq());
+  // only the hashes are loaded, the other writes are logged
+  assert(-1 != _ssdb->set("k1", "v1"));
+  assert(seq + 1 == logs->max_seq());
+  assert(1 == _ssdb->bulkload(false));
+  assert(0 == _ssdb->bulkload(false));
+  // written in the mode, read after it
+  assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "12");
+  assert(1 == _ssdb->hget("key1", "b0b1", &result) && result == "7");
+  assert(-1 != _ssdb->hset("key1", "c0c1", "3"));
+  assert(3 == _ssdb->hsize("key1"));
+
+  TearDown("\tdone\n");
+}
+
+void BinlogTest_HMergeRecord() {
+  SetUp("==== BinlogTest_HMergeRecord start\n");
+
+  ChessHashEncoder encoder;
+  std::string hkey = encoder.encode_key("key1");
+  std::string operand = packed({ encoder.encode_value("a0a1", "12"), encoder.encode_value("b0b1", kDelTag) });
+  Binlog log(7, BinlogType::SYNC, BinlogCommand::HMERGE, hkey, operand);
+  Binlog loaded;
+  assert(0 == loaded.load(log.repr()));
+  assert(loaded.seq() == 7 && loaded.cmd() == BinlogCommand::HMERGE);
+  assert(loaded.key() == Bytes(hkey) && loaded.val() == Bytes(operand));
+  // the trailer can not claim more than the record holds
+  std::string bad = log.repr();
+  bad[bad.size() - 1] = 0x7F;
+  assert(-1 == loaded.load(bad));
+  // records without a value are as before
+  Binlog plain(8, BinlogType::SYNC, BinlogCommand::HSET, hkey);
+  assert(0 == loaded.load(plain.repr()) && loaded.key() == Bytes(hkey) && loaded.val().empty());
+
+  // applied as a slave does
+  std::string result;
+  assert(-1 != _ssdb->hset("key1", "b0b1", "7"));
+  assert(1 == _ssdb->hmerge("key1", operand));
+  assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "12");
+  assert(0 == _ssdb->hget("key1", "b0b1", &result));
+  assert(-1 == _ssdb->hmerge("key1", "\xF2\x01"));
+
+  TearDown("\tdone\n");
+}
+
+void BinlogTest_ReaderAndFrame() {
+  SetUp("==== BinlogTest_ReaderAndFrame start\n");
+
+  // with binlogs, unlike the other tests
+  delete _ssdb;
+  Options options;
+  options.binlog = true;
+  _ssdb = SSDB::open(options, kDBPath);
+  BinlogQueue *logs = ((SSDBImpl *)_ssdb)->_binlogs;
+  BinlogReader reader(logs);
+  Binlog log;
+  uint64_t seq = logs->max_seq();
+  assert(0 == reader.find_next(seq + 1, &log));
+  assert(!logs->wait(seq, 1));
+  assert(-1 != _ssdb->set("k1", "v1"));
+  assert(-1 != _ssdb->set("k2", "v2"));
+  // committed after the reader found nothing
+  assert(logs->wait(seq, 1));
+  assert(1 == reader.find_next(seq + 1, &log) && log.seq() == seq + 1);
+  assert(1 == reader.find_next(seq + 2, &log) && log.seq() == seq + 2);
+  assert(log.cmd() == BinlogCommand::KSET);
+  assert(0 == reader.find_next(seq + 3, &log));
+  // cleared, the reader still sees the binlogs committed after
+  logs->flush();
+  assert(0 == logs->find_next(seq + 1, &log));
+  assert(0 == reader.find_next(seq + 1, &log));
+  assert(-1 != _ssdb->set("k3", "v3"));
+  assert(1 == reader.find_next(seq + 3, &log) && log.seq() == seq + 3);
+  assert(log.key() == Bytes(encode_kv_key("k3")));
+
+  BinlogFrame frame;
+  frame.add(log);
+  frame.add(log, "v2");
+  assert(2 == frame.count());
+  std::string codec, payload, buf;
+  std::vector<std::vector<Bytes> > records;
+  frame.encode(true, &codec, &payload);
+  assert(0 == BinlogFrame::decode(codec, payload, &buf, &records));
+  assert(2 == records.size() && 1 == records[0].size() && 2 == records[1].size());
+  assert(records[0][0] == Bytes(log.data(), log.size()) && records[1][1] == "v2");
+  assert(-1 == BinlogFrame::decode("lz4", payload, &buf, &records));
+  frame.encode(false, &codec, &payload);
+  assert(codec == "none");
+  payload.resize(payload.size() - 1);
+  assert(-1 == BinlogFrame::decode(codec, payload, &buf, &records));
+
+  TearDown("\tdone\n");
+}
+
+void BinlogTest_WalBackend() {
+  SetUp("==== BinlogTest_WalBackend start\n");
+
+  delete _ssdb;
+  Options options;
+  options.binlog = true;
+  options.binlog_backend = "wal";
+  _ssdb = SSDB::open(options, kDBPath);
+  BinlogQueue *logs = ((SSDBImpl *)_ssdb)->_binlogs;
+  BinlogReader reader(logs);
+  Binlog log;
+  uint64_t seq = logs->max_seq();
+  assert(0 == reader.find_next(seq + 1, &log));
+  assert(-1 != _ssdb->set("k1", "v1"));
+  assert(-1 != _ssdb->set("k2", "v2"));
+  assert(1 == reader.find_next(seq + 1, &log) && log.seq() == seq + 1);
+  assert(log.key() == Bytes(encode_kv_key("k1")));
+  assert(1 == reader.find_next(seq + 2, &log) && log.seq() == seq + 2);
+  assert(0 == reader.find_next(seq + 3, &log));
+  // a write without WAL in between
+  logs->set_bulkload(true);
+  assert(-1 != _ssdb->hset("key1", "a0a1", "3"));
+  logs->set_bulkload(false);
+  assert(-1 != _ssdb->set("k4", "v4"));
+  assert(1 == reader.find_next(seq + 3, &log) && log.key() == Bytes(encode_kv_key("k4")));
+  assert(1 == logs->find_last(&log) && log.seq() == seq + 3 && logs->max_seq() == seq + 3);
+  // not in the oplog
+  assert(0 == logs->get(seq + 1, &log));
+  assert(1 == logs->find_next(seq + 2, &log) && log.seq() == seq + 2);
+  // nor is the last seq, until it is saved
+  assert(0 == logs->saved_seq());
+  logs->save_last_seq();
+  assert(seq + 3 == logs->saved_seq());
+
+  TearDown("\tdone\n");
+}
+
+void HashValueViewTest_BaseTest() {
+  SetUp("==== HashValueViewTest_BaseTest start\n");
+
+  // v1, newest entry of a move first, one tombstone
+  std::string v1 = v1_entry("c4d4", 7) + ";" + v1_entry("a0a1", 1) + ";" +
+    v1_entry("c4d4", 3) + ";" + v1_entry("i9i8", kDelScore);
+  HashValueView view;
+  assert(view.assign(v1) == 0);
+  assert(3 == view.count());
+  assert(2 == view.count_live());
+  int16_t score;
+  assert(1 == view.find(ChessHashEncoder::move_id("c4d4"), &score) && score == 7);
+  assert(0 == view.find(ChessHashEncoder::move_id("i9i8"), &score));
+  assert(0 == view.find(ChessHashEncoder::move_id("b0b1"), &score));
+  assert(view.assign(std::string(1, kHashValueV2) + "xyz") == -1);
+  assert(view.assign("") == 0 && 0 == view.count());
+
+  // scan bounds are (start, end] on field names
+  std::string key1 = "key1";
+  std::vector<Bytes> kvs = { "a0a1", "1", "b0b1", "2", "c0c1", "3", "d0d1", "4" };
+  _ssdb->multi_hset(key1, kvs, 0, BinlogCommand::HSET);
+  _ssdb->hdel(key1, "c0c1", BinlogCommand::HSET);
+  HIterator* iter = _ssdb->hscan(key1, "a0a1", "d0d1", 100);
+  assert(iter->next() && iter->_field == "b0b1" && iter->_value == "2");
+  assert(iter->next() && iter->_field == "d0d1" && iter->score() == 4);
+  assert(!iter->next());
+  delete iter;
+  iter = _ssdb->hscan(key1, "", "", 1);
+  assert(iter->next() && iter->_field == "a0a1");
+  assert(!iter->next());
+  delete iter;
+
+  _ssdb->hclear(key1);
+  TearDown("\tdone\n");
+}
+
+void THashTest_MultiGetValues() {
+  SetUp("==== THashTest_MultiGetValues start\n");
+
+  _ssdb->hset("key2", "a0a1", "1", BinlogCommand::HSET);
+  _ssdb->hset("key2", "b0b1", "2", BinlogCommand::HSET);
+  _ssdb->hset("key1", "c0c1", "3", BinlogCommand::HSET);
+
+  // unsorted, with a missing key in between
+  std::vector<Bytes> keys = { "ignored", "key2", "no such key", "key1" };
+  HashValueBatch batch(3);
+  assert(2 == _ssdb->multi_hget_values(keys, 1, &batch));
+  assert(2 == batch.views[0].count_live());
+  assert(0 == batch.views[1].count());
+  int16_t score;
+  assert(1 == batch.views[2].find(ChessHashEncoder::move_id("c0c1"), &score) && score == 3);
+
+  _ssdb->hclear("key1");
+  _ssdb->hclear("key2");
+  TearDown("\tdone\n");
+}
+
+void THashTest_Mirror() {
+  SetUp("==== THashTest_Mirror start\n");
+
+  // stored as its mirror, the first rank reversed sorts before it
+  std::string pos = "rnbakabn1/9/1c5c1/p1p1p1p1p/9/9/P1P1P1P1P/1C5C1/9/RNBAKABNR w";
+  std::string mir = "1nbakabnr/9/1c5c1/p1p1p1p1p/9/9/P1P1P1P1P/1C5C1/9/RNBAKABNR w";
+  FenMirror mirror;
+  std::string stored;
+  assert(1 == mirror.canonical(pos, &stored) && stored == mir);
+  assert(0 == mirror.canonical(mir, &stored) && stored == mir);
+  assert(0 == mirror.canonical("key1", &stored) && stored == "key1");
+  assert(0 == mirror.canonical("rnbakabn1/9 w", &stored));
+  int move = ChessHashEncoder::move_id("b0c2");
+  assert(ChessHashEncoder::mirror_move(move) == ChessHashEncoder::move_id("h0g2"));
+
+  std::string val;
+  assert(0 == _ssdb->hset(pos, "b0c2", "5", BinlogCommand::HSET));
+  assert(1 == _ssdb->hget(mir, "h0g2", &val) && val == "5");
+  assert(1 == _ssdb->hget(pos, "b0c2", &val) && val == "5");
+  assert(0 == _ssdb->hget(pos, "h0g2", &val));
+  std::vector<Bytes> kvs = { "a0a1", "1", "i0i1", "2" };
+  assert(2 == _ssdb->multi_hset(mir, kvs, 0, BinlogCommand::HSET));
+  assert(3 == _ssdb->hsize(pos));
+
+  // read back in the orientation asked for, still sorted
+  HIterator *it = _ssdb->hscan(pos, "", "", 100);
+  std::string fields;
+  while (it->next()) {
+    fields += it->_field + "=" + it->_value + " ";
+  }
+  delete it;
+  assert(fields == "a0a1=2 b0c2=5 i0i1=1 ");
+
+  std::vector<Bytes> keys = { pos, mir };
+  HashValueBatch batch(2);
+  assert(2 == _ssdb->multi_hget_values(keys, 0, &batch));
+  int16_t score;
+  assert(1 == batch.views[0].find(move, &score) && score == 5);
+  assert(0 == batch.views[1].find(move, &score));
+
+  assert(0 == _ssdb->hdel(pos, "b0c2", BinlogCommand::HSET));
+  assert(2 == _ssdb->hsize(mir));
+  _ssdb->hclear(pos);
+  assert(0 == _ssdb->hsize(mir));
+  TearDown("\tdone\n");
+}
+
+void HashValueViewTest_BestAndFilter() {
+  SetUp("==== HashValueViewTest_BestAndFilter start\n");
+
+  ChessHashEncoder encoder;
+  std::string value = packed({ encoder.encode_value("a0a1", "5"), encoder.encode_value("b0b1", "-3"),
+			       encoder.encode_value("c0c1", kDelTag), encoder.encode_value("d0d1", "5"),
+			       encoder.encode_value("e0e1", "100"), encoder.encode_value("f0f1", "-30000") });
+  HashValueView view;
+  assert(0 == view.assign(value));
+
+  // best first, ties by move id, tombstones never selected
+  auto fields = [](const std::string& entries) {
+    std::string ret, field;
+    for (size_t i = 0; i < entries.size(); i += kV2EntryLen) {
+      ChessHashEncoder::move_field(ChessHashEncoder::entry_move(&entries[i]), &field);
+      ret += field + "=" + std::to_string(ChessHashEncoder::entry_score(&entries[i])) + " ";
+    }
+    return ret;
+  };
+  std::string entries;
+  assert(3 == view.best(3, true, &entries));
+  assert(fields(entries) == "e0e1=100 a0a1=5 d0d1=5 ");
+  assert(2 == view.best(2, false, &entries));
+  assert(fields(entries) == "f0f1=-30000 b0b1=-3 ");
+  assert(5 == view.best(100, true, &entries));
+  assert(0 == view.best(0, true, &entries) && entries.empty());
+
+  assert(3 == view.filter(-3, 5, &entries));
+  assert(fields(entries) == "a0a1=5 b0b1=-3 d0d1=5 ");
+  assert(5 == view.filter(-32768, 32767, &entries));
+  assert(0 == view.filter(6, 99, &entries));
+
+  TearDown("\tdone\n");
+}
+
+void PositionCacheTest_BaseTest() {
+  SetUp("==== PositionCacheTest_BaseTest start\n");
+
+  // room for ~100 entries in a single shard
+  PositionCache cache(100 * 128, 1);
+  PositionCache::Value value = std::make_shared<const std::string>(16, 'v'), got;
+  uint64_t epoch;
+
+  // a hot position survives a scan of one-off ones
+  for (int i = 0; i < 10; i++) {
+    if (!cache.lookup("hot", &got, &epoch)) {
+      cache.insert("hot", value, epoch);
+    }
+  }
+  for (int i = 0; i < 10000; i++) {
+    std::string key = "cold" + std::to_string(i);
+    if (!cache.lookup(key, &got, &epoch)) {
+      cache.insert(key, value, epoch);
+    }
+  }
+  assert(cache.lookup("hot", &got, &epoch) && got == value);
+
+  // a value read before a write is not cached after it
+  assert(!cache.lookup("key1", &got, &epoch));
+  cache.erase("key1");
+  cache.insert("key1", value, epoch);
+  assert(!cache.lookup("key1", &got, &epoch));
+  cache.insert("key1", value, epoch);
+  assert(cache.lookup("key1", &got, &epoch));
+
+  cache.clear();
+  assert(!cache.lookup("hot", &got, &epoch));
+
+  TearDown("\tdone\n");
+}
+
 void FullMergerTest_EmptyExistingTest() {
   SetUp("==== FullMergerTest_EmptyExistingTest\n");
 
@@ -191,7 +649,7 @@ void FullMergerTest_EmptyExistingTest() {
     operands.push_back(ep2);
 
     new_value = "";
-    expected= ep2 + ";" + ep1;
+    expected = packed({ep2, ep1});
     rocksdb::MergeOperator::MergeOperationInput merge_in(key, nullptr,
 							 operands, nullptr);
     rocksdb::MergeOperator::MergeOperationOutput merge_out(new_value, existing_operand);
@@ -278,7 +736,7 @@ void FullMergerTest_EmptyExistingTest() {
     operands.push_back(ep3);
 
     new_value = "";
-    expected = ep3 + ";" + ep2;
+    expected = packed({ep2, ep3});
     rocksdb::MergeOperator::MergeOperationInput merge_in(key, nullptr,
 							 operands, nullptr);
     rocksdb::MergeOperator::MergeOperationOutput merge_out(new_value, existing_operand);
@@ -335,14 +793,14 @@ void FullMergerTest_NoneEmptyExistingTest() {
     // one insert
     operands.clear();
     new_value = "";
-    std::string existing_value = ep1 + ";" + ep2;
+    std::string existing_value = packed({ep2, ep1});
     rocksdb::Slice slice(existing_value);
 	
     field = "b3b4"; value = "112";
     std::string temp = gEncoder->encode_value(field, value);
     operands.push_back(temp);
 
-    expected = temp + ";" + existing_value;
+    expected = packed({ep2, ep1, temp});
     rocksdb::MergeOperator::MergeOperationInput merge_in(key, &slice,
 							 operands, nullptr);
     rocksdb::MergeOperator::MergeOperationOutput merge_out(new_value, existing_operand);
@@ -354,14 +812,14 @@ void FullMergerTest_NoneEmptyExistingTest() {
     // one update
     operands.clear();
     new_value = "";
-    std::string existing_value = ep1 + ";" + ep2;
+    std::string existing_value = packed({ep2, ep1});
     rocksdb::Slice slice(existing_value);
 
     value = "whatever";
     std::string temp = gEncoder->encode_value(field1, value);
     operands.push_back(temp);
 
-    expected = temp + ";" + ep2;
+    expected = packed({ep2, temp});
     rocksdb::MergeOperator::MergeOperationInput merge_in(key, &slice,
 							 operands, nullptr);
     rocksdb::MergeOperator::MergeOperationOutput merge_out(new_value, existing_operand);
@@ -373,7 +831,7 @@ void FullMergerTest_NoneEmptyExistingTest() {
     // one delete
     operands.clear();
     new_value = "";
-    std::string existing_value = ep1 + ";" + ep2;
+    std::string existing_value = packed({ep2, ep1});
     rocksdb::Slice slice(existing_value);
 
     value = kDelTag;
@@ -392,7 +850,7 @@ void FullMergerTest_NoneEmptyExistingTest() {
     // one insert, one update, one delete
     operands.clear();
     new_value = "";
-    std::string existing_value = ep1 + ";" + ep2;
+    std::string existing_value = packed({ep2, ep1});
     rocksdb::Slice slice(existing_value);
 
     field = "c7d0"; value = "112";
@@ -407,7 +865,73 @@ void FullMergerTest_NoneEmptyExistingTest() {
     std::string utemp = gEncoder->encode_value(field1, value);
     operands.push_back(utemp);
 
-    expected = utemp + ";" + itemp;
+    expected = packed({utemp, itemp});
+    rocksdb::MergeOperator::MergeOperationInput merge_in(key, &slice,
+							 operands, nullptr);
+    rocksdb::MergeOperator::MergeOperationOutput merge_out(new_value, existing_operand);
+    chessMerger.FullMergeV2(merge_in, &merge_out);
+
+    assert(new_value == expected);
+  }
+
+  TearDown("\tdone\n");
+}
+
+void FullMergerTest_V1ExistingTest() {
+  SetUp("==== FullMergerTest_V1ExistingTest start\n");
+
+  std::string key, field, value;
+  std::string new_value, result, expected;
+
+  // v1 value written before the v2 format, newest entry at front
+  std::string field1("a3b4"), value1("112"),
+    field2("a3b3"), value2("-11159");
+  std::string ep1 = gEncoder->encode_value(field1, value1),
+    ep2 = gEncoder->encode_value(field2, value2);
+  std::string v1_value = v1_entry(field1, 112) + ";" + v1_entry(field2, -11159)
+    + ";" + v1_entry(field1, 7);
+
+  rocksdb::Slice existing_operand;
+  std::vector<rocksdb::Slice> operands;
+  ChessMergeOperator chessMerger;
+  {
+    // read
+    assert(3 == get_hash_value_count(v1_value));
+    assert(1 == get_hash_value(v1_value, field2, &result));
+    assert(value2 == result);
+    assert(1 == get_hash_value(v1_value, field1, &result));
+    assert(value1 == result);
+  }
+  {
+    // upgrade, the first entry of a field wins
+    new_value = "";
+    expected = packed({ep2, ep1});
+    assert(0 == upgrade_hash_value(v1_value, &new_value));
+    assert(new_value == expected);
+    assert(1 == get_hash_value(new_value, field1, &result));
+    assert(value1 == result);
+
+    // v2 is left as is
+    result = "";
+    assert(0 == upgrade_hash_value(new_value, &result));
+    assert(result == new_value);
+
+    // a field nibble off the board is rejected
+    std::string bad = v1_value;
+    bad[kV1EntryLen] = '\xFF';
+    assert(-1 == upgrade_hash_value(bad, &result));
+  }
+  {
+    // one insert on v1, written as v2
+    operands.clear();
+    new_value = "";
+    rocksdb::Slice slice(v1_value);
+
+    field = "b3b4"; value = "112";
+    std::string temp = gEncoder->encode_value(field, value);
+    operands.push_back(temp);
+
+    expected = packed({ep2, ep1, temp});
     rocksdb::MergeOperator::MergeOperationInput merge_in(key, &slice,
 							 operands, nullptr);
     rocksdb::MergeOperator::MergeOperationOutput merge_out(new_value, existing_operand);
@@ -435,7 +959,7 @@ void PartialMergerTest_BaseTest() {
     std::string ep2 = gEncoder->encode_value(field, value);
 
     new_value = "";
-    expected = ep2 + ";" + ep1;
+    expected = packed({ep2, ep1});
     chessMerger.PartialMerge(key, ep1, ep2, &new_value, nullptr);
 
     assert(new_value == expected);
@@ -494,8 +1018,8 @@ void PartialMergerTest_BaseTest() {
     std::string ep3 = gEncoder->encode_value(field, value);
 
     new_value = "";
-    expected = ep3 + ";" + ep2;
-    chessMerger.PartialMerge(key, ep1, ep3 + ";" + ep2, &new_value, nullptr);
+    expected = packed({ep2, ep3});
+    chessMerger.PartialMerge(key, ep1, packed({ep2, ep3}), &new_value, nullptr);
 
     assert(new_value == expected);
   }
@@ -511,8 +1035,8 @@ void PartialMergerTest_BaseTest() {
     std::string ep3 = gEncoder->encode_value(field, value);
 
     new_value = "";
-    expected = ep3 + ";" + ep1;
-    chessMerger.PartialMerge(key, ep1 + ";" + ep2, ep3, &new_value, nullptr);
+    expected = packed({ep3, ep1});
+    chessMerger.PartialMerge(key, packed({ep2, ep1}), ep3, &new_value, nullptr);
 
     assert(new_value == expected);
   }
@@ -520,6 +1044,195 @@ void PartialMergerTest_BaseTest() {
   TearDown("\tdone\n");
 }
 
+void PartialMergerTest_MultiTest() {
+  SetUp("==== PartialMergerTest_MultiTest start\n");
+
+  std::string key, field, value;
+  std::string new_value, expected;
+
+  ChessMergeOperator chessMerger;
+  {
+    // insert, insert, delete the 1st one, front() is the oldest
+    field = "a3b4"; value = "112";
+    std::string ep1 = gEncoder->encode_value(field, value);
+
+    field = "a3b3"; value = "-11159";
+    std::string ep2 = gEncoder->encode_value(field, value);
+
+    field = "a3b4"; value = kDelTag;
+    std::string ep3 = gEncoder->encode_value(field, value);
+
+    std::deque<rocksdb::Slice> operands = { ep1, ep2, ep3 };
+    new_value = "";
+    expected = packed({ep2, ep3});
+    chessMerger.PartialMergeMulti(key, operands, &new_value, nullptr);
+
+    assert(new_value == expected);
+  }
+  {
+    // many moves, result is sorted by move id and newest wins
+    std::vector<std::string> eps;
+    std::vector<rocksdb::Slice> operands;
+    for (int move = kMoveIdCount - 1; move >= 0; move -= 7) {
+      ChessHashEncoder::move_field(move, &field);
+      eps.push_back(gEncoder->encode_value(field, std::to_string(move % 100)));
+    }
+    ChessHashEncoder::move_field(kMoveIdCount - 1, &field);
+    eps.push_back(gEncoder->encode_value(field, "-1"));
+    for (auto& ep : eps) {
+      operands.push_back(ep);
+    }
+
+    new_value = "";
+    rocksdb::Slice existing_operand;
+    rocksdb::MergeOperator::MergeOperationInput merge_in(key, nullptr,
+							 operands, nullptr);
+    rocksdb::MergeOperator::MergeOperationOutput merge_out(new_value, existing_operand);
+    assert(chessMerger.FullMergeV2(merge_in, &merge_out));
+
+    assert((int)eps.size() - 1 == get_hash_value_count(new_value));
+    int last = -1;
+    for (int i = 1; i < new_value.size(); i += kV2EntryLen) {
+      int move = ChessHashEncoder::entry_move(new_value.data() + i);
+      assert(last < move);
+      last = move;
+    }
+    std::string result;
+    assert(1 == get_hash_value(new_value, field, &result));
+    assert("-1" == result);
+  }
+
+  TearDown("\tdone\n");
+}
+
+// one kOpAdd operand
+static std::string delta_operand(const std::string& field, int16_t delta) {
+  std::string buf(1 + kV2EntryLen, kHashValueV2);
+  ChessHashEncoder::put_entry(&buf[1], ChessHashEncoder::move_id(field) | (kOpAdd << kOpShift), delta);
+  return buf;
+}
+
+void DeltaMergerTest_BaseTest() {
+  SetUp("==== DeltaMergerTest_BaseTest start\n");
+
+  std::string key, new_value, result;
+  ChessMergeOperator chessMerger;
+  std::string set1 = gEncoder->encode_value("a3b4", "100");
+  std::string del1 = gEncoder->encode_value("a3b4", kDelTag);
+  std::string add5 = delta_operand("a3b4", 5);
+  std::string add_big = delta_operand("a3b4", 29000);
+  {
+    // deltas fold into one, a set before them is resolved
+    std::deque<rocksdb::Slice> operands = { add5, add5 };
+    assert(chessMerger.PartialMergeMulti(key, operands, &new_value, nullptr));
+    assert(new_value == delta_operand("a3b4", 10));
+    new_value.clear();
+    operands = { set1, add5, add5 };
+    assert(chessMerger.PartialMergeMulti(key, operands, &new_value, nullptr));
+    assert(new_value == gEncoder->encode_value("a3b4", "110"));
+    // a delta after a set wins over nothing, a set after a delta replaces it
+    new_value.clear();
+    assert(chessMerger.PartialMerge(key, add5, set1, &new_value, nullptr));
+    assert(new_value == set1);
+  }
+  {
+    // applied to the existing score, to 0 if deleted, saturating
+    std::vector<rocksdb::Slice> operands = { add5, add_big, add_big };
+    rocksdb::Slice existing(set1), existing_operand;
+    new_value.clear();
+    rocksdb::MergeOperator::MergeOperationInput merge_in(key, &existing, operands, nullptr);
+    rocksdb::MergeOperator::MergeOperationOutput merge_out(new_value, existing_operand);
+    assert(chessMerger.FullMergeV2(merge_in, &merge_out));
+    assert(1 == get_hash_value(new_value, "a3b4", &result) && result == "30000");
+
+    operands = { del1, add5 };
+    new_value.clear();
+    rocksdb::MergeOperator::MergeOperationInput merge_in2(key, &existing, operands, nullptr);
+    assert(chessMerger.FullMergeV2(merge_in2, &merge_out));
+    assert(1 == get_hash_value(new_value, "a3b4", &result) && result == "5");
+  }
+  {
+    // the same deltas give the same score however they are grouped, a
+    // sum is only saturated once it is applied
+    std::string up = delta_operand("a3b4", 30000), down = delta_operand("a3b4", -30000);
+    auto full = [&](std::vector<rocksdb::Slice> operands) {
+      std::string value, score;
+      rocksdb::Slice existing_operand;
+      rocksdb::MergeOperator::MergeOperationInput merge_in(key, nullptr, operands, nullptr);
+      rocksdb::MergeOperator::MergeOperationOutput merge_out(value, existing_operand);
+      assert(chessMerger.FullMergeV2(merge_in, &merge_out));
+      assert(1 == get_hash_value(value, "a3b4", &score));
+      return score;
+    };
+    assert(full({ up, up, down }) == "30000");
+    std::string up_down;
+    assert(chessMerger.PartialMerge(key, up, down, &up_down, nullptr));
+    assert(full({ up, up_down }) == "30000");
+    std::deque<rocksdb::Slice> operands = { up, up, down };
+    std::string folded;
+    assert(chessMerger.PartialMergeMulti(key, operands, &folded, nullptr));
+    assert(full({ folded }) == "30000");
+    // a sum that does not fit in an operand is left to the full merge
+    std::string up_up;
+    assert(!chessMerger.PartialMerge(key, up, up, &up_up, nullptr));
+  }
+  {
+    // hincr is a blind write, the new score is read back through the merge
+    int64_t new_val;
+    assert(1 == _ssdb->hincr("key1", "a0a1", 7, &new_val) && new_val == 7);
+    assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "7");
+    assert(1 == _ssdb->hincr("key1", "a0a1", -10, &new_val) && new_val == -3);
+    assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "-3");
+    // not asked for, not read back
+    assert(1 == _ssdb->hincr("key1", "a0a1", 4, NULL));
+    assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "1");
+    assert(0 == _ssdb->hincr("key1", "a0a1", 40000, &new_val));
+    assert(0 == _ssdb->hincr("key1", "z0a1", 1, &new_val));
+    _ssdb->hclear("key1");
+  }
+
+  TearDown("\tdone\n");
+}
+
+void THashTest_MergeCollapse() {
+  SetUp("==== THashTest_MergeCollapse start\n");
+
+  // reopen with the collapse on, no cache so every read merges
+  delete _ssdb;
+  Options options;
+  options.collapse_threshold = 4;
+  options.collapse_rate = 1000;
+  _ssdb = SSDB::open(options, kDBPath);
+  assert(_ssdb);
+
+  int64_t new_val;
+  std::string result;
+  MergeChainLog *chains = MergeChainLog::local();
+  // below the threshold, nothing is queued
+  for (int i = 0; i < 3; i++) {
+    assert(1 == _ssdb->hincr("key1", "a0a1", 1, &new_val));
+  }
+  assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "3");
+  assert(chains->merges == 1 && chains->operands == 3 && chains->long_keys.empty());
+
+  for (int i = 0; i < 5; i++) {
+    assert(1 == _ssdb->hincr("key1", "a0a1", 1, &new_val));
+  }
+  assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "8");
+  assert(chains->merges == 1 && chains->operands == 8 && chains->long_keys.size() == 1);
+  // rewritten in the background, later reads merge nothing
+  for (int i = 0; i < 200 && chains->merges; i++) {
+    usleep(10 * 1000);
+    assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "8");
+  }
+  assert(chains->merges == 0);
+  assert(1 == _ssdb->hincr("key1", "a0a1", 1, &new_val));
+  assert(1 == _ssdb->hget("key1", "a0a1", &result) && result == "9");
+  assert(chains->merges == 1 && chains->operands == 1);
+
+  TearDown("\tdone\n");
+}
+
 void THashTest_BugPartial() {
   SetUp("==== PartialBug start\n");
 
@@ -539,7 +1252,7 @@ void THashTest_BugPartial() {
   std::string ep3 = gEncoder->encode_value(field, value);
     
   std::string inter = "";
-  expected = ep3 + ";" + ep2;
+  expected = packed({ep2, ep3});
   chessMerger.PartialMerge(key, ep2, ep3, &inter, nullptr);
   assert(expected == inter);
 
@@ -623,17 +1336,145 @@ void ValueEncodeTest_BaseTest() {
   TearDown("\tdone\n");
 }
 
+void HashKernelTest_BaseTest() {
+  SetUp("==== HashKernelTest_BaseTest start\n");
+
+  const HashKernel* scalar = hash_kernel_by_name("scalar");
+  assert(scalar != NULL);
+  assert(hash_kernel() != NULL);
+  const char* names[] = { "sse2", "avx2" };
+
+  srand(1017);
+  for (int n = 0; n < 300; n += (n < 40 ? 1 : 37)) {
+    // sorted moves, every 5th one deleted
+    std::string value(1, kHashValueV2);
+    char buf[kV2EntryLen];
+    int move = rand() % 10;
+    for (int i = 0; i < n; i++) {
+      int16_t score = (i % 5 == 4) ? kDelScore : (rand() % 60001 - 30000);
+      ChessHashEncoder::put_entry(buf, move, score);
+      value.append(buf, kV2EntryLen);
+      move += 1 + rand() % 20;
+    }
+    const char* entries = value.data() + 1;
+    std::vector<char> out1(n * kV2EntryLen + 1), out2(n * kV2EntryLen + 1);
+
+    assert(n - n / 5 == scalar->count_live(entries, n));
+    assert(n - n / 5 == get_hash_value_count(value));
+    for (int i = 0; i < n; i++) {
+      int m = ChessHashEncoder::entry_move(entries + i * kV2EntryLen);
+      assert(i == scalar->find(entries, n, m));
+      int16_t score = 0;
+      assert((i % 5 != 4) == find_hash_score(value, m, &score));
+    }
+    for (const char* name : names) {
+      const HashKernel* kernel = hash_kernel_by_name(name);
+      if (!kernel) {
+	continue;
+      }
+      assert(scalar->count_live(entries, n) == kernel->count_live(entries, n));
+      for (int i = 0; i < n; i++) {
+	int m = ChessHashEncoder::entry_move(entries + i * kV2EntryLen);
+	assert(i == kernel->find(entries, n, m));
+	assert(-1 == kernel->find(entries, n, m + kMoveIdCount));
+      }
+      int16_t ranges[][2] = { {-30000, 30000}, {-100, 100}, {0, 32767}, {5, -5} };
+      for (auto& range : ranges) {
+	int cnt1 = scalar->filter(entries, n, range[0], range[1], &out1[0]);
+	int cnt2 = kernel->filter(entries, n, range[0], range[1], &out2[0]);
+	assert(cnt1 == cnt2);
+	assert(memcmp(&out1[0], &out2[0], cnt1 * kV2EntryLen) == 0);
+      }
+    }
+  }
+
+  TearDown("\tdone\n");
+}
+
+void CompactionFilterTest_PurgeTest() {
+  SetUp("==== CompactionFilterTest_PurgeTest start\n");
+
+  ChessCompactionFilter filter;
+  std::string hkey = gEncoder->encode_key("key1");
+  std::string ep1 = gEncoder->encode_value("a3b4", "112"),
+    ep2 = gEncoder->encode_value("a3b3", "-11159"),
+    ep3 = gEncoder->encode_value("c7d0", kDelTag);
+  std::string new_value;
+  bool changed;
+  {
+    // not a hash key
+    std::string value = packed({ep3});
+    new_value = ""; changed = false;
+    assert(!filter.Filter(0, "kkey1", value, &new_value, &changed));
+    assert(!changed);
+  }
+  {
+    // nothing to purge
+    std::string value = packed({ep2, ep1});
+    new_value = ""; changed = false;
+    assert(!filter.Filter(0, hkey, value, &new_value, &changed));
+    assert(!changed);
+  }
+  {
+    // 'DEL' stripped
+    std::string value = packed({ep2, ep1, ep3});
+    new_value = ""; changed = false;
+    assert(!filter.Filter(0, hkey, value, &new_value, &changed));
+    assert(changed);
+    assert(new_value == packed({ep2, ep1}));
+  }
+  {
+    // nothing left, or empty
+    std::string value = packed({ep3});
+    new_value = ""; changed = false;
+    assert(filter.Filter(0, hkey, value, &new_value, &changed));
+    assert(filter.Filter(0, hkey, "", &new_value, &changed));
+  }
+  {
+    // v1 upgraded
+    std::string value = v1_entry("a3b4", 112) + ";" + v1_entry("a3b3", -11159);
+    new_value = ""; changed = false;
+    assert(!filter.Filter(0, hkey, value, &new_value, &changed));
+    assert(changed);
+    assert(new_value == packed({ep2, ep1}));
+  }
+  std::string stats = filter.stats();
+  assert(stats.find("purged_entries  : 2") != std::string::npos);
+  assert(stats.find("removed_keys    : 2") != std::string::npos);
+  assert(stats.find("upgraded_values : 1") != std::string::npos);
+
+  TearDown("\tdone\n");
+}
+
 int main() {
   printf("EXAGGERATE\n");
   THashTest_SetAndCnt();
   THashTest_SetAndGet();
   THashTest_DelAndCnt();
+  THashTest_MultiSetAndDel();
+  THashTest_ConcurrentSet();
   THashTest_ListKeys();
   THashTest_Scan();
+  THashTest_ColumnFamilies();
+  THashTest_BulkLoad();
+  BinlogTest_HMergeRecord();
+  BinlogTest_ReaderAndFrame();
+  BinlogTest_WalBackend();
+  HashValueViewTest_BaseTest();
+  THashTest_MultiGetValues();
+  THashTest_Mirror();
+  HashValueViewTest_BestAndFilter();
+  PositionCacheTest_BaseTest();
   FullMergerTest_EmptyExistingTest();
   FullMergerTest_NoneEmptyExistingTest();
+  FullMergerTest_V1ExistingTest();
   PartialMergerTest_BaseTest();
+  PartialMergerTest_MultiTest();
   ValueEncodeTest_BaseTest();
   THashTest_BugPartial();
+  DeltaMergerTest_BaseTest();
+  THashTest_MergeCollapse();
+  HashKernelTest_BaseTest();
+  CompactionFilterTest_PurgeTest();
   return 0;
 }
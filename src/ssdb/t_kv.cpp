@@ -8,7 +8,11 @@
 int SSDBImpl::multi_set(const std::vector<Bytes> &kvs, int offset, char log_type){
     assert(kvs.size() % 2 == 0);
     assert(offset % 2 == 0);
-    Transaction trans(_binlogs);
+    std::vector<std::string> lock_keys;
+    for (auto it = kvs.begin() + offset; it != kvs.end(); it += 2) {
+        lock_keys.push_back(encode_kv_key(*it));
+    }
+    Transaction trans(_binlogs, lock_keys);
     for (auto it = kvs.begin() + offset; it != kvs.end(); it += 2) {
         const Bytes &key = *it;
         if (key.empty()) {
@@ -30,7 +34,11 @@ int SSDBImpl::multi_set(const std::vector<Bytes> &kvs, int offset, char log_type
 }
 
 int SSDBImpl::multi_del(const std::vector<Bytes> &keys, int offset, char log_type){
-    Transaction trans(_binlogs);
+    std::vector<std::string> lock_keys;
+    for (auto it = keys.begin() + offset; it != keys.end(); it++) {
+        lock_keys.push_back(encode_kv_key(*it));
+    }
+    Transaction trans(_binlogs, lock_keys);
 
     for (auto it = keys.begin() + offset; it != keys.end(); it++) {
         const Bytes &key = *it;
@@ -52,9 +60,9 @@ int SSDBImpl::set(const Bytes &key, const Bytes &val, char log_type){
         //return -1;
         return 0;
     }
-    Transaction trans(_binlogs);
-
     std::string buf = encode_kv_key(key);
+    Transaction trans(_binlogs, buf);
+
     _binlogs->Put(buf, slice(val));
     _binlogs->add_log(log_type, BinlogCommand::KSET, buf);
     rocksdb::Status s = _binlogs->commit();
@@ -71,14 +79,14 @@ int SSDBImpl::setnx(const Bytes &key, const Bytes &val, char log_type){
         //return -1;
         return 0;
     }
-    Transaction trans(_binlogs);
+    std::string buf = encode_kv_key(key);
+    Transaction trans(_binlogs, buf);
 
     std::string tmp;
     int found = this->get(key, &tmp);
     if (found != 0) {
         return 0;
     }
-    std::string buf = encode_kv_key(key);
     _binlogs->Put(buf, slice(val));
     _binlogs->add_log(log_type, BinlogCommand::KSET, buf);
     rocksdb::Status s = _binlogs->commit();
@@ -95,10 +103,10 @@ int SSDBImpl::getset(const Bytes &key, std::string *val, const Bytes &newval, ch
         //return -1;
         return 0;
     }
-    Transaction trans(_binlogs);
+    std::string buf = encode_kv_key(key);
+    Transaction trans(_binlogs, buf);
 
     int found = this->get(key, val);
-    std::string buf = encode_kv_key(key);
     _binlogs->Put(buf, slice(newval));
     _binlogs->add_log(log_type, BinlogCommand::KSET, buf);
     rocksdb::Status s = _binlogs->commit();
@@ -111,9 +119,9 @@ int SSDBImpl::getset(const Bytes &key, std::string *val, const Bytes &newval, ch
 
 
 int SSDBImpl::del(const Bytes &key, char log_type){
-    Transaction trans(_binlogs);
-
     std::string buf = encode_kv_key(key);
+    Transaction trans(_binlogs, buf);
+
     _binlogs->Delete(buf);
     _binlogs->add_log(log_type, BinlogCommand::KDEL, buf);
     rocksdb::Status s = _binlogs->commit();
@@ -125,7 +133,8 @@ int SSDBImpl::del(const Bytes &key, char log_type){
 }
 
 int SSDBImpl::incr(const Bytes &key, int64_t by, int64_t *new_val, char log_type){
-    Transaction trans(_binlogs);
+    std::string buf = encode_kv_key(key);
+    Transaction trans(_binlogs, buf);
 
     std::string old;
     int ret = this->get(key, &old);
@@ -140,7 +149,6 @@ int SSDBImpl::incr(const Bytes &key, int64_t by, int64_t *new_val, char log_type
         }
     }
 
-    std::string buf = encode_kv_key(key);
     _binlogs->Put(buf, str(*new_val));
     _binlogs->add_log(log_type, BinlogCommand::KSET, buf);
 
@@ -155,7 +163,7 @@ int SSDBImpl::incr(const Bytes &key, int64_t by, int64_t *new_val, char log_type
 int SSDBImpl::get(const Bytes &key, std::string *val){
     std::string buf = encode_kv_key(key);
 
-    rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), buf, val);
+    rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), cf(buf), buf, val);
     if (s.IsNotFound()) {
         return 0;
     }
@@ -201,7 +209,8 @@ int SSDBImpl::setbit(const Bytes &key, int bitoffset, int on, char log_type){
         log_error("empty key!");
         return 0;
     }
-    Transaction trans(_binlogs);
+    std::string buf = encode_kv_key(key);
+    Transaction trans(_binlogs, buf);
 
     std::string val;
     int ret = this->get(key, &val);
@@ -221,7 +230,6 @@ int SSDBImpl::setbit(const Bytes &key, int bitoffset, int on, char log_type){
         val[len] &= ~(1 << bit);
     }
 
-    std::string buf = encode_kv_key(key);
     _binlogs->Put(buf, val);
     _binlogs->add_log(log_type, BinlogCommand::KSET, buf);
     rocksdb::Status s = _binlogs->commit();
@@ -5,11 +5,11 @@
 */
 #include "t_queue.h"
 
-static int qget_by_seq(rocksdb::DB* db, const Bytes &name, uint64_t seq, std::string *val){
+static int qget_by_seq(rocksdb::DB* db, rocksdb::ColumnFamilyHandle *cf, const Bytes &name, uint64_t seq, std::string *val){
     std::string key = encode_qitem_key(name, seq);
     rocksdb::Status s;
 
-    s = db->Get(rocksdb::ReadOptions(), key, val);
+    s = db->Get(rocksdb::ReadOptions(), cf, key, val);
     if(s.IsNotFound()){
 	return 0;
     }else if(!s.ok()){
@@ -20,10 +20,10 @@ static int qget_by_seq(rocksdb::DB* db, const Bytes &name, uint64_t seq, std::st
     }
 }
 
-static int qget_uint64(rocksdb::DB* db, const Bytes &name, uint64_t seq, uint64_t *ret){
+static int qget_uint64(rocksdb::DB* db, rocksdb::ColumnFamilyHandle *cf, const Bytes &name, uint64_t seq, uint64_t *ret){
     std::string val;
     *ret = 0;
-    int s = qget_by_seq(db, name, seq, &val);
+    int s = qget_by_seq(db, cf, name, seq, &val);
     if(s == 1){
 	if(val.size() != sizeof(uint64_t)){
 	    return -1;
@@ -72,7 +72,7 @@ int64_t SSDBImpl::qsize(const Bytes &name){
     std::string val;
 
     rocksdb::Status s;
-    s = ldb->Get(rocksdb::ReadOptions(), key, &val);
+    s = ldb->Get(rocksdb::ReadOptions(), cf(key), key, &val);
     if(s.IsNotFound()){
 	return 0;
     }else if(!s.ok()){
@@ -90,14 +90,14 @@ int64_t SSDBImpl::qsize(const Bytes &name){
 int SSDBImpl::qfront(const Bytes &name, std::string *item){
     int ret = 0;
     uint64_t seq;
-    ret = qget_uint64(this->ldb, name, QFRONT_SEQ, &seq);
+    ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QFRONT_SEQ, &seq);
     if(ret == -1){
 	return -1;
     }
     if(ret == 0){
 	return 0;
     }
-    ret = qget_by_seq(this->ldb, name, seq, item);
+    ret = qget_by_seq(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, seq, item);
     return ret;
 }
 
@@ -105,26 +105,26 @@ int SSDBImpl::qfront(const Bytes &name, std::string *item){
 int SSDBImpl::qback(const Bytes &name, std::string *item){
     int ret = 0;
     uint64_t seq;
-    ret = qget_uint64(this->ldb, name, QBACK_SEQ, &seq);
+    ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QBACK_SEQ, &seq);
     if(ret == -1){
 	return -1;
     }
     if(ret == 0){
 	return 0;
     }
-    ret = qget_by_seq(this->ldb, name, seq, item);
+    ret = qget_by_seq(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, seq, item);
     return ret;
 }
 
 int SSDBImpl::qset_by_seq(const Bytes &name, uint64_t seq, const Bytes &item, char log_type){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_qsize_key(name));
     uint64_t min_seq, max_seq;
     int ret;
     int64_t size = this->qsize(name);
     if(size == -1){
 	return -1;
     }
-    ret = qget_uint64(this->ldb, name, QFRONT_SEQ, &min_seq);
+    ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QFRONT_SEQ, &min_seq);
     if(ret == -1){
 	return -1;
     }
@@ -151,7 +151,7 @@ int SSDBImpl::qset_by_seq(const Bytes &name, uint64_t seq, const Bytes &item, ch
 
 // return: 0: index out of range, -1: error, 1: ok
 int SSDBImpl::qset(const Bytes &name, int64_t index, const Bytes &item, char log_type){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_qsize_key(name));
     int64_t size = this->qsize(name);
     if(size == -1){
 	return -1;
@@ -163,10 +163,10 @@ int SSDBImpl::qset(const Bytes &name, int64_t index, const Bytes &item, char log
     int ret;
     uint64_t seq;
     if(index >= 0){
-	ret = qget_uint64(this->ldb, name, QFRONT_SEQ, &seq);
+	ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QFRONT_SEQ, &seq);
 	seq += index;
     }else{
-	ret = qget_uint64(this->ldb, name, QBACK_SEQ, &seq);
+	ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QBACK_SEQ, &seq);
 	seq += index + 1;
     }
     if(ret == -1){
@@ -194,12 +194,12 @@ int SSDBImpl::qset(const Bytes &name, int64_t index, const Bytes &item, char log
 }
 
 int64_t SSDBImpl::_qpush(const Bytes &name, const Bytes &item, uint64_t front_or_back_seq, char log_type){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_qsize_key(name));
 
     int ret;
     // generate seq
     uint64_t seq;
-    ret = qget_uint64(this->ldb, name, front_or_back_seq, &seq);
+    ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, front_or_back_seq, &seq);
     if(ret == -1){
 	return -1;
     }
@@ -259,11 +259,11 @@ int64_t SSDBImpl::qpush_back(const Bytes &name, const Bytes &item, char log_type
 }
 
 int SSDBImpl::_qpop(const Bytes &name, std::string *item, uint64_t front_or_back_seq, char log_type){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_qsize_key(name));
 	
     int ret;
     uint64_t seq;
-    ret = qget_uint64(this->ldb, name, front_or_back_seq, &seq);
+    ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, front_or_back_seq, &seq);
     if(ret == -1){
 	return -1;
     }
@@ -271,7 +271,7 @@ int SSDBImpl::_qpop(const Bytes &name, std::string *item, uint64_t front_or_back
 	return 0;
     }
 	
-    ret = qget_by_seq(this->ldb, name, seq, item);
+    ret = qget_by_seq(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, seq, item);
     if(ret == -1){
 	return -1;
     }
@@ -375,7 +375,7 @@ int SSDBImpl::qrlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 }
 
 int SSDBImpl::qfix(const Bytes &name){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_qsize_key(name));
     std::string key_s = encode_qitem_key(name, QITEM_MIN_SEQ - 1);
     std::string key_e = encode_qitem_key(name, QITEM_MAX_SEQ);
 
@@ -429,7 +429,7 @@ int SSDBImpl::qslice(const Bytes &name, int64_t begin, int64_t end,
     uint64_t seq_begin, seq_end;
     if(begin >= 0 && end >= 0){
 	uint64_t tmp_seq;
-	ret = qget_uint64(this->ldb, name, QFRONT_SEQ, &tmp_seq);
+	ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QFRONT_SEQ, &tmp_seq);
 	if(ret != 1){
 	    return ret;
 	}
@@ -437,7 +437,7 @@ int SSDBImpl::qslice(const Bytes &name, int64_t begin, int64_t end,
 	seq_end = tmp_seq + end;
     }else if(begin < 0 && end < 0){
 	uint64_t tmp_seq;
-	ret = qget_uint64(this->ldb, name, QBACK_SEQ, &tmp_seq);
+	ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QBACK_SEQ, &tmp_seq);
 	if(ret != 1){
 	    return ret;
 	}
@@ -445,11 +445,11 @@ int SSDBImpl::qslice(const Bytes &name, int64_t begin, int64_t end,
 	seq_end = tmp_seq + end + 1;
     }else{
 	uint64_t f_seq, b_seq;
-	ret = qget_uint64(this->ldb, name, QFRONT_SEQ, &f_seq);
+	ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QFRONT_SEQ, &f_seq);
 	if(ret != 1){
 	    return ret;
 	}
-	ret = qget_uint64(this->ldb, name, QBACK_SEQ, &b_seq);
+	ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QBACK_SEQ, &b_seq);
 	if(ret != 1){
 	    return ret;
 	}
@@ -467,7 +467,7 @@ int SSDBImpl::qslice(const Bytes &name, int64_t begin, int64_t end,
 	
     for(; seq_begin <= seq_end; seq_begin++){
 	std::string item;
-	ret = qget_by_seq(this->ldb, name, seq_begin, &item);
+	ret = qget_by_seq(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, seq_begin, &item);
 	if(ret == -1){
 	    return -1;
 	}
@@ -483,10 +483,10 @@ int SSDBImpl::qget(const Bytes &name, int64_t index, std::string *item){
     int ret;
     uint64_t seq;
     if(index >= 0){
-	ret = qget_uint64(this->ldb, name, QFRONT_SEQ, &seq);
+	ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QFRONT_SEQ, &seq);
 	seq += index;
     }else{
-	ret = qget_uint64(this->ldb, name, QBACK_SEQ, &seq);
+	ret = qget_uint64(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, QBACK_SEQ, &seq);
 	seq += index + 1;
     }
     if(ret == -1){
@@ -496,6 +496,6 @@ int SSDBImpl::qget(const Bytes &name, int64_t index, std::string *item){
 	return 0;
     }
 	
-    ret = qget_by_seq(this->ldb, name, seq, item);
+    ret = qget_by_seq(this->ldb, _cfHandles[ColumnFamily::QUEUE], name, seq, item);
     return ret;
 }
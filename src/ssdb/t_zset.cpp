@@ -18,7 +18,7 @@ static int incr_zsize(SSDBImpl *ssdb, const Bytes &name, int64_t incr);
  * @return -1: error, 0: item updated, 1: new item inserted
  */
 int SSDBImpl::zset(const Bytes &name, const Bytes &key, const Bytes &score, char log_type){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_zsize_key(name));
 
     int ret = zset_one(this, name, key, score, log_type);
     if(ret >= 0){
@@ -37,7 +37,7 @@ int SSDBImpl::zset(const Bytes &name, const Bytes &key, const Bytes &score, char
 }
 
 int SSDBImpl::zdel(const Bytes &name, const Bytes &key, char log_type){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_zsize_key(name));
 
     int ret = zdel_one(this, name, key, log_type);
     if(ret >= 0){
@@ -56,7 +56,7 @@ int SSDBImpl::zdel(const Bytes &name, const Bytes &key, char log_type){
 }
 
 int SSDBImpl::zincr(const Bytes &name, const Bytes &key, int64_t by, int64_t *new_val, char log_type){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_zsize_key(name));
 
     std::string old;
     int ret = this->zget(name, key, &old);
@@ -92,7 +92,7 @@ int64_t SSDBImpl::zsize(const Bytes &name){
     std::string val;
     rocksdb::Status s;
 
-    s = ldb->Get(rocksdb::ReadOptions(), size_key, &val);
+    s = ldb->Get(rocksdb::ReadOptions(), cf(size_key), size_key, &val);
     if(s.IsNotFound()){
 	return 0;
     }else if(!s.ok()){
@@ -108,7 +108,7 @@ int64_t SSDBImpl::zsize(const Bytes &name){
 
 int SSDBImpl::zget(const Bytes &name, const Bytes &key, std::string *score){
     std::string buf = encode_zset_key(name, key);
-    rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), buf, score);
+    rocksdb::Status s = ldb->Get(rocksdb::ReadOptions(), cf(buf), buf, score);
     if(s.IsNotFound()){
 	return 0;
     }
@@ -373,7 +373,7 @@ static int incr_zsize(SSDBImpl *ssdb, const Bytes &name, int64_t incr){
 }
 
 int64_t SSDBImpl::zfix(const Bytes &name){
-    Transaction trans(_binlogs);
+    Transaction trans(_binlogs, encode_zsize_key(name));
     std::string it_start, it_end;
     Iterator *it;
     rocksdb::Status s;
@@ -404,7 +404,7 @@ int64_t SSDBImpl::zfix(const Bytes &name){
 		
 	std::string buf = encode_zset_key(name, key);
 	std::string score2;
-	s = ldb->Get(rocksdb::ReadOptions(), buf, &score2);
+	s = ldb->Get(rocksdb::ReadOptions(), cf(buf), buf, &score2);
 	if(!s.ok() && !s.IsNotFound()){
 	    log_error("zget error: %s", s.ToString().c_str());
 	    size = -1;
@@ -416,7 +416,7 @@ int64_t SSDBImpl::zfix(const Bytes &name){
 		     hexmem(key.data(), key.size()).c_str(),
 		     hexmem(score.data(), score.size()).c_str()
 		     );
-	    s = ldb->Put(rocksdb::WriteOptions(), buf, score);
+	    s = ldb->Put(rocksdb::WriteOptions(), cf(buf), buf, score);
 	    if(!s.ok()){
 		log_error("db error! %s", s.ToString().c_str());
 		size = -1;
@@ -438,9 +438,9 @@ int64_t SSDBImpl::zfix(const Bytes &name){
 		 hexmem(name.data(), name.size()).c_str(), old_size, size);
 	std::string size_key = encode_zsize_key(name);
 	if(size == 0){
-	    s = ldb->Delete(rocksdb::WriteOptions(), size_key);
+	    s = ldb->Delete(rocksdb::WriteOptions(), cf(size_key), size_key);
 	}else{
-	    s = ldb->Put(rocksdb::WriteOptions(), size_key, rocksdb::Slice((char *)&size, sizeof(int64_t)));
+	    s = ldb->Put(rocksdb::WriteOptions(), cf(size_key), size_key, rocksdb::Slice((char *)&size, sizeof(int64_t)));
 	}
     }
 	
@@ -471,7 +471,7 @@ int64_t SSDBImpl::zfix(const Bytes &name){
 		
 	std::string buf = encode_zscore_key(name, key, score);
 	std::string score2;
-	s = ldb->Get(rocksdb::ReadOptions(), buf, &score2);
+	s = ldb->Get(rocksdb::ReadOptions(), cf(buf), buf, &score2);
 	if(!s.ok() && !s.IsNotFound()){
 	    log_error("zget error: %s", s.ToString().c_str());
 	    size = -1;
@@ -483,7 +483,7 @@ int64_t SSDBImpl::zfix(const Bytes &name){
 		     hexmem(key.data(), key.size()).c_str(),
 		     hexmem(score.data(), score.size()).c_str()
 		     );
-	    s = ldb->Put(rocksdb::WriteOptions(), buf, "");
+	    s = ldb->Put(rocksdb::WriteOptions(), cf(buf), buf, "");
 	    if(!s.ok()){
 		log_error("db error! %s", s.ToString().c_str());
 		size = -1;
@@ -505,9 +505,9 @@ int64_t SSDBImpl::zfix(const Bytes &name){
 		 hexmem(name.data(), name.size()).c_str(), old_size, size);
 	std::string size_key = encode_zsize_key(name);
 	if(size == 0){
-	    s = ldb->Delete(rocksdb::WriteOptions(), size_key);
+	    s = ldb->Delete(rocksdb::WriteOptions(), cf(size_key), size_key);
 	}else{
-	    s = ldb->Put(rocksdb::WriteOptions(), size_key, rocksdb::Slice((char *)&size, sizeof(int64_t)));
+	    s = ldb->Put(rocksdb::WriteOptions(), cf(size_key), size_key, rocksdb::Slice((char *)&size, sizeof(int64_t)));
 	}
     }
 	
@@ -0,0 +1,214 @@
+/*
+  Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+  Use of this source code is governed by a BSD-style license that can be
+  found in the LICENSE file.
+*/
+#include <inttypes.h>
+#include "../util/log.h"
+#include "wal_binlog.h"
+
+// one index entry per this many binlogs
+static const uint64_t kIndexStep = 1000;
+// batches read by trim() to find the first binlog
+static const int kTrimMaxBatches = 100;
+
+// collects the log data of a batch, the binlogs, and skips the writes
+class LogDataCollector : public rocksdb::WriteBatch::Handler{
+ private:
+    std::deque<std::string> *logs;
+ public:
+    LogDataCollector(std::deque<std::string> *logs) : logs(logs){
+    }
+
+    virtual rocksdb::Status PutCF(uint32_t id, const rocksdb::Slice& key,
+				  const rocksdb::Slice& value){
+	return rocksdb::Status::OK();
+    }
+    virtual rocksdb::Status DeleteCF(uint32_t id, const rocksdb::Slice& key){
+	return rocksdb::Status::OK();
+    }
+    virtual rocksdb::Status MergeCF(uint32_t id, const rocksdb::Slice& key,
+				    const rocksdb::Slice& value){
+	return rocksdb::Status::OK();
+    }
+    virtual rocksdb::Status DeleteRangeCF(uint32_t id, const rocksdb::Slice& begin,
+					  const rocksdb::Slice& end){
+	return rocksdb::Status::OK();
+    }
+    virtual void LogData(const rocksdb::Slice& blob){
+	logs->push_back(blob.ToString());
+    }
+};
+
+static int collect(rocksdb::WriteBatch *batch, std::deque<std::string> *logs){
+    LogDataCollector collector(logs);
+    rocksdb::Status s = batch->Iterate(&collector);
+    if(!s.ok()){
+	log_error("WAL batch error: %s", s.ToString().c_str());
+	return -1;
+    }
+    return 0;
+}
+
+/* WalBinlogs */
+
+WalBinlogs::WalBinlogs(rocksdb::DB *db){
+    this->_db = db;
+    this->last_indexed = 0;
+}
+
+const std::string& WalBinlogs::last_seq_key(){
+    // not a seq key, it sorts before all of them
+    static const std::string key(1, DataType::SYNCLOG);
+    return key;
+}
+
+// the rocksdb seq 0 is before the first batch kept, GetUpdatesSince()
+// starts at the oldest WAL file then
+int WalBinlogs::load(uint64_t *first_seq, Binlog *last){
+    std::unique_ptr<rocksdb::TransactionLogIterator> it;
+    rocksdb::Status s = _db->GetUpdatesSince(0, &it);
+    if(!s.ok()){
+	log_info("no binlogs in WAL: %s", s.ToString().c_str());
+	return 0;
+    }
+    int ret = 0;
+    uint64_t batches = 0;
+    std::deque<std::string> logs;
+    for(; it->Valid(); it->Next()){
+	rocksdb::BatchResult batch = it->GetBatch();
+	logs.clear();
+	if(collect(batch.writeBatchPtr.get(), &logs) == -1 || logs.empty()){
+	    continue;
+	}
+	Binlog log;
+	if(log.load(logs.front()) == -1 || last->load(logs.back()) == -1){
+	    continue;
+	}
+	if(ret == 0){
+	    *first_seq = log.seq();
+	    ret = 1;
+	}
+	this->add(log.seq(), batch.sequence - 1);
+	batches ++;
+    }
+    if(!it->status().ok()){
+	log_error("WAL read error: %s", it->status().ToString().c_str());
+    }
+    log_info("%" PRIu64 " binlog batches in WAL", batches);
+    return ret;
+}
+
+void WalBinlogs::add(uint64_t seq, rocksdb::SequenceNumber before){
+    Locking l(&mutex);
+    if(!index.empty() && seq < last_indexed + kIndexStep){
+	return;
+    }
+    index[seq] = before;
+    last_indexed = seq;
+}
+
+rocksdb::SequenceNumber WalBinlogs::start_of(uint64_t seq){
+    Locking l(&mutex);
+    std::map<uint64_t, rocksdb::SequenceNumber>::iterator it = index.upper_bound(seq);
+    if(it == index.begin()){
+	return 0;
+    }
+    it--;
+    return it->second + 1;
+}
+
+uint64_t WalBinlogs::trim(){
+    std::unique_ptr<rocksdb::TransactionLogIterator> it;
+    rocksdb::Status s = _db->GetUpdatesSince(0, &it);
+    if(!s.ok()){
+	return 0;
+    }
+    uint64_t first = 0;
+    std::deque<std::string> logs;
+    for(int i=0; first == 0 && i < kTrimMaxBatches && it->Valid(); i++, it->Next()){
+	rocksdb::BatchResult batch = it->GetBatch();
+	logs.clear();
+	if(collect(batch.writeBatchPtr.get(), &logs) == -1 || logs.empty()){
+	    continue;
+	}
+	Binlog log;
+	if(log.load(logs.front()) != -1){
+	    first = log.seq();
+	}
+    }
+    if(first == 0){
+	return 0;
+    }
+    Locking l(&mutex);
+    // the entry at or below first is still where to start from
+    while(index.size() > 1 && (++index.begin())->first <= first){
+	index.erase(index.begin());
+    }
+    return first;
+}
+
+/* WalBinlogReader */
+
+WalBinlogReader::WalBinlogReader(WalBinlogs *wal){
+    this->wal = wal;
+    this->next_seq = 0;
+    this->next_batch = 0;
+}
+
+int WalBinlogReader::find_next(uint64_t seq, Binlog *log){
+    if(seq != next_seq){
+	// not where the last one left off, from the index then
+	iter.reset();
+	pending.clear();
+	next_batch = wal->start_of(seq);
+    }
+    next_seq = seq;
+    while(1){
+	while(!pending.empty()){
+	    std::string data;
+	    data.swap(pending.front());
+	    pending.pop_front();
+	    if(log->load(data) == -1){
+		return -1;
+	    }
+	    if(log->seq() >= seq){
+		next_seq = log->seq() + 1;
+		return 1;
+	    }
+	}
+	if(this->read_batch() == 0){
+	    return 0;
+	}
+    }
+}
+
+// 1 if a batch was read, 0 at the end of the WAL
+int WalBinlogReader::read_batch(){
+    if(!iter || !iter->Valid()){
+	// an iterator does not see batches written after it ends, nor
+	// past a gap of writes without WAL, a new one starts after them
+	if(iter && !iter->status().ok()){
+	    log_debug("WAL read: %s", iter->status().ToString().c_str());
+	}
+	iter.reset();
+	if(next_batch > wal->db()->GetLatestSequenceNumber()){
+	    return 0;
+	}
+	rocksdb::Status s = wal->db()->GetUpdatesSince(next_batch, &iter);
+	if(!s.ok()){
+	    log_error("WAL read error: %s", s.ToString().c_str());
+	    iter.reset();
+	    return 0;
+	}
+	if(!iter->Valid()){
+	    iter.reset();
+	    return 0;
+	}
+    }
+    rocksdb::BatchResult batch = iter->GetBatch();
+    next_batch = batch.sequence + batch.writeBatchPtr->Count();
+    collect(batch.writeBatchPtr.get(), &pending);
+    iter->Next();
+    return 1;
+}
@@ -0,0 +1,82 @@
+/*
+  Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+  Use of this source code is governed by a BSD-style license that can be
+  found in the LICENSE file.
+*/
+#ifndef SSDB_WAL_BINLOG_H_
+#define SSDB_WAL_BINLOG_H_
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include "rocksdb/db.h"
+#include "rocksdb/transaction_log.h"
+#include "../util/thread.h"
+#include "binlog.h"
+
+// Binlogs kept in the WAL, as the log data of the batch they describe,
+// instead of in the oplog column family, so they are written once and
+// never deleted key by key. rocksdb keeps the WAL for WAL_ttl_seconds
+// or up to WAL_size_limit_MB, and GetUpdatesSince() reads it back.
+//
+// Where to start reading for a binlog seq is found in a sparse index of
+// binlog seq => rocksdb seq, built by a scan of the WAL at open.
+class WalBinlogs{
+ public:
+    WalBinlogs(rocksdb::DB *db);
+
+    // scans the WAL, 1 and the first seq and the last binlog if there are
+    // binlogs in it, 0 if not
+    int load(uint64_t *first_seq, Binlog *last);
+    // the binlogs from seq on are in a batch written after the rocksdb
+    // seq 'before'
+    void add(uint64_t seq, rocksdb::SequenceNumber before);
+    // the rocksdb seq to read from to find the binlog seq
+    rocksdb::SequenceNumber start_of(uint64_t seq);
+    // the seq of the first binlog left in the WAL, the index below it is
+    // dropped, 0 if none is found in the first batches
+    uint64_t trim();
+
+    // the key in the oplog column family of the last binlog seq, see
+    // BinlogQueue::save_last_seq(), so the seqs go on when the WAL is all
+    // purged
+    static const std::string& last_seq_key();
+
+    rocksdb::DB* db() const{
+	return _db;
+    }
+
+ private:
+    rocksdb::DB *_db;
+    Mutex mutex;
+    std::map<uint64_t, rocksdb::SequenceNumber> index;
+    uint64_t last_indexed;
+
+    // No copying allowed
+    WalBinlogs(const WalBinlogs&);
+    void operator=(const WalBinlogs&);
+};
+
+// Reads the binlogs of the WAL in seq order, batch by batch, going on
+// from the batch read last as long as the seqs asked for follow.
+class WalBinlogReader{
+ public:
+    WalBinlogReader(WalBinlogs *wal);
+    // as BinlogQueue::find_next()
+    int find_next(uint64_t seq, Binlog *log);
+
+ private:
+    WalBinlogs *wal;
+    std::unique_ptr<rocksdb::TransactionLogIterator> iter;
+    // binlogs of the batches read and not returned yet
+    std::deque<std::string> pending;
+    // the binlog seq after the one returned last, 0 if none yet
+    uint64_t next_seq;
+    // the rocksdb seq after the batch read last
+    rocksdb::SequenceNumber next_batch;
+
+    int read_batch();
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include <assert.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+#include "include.h"
+#include "ssdb/ssdb.h"
+#include "ssdb/ssdb_impl.h"
+#include "backend_sync.h"
+#include "slave.h"
+#include "net/link.h"
+
+// a master and a slave in one process, synced over loopback
+
+const std::string kDBPath = "./testdb_sync";
+static const char *kIp = "127.0.0.1";
+static const int kPort = 18891;
+
+SSDB *_master;
+SSDB *_slave_db;
+SSDB *_meta;
+BackendSync *_backend;
+Link *_serv;
+
+void SetUp(const std::string& msg) {
+  std::string cmd = "rm -rf " + kDBPath;
+  system(cmd.c_str());
+  Options options;
+  options.binlog = true;
+  _master = SSDB::open(options, kDBPath + "/master");
+  _slave_db = SSDB::open(Options(), kDBPath + "/slave");
+  _meta = SSDB::open(Options(), kDBPath + "/meta");
+  assert(_master && _slave_db && _meta);
+  _backend = new BackendSync((SSDBImpl *)_master, 0);
+  _serv = Link::listen(kIp, kPort);
+  assert(_serv);
+  std::cout << msg;
+}
+
+void TearDown(const std::string& msg) {
+  std::cout << msg;
+  delete _serv;
+  delete _backend;
+  delete _meta;
+  delete _slave_db;
+  delete _master;
+  std::string cmd = "rm -rf " + kDBPath;
+  system(cmd.c_str());
+}
+
+// serves the next sync140 of the slave, the seq it asks from
+static std::string accept_sync() {
+  Link *link = _serv->accept();
+  assert(link);
+  const std::vector<Bytes> *req;
+  while (1) {
+    req = link->recv();
+    assert(req);
+    if (!req->empty()) {
+      break;
+    }
+    assert(link->read() > 0);
+  }
+  assert(req->at(0) == "sync140");
+  std::string seq = req->at(1).String();
+  _backend->proc(link);
+  return seq;
+}
+
+// 1 once db has key = val, 0 after 10 seconds
+static int wait_get(SSDB *db, const std::string &key, const std::string &val) {
+  std::string tmp;
+  for (int i = 0; i < 1000; i++) {
+    if (db->get(key, &tmp) == 1 && tmp == val) {
+      return 1;
+    }
+    usleep(10 * 1000);
+  }
+  return 0;
+}
+
+static int wait_hget(SSDB *db, const std::string &name, const std::string &field,
+		     const std::string &val) {
+  std::string tmp;
+  for (int i = 0; i < 1000; i++) {
+    if (db->hget(name, field, &tmp) == 1 && tmp == val) {
+      return 1;
+    }
+    usleep(10 * 1000);
+  }
+  return 0;
+}
+
+void SyncTest_BulkLoad() {
+  SetUp("==== SyncTest_BulkLoad start\n");
+
+  assert(1 == _master->set("k1", "v1"));
+  Slave slave(_slave_db, _meta, kIp, kPort);
+  slave.start();
+  assert("0" == accept_sync());
+  assert(1 == wait_get(_slave_db, "k1", "v1"));
+
+  // the load is in neither the WAL nor the binlog, the barrier after it
+  // makes the slave ask for all the data again
+  assert(1 == _master->bulkload(true));
+  assert(-1 != _master->hset("h1", "a0a1", "5"));
+  assert(1 == _master->bulkload(false));
+  assert("0" == accept_sync());
+  assert(1 == wait_hget(_slave_db, "h1", "a0a1", "5"));
+  assert(1 == wait_get(_slave_db, "k1", "v1"));
+
+  slave.stop();
+  TearDown("\tdone\n");
+}
+
+// what is gone on the master is gone on the slave after it copies again
+void SyncTest_RecopyClears() {
+  SetUp("==== SyncTest_RecopyClears start\n");
+
+  std::string tmp;
+  assert(-1 != _master->hset("h1", "a0a1", "5"));
+  Slave slave(_slave_db, _meta, kIp, kPort);
+  slave.start();
+  assert("0" == accept_sync());
+  assert(1 == wait_hget(_slave_db, "h1", "a0a1", "5"));
+
+  assert(1 == _master->bulkload(true));
+  assert(-1 != _master->hdel("h1", "a0a1"));
+  assert(-1 != _master->hset("h2", "b0b1", "7"));
+  assert(1 == _master->bulkload(false));
+  assert("0" == accept_sync());
+  assert(1 == wait_hget(_slave_db, "h2", "b0b1", "7"));
+  assert(1 != _slave_db->hget("h1", "a0a1", &tmp));
+
+  slave.stop();
+  TearDown("\tdone\n");
+}
+
+int main() {
+  SyncTest_BulkLoad();
+  SyncTest_RecopyClears();
+  return 0;
+}
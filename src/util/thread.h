@@ -12,6 +12,7 @@ found in the LICENSE file.
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <queue>
 #include <vector>
 
@@ -50,6 +51,42 @@ class Locking{
 
 };
 
+// A fixed table of mutexes, a key is always guarded by the same stripe.
+// Lock several stripes in ascending order only, to avoid deadlocks.
+class StripedMutex{
+	private:
+		Mutex *mutexes;
+		int count;
+		// No copying allowed
+		StripedMutex(const StripedMutex&);
+		void operator=(const StripedMutex&);
+	public:
+		StripedMutex(int count=1024){
+			this->count = count;
+			this->mutexes = new Mutex[count];
+		}
+		~StripedMutex(){
+			delete[] mutexes;
+		}
+		int size() const{
+			return count;
+		}
+		// FNV-1a
+		int stripe(const char *data, int len) const{
+			uint32_t h = 2166136261u;
+			for(int i=0; i<len; i++){
+				h = (h ^ (uint8_t)data[i]) * 16777619u;
+			}
+			return h % count;
+		}
+		void lock(int stripe){
+			mutexes[stripe].lock();
+		}
+		void unlock(int stripe){
+			mutexes[stripe].unlock();
+		}
+};
+
 /*
 class Semaphore {
 	private:
@@ -8,20 +8,8 @@ ulimit -n 8192
 echo 1800 > /proc/sys/net/ipv4/tcp_keepalive_time
 
 
-nohup env LD_PRELOAD=libterark-zip-rocksdb-r.so:librocksdb.so \
-    TerarkUseDivSufSort=1 \
-    TerarkZipTable_write_buffer_size=2G \
-    TerarkZipTable_indexNestLevel=4 \
-    TerarkZipTable_indexCacheRatio=0.001 \
-    TerarkZipTable_sampleRatio=0.015 \
-    TerarkZipTable_smallTaskMemory=1G \
-    TerarkZipTable_softZipWorkingMemLimit=16G \
-    TerarkZipTable_hardZipWorkingMemLimit=32G \
-    TerarkZipTable_minDictZipValueSize=1024 \
-    TerarkZipTable_offsetArrayBlockUnits=128 \
-    TerarkZipTable_max_background_flushes=2 \
-    TerarkZipTable_base_background_compactions=2 \
-    TerarkZipTable_max_background_compactions=2 \
+# table format and TerarkZipTable tuning are set in chess.conf
+nohup env TerarkUseDivSufSort=1 \
     TerarkZipTable_extendedConfigFile=/root/.terark_license \
     ./ssdb-server ./chess.conf &
 
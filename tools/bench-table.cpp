@@ -0,0 +1,222 @@
+/*
+Copyright (c) 2012-2015 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+// ssdb-bench table: load the same chess dataset into a block based and a
+// TerarkZipTable data column family, then compare them on disk size,
+// memory and hget/hgetall latency. Runs in process, no server needed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "util/log.h"
+#include "util/bytes.h"
+#include "ssdb/ssdb.h"
+#include "ssdb/options.h"
+
+#include "../src/include.h"
+
+static const char *kPieces = "rnbakcpRNBAKCP";
+
+// a FEN-like board string, the same for a given seed on every run
+static std::string gen_position(int n){
+	char buf[128];
+	int len = 0;
+	srand(n * 2654435761u);
+	for(int rank=0; rank<10; rank++){
+		int empty = 0;
+		for(int file=0; file<9; file++){
+			if(rand() % 3 == 0){
+				if(empty){
+					buf[len++] = '0' + empty;
+					empty = 0;
+				}
+				buf[len++] = kPieces[rand() % 14];
+			}else{
+				empty++;
+			}
+		}
+		if(empty){
+			buf[len++] = '0' + empty;
+		}
+		buf[len++] = (rank < 9)? '/' : ' ';
+	}
+	buf[len++] = (n & 1)? 'b' : 'w';
+	return std::string(buf, len);
+}
+
+// field/score pairs of a position, scores near 0 are the most common
+static void gen_moves(int n, std::vector<std::string> *kvs){
+	kvs->clear();
+	srand(n * 40503u + 1);
+	int count = 1 + rand() % 40;
+	char buf[16];
+	for(int i=0; i<count; i++){
+		snprintf(buf, sizeof(buf), "%c%d%c%d",
+			'a' + rand() % 9, rand() % 10, 'a' + rand() % 9, rand() % 10);
+		kvs->push_back(buf);
+		int score = (rand() % 201 - 100) * (1 + rand() % 4) * (1 + rand() % 4);
+		snprintf(buf, sizeof(buf), "%d", score);
+		kvs->push_back(buf);
+	}
+}
+
+// bytes of the sst files under dir
+static int64_t sst_size(const std::string &dir){
+	int64_t ret = 0;
+	DIR *dp = opendir(dir.c_str());
+	if(!dp){
+		return -1;
+	}
+	struct dirent *ent;
+	while((ent = readdir(dp)) != NULL){
+		std::string name = ent->d_name;
+		if(name.size() < 4 || name.compare(name.size() - 4, 4, ".sst") != 0){
+			continue;
+		}
+		struct stat st;
+		if(stat((dir + "/" + name).c_str(), &st) == 0){
+			ret += st.st_size;
+		}
+	}
+	closedir(dp);
+	return ret;
+}
+
+// resident set size of the process, in bytes
+static int64_t rss(){
+	long pages = 0, resident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if(!fp){
+		return 0;
+	}
+	if(fscanf(fp, "%ld %ld", &pages, &resident) != 2){
+		resident = 0;
+	}
+	fclose(fp);
+	return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static void print_latency(const char *name, std::vector<double> *us){
+	if(us->empty()){
+		return;
+	}
+	std::sort(us->begin(), us->end());
+	size_t n = us->size();
+	printf("    %-8s p50 %8.1f us, p99 %8.1f us, p999 %8.1f us, max %8.1f us\n",
+		name, (*us)[n / 2], (*us)[n * 99 / 100], (*us)[n * 999 / 1000], (*us)[n - 1]);
+}
+
+static int run(const std::string &format, const std::string &dir, int positions, int lookups){
+	struct stat st;
+	if(stat(dir.c_str(), &st) == 0){
+		fprintf(stderr, "%s already exists, remove it first\n", dir.c_str());
+		return -1;
+	}
+	Options opt;
+	opt.table_format = format;
+	opt.binlog = false;
+	opt.position_cache_size = 0;
+
+	int64_t rss_start = rss();
+	SSDB *db = SSDB::open(opt, dir);
+	if(!db){
+		fprintf(stderr, "could not open db: %s\n", dir.c_str());
+		return -1;
+	}
+
+	double stime = millitime();
+	std::vector<std::string> kvs;
+	std::vector<Bytes> req;
+	for(int i=0; i<positions; i++){
+		gen_moves(i, &kvs);
+		req.assign(kvs.begin(), kvs.end());
+		if(db->multi_hset(gen_position(i), req) == -1){
+			fprintf(stderr, "multi_hset error\n");
+			delete db;
+			return -1;
+		}
+	}
+	db->compact();
+	double load_time = millitime() - stime;
+
+	std::vector<double> hget_us, hgetall_us;
+	std::string val;
+	// own generator, gen_*() reseed rand()
+	uint32_t seed = 12345;
+	for(int i=0; i<lookups; i++){
+		seed = seed * 1103515245 + 12345;
+		int n = (seed >> 8) % positions;
+		std::string key = gen_position(n);
+		gen_moves(n, &kvs);
+
+		stime = millitime();
+		db->hget(key, kvs[0], &val);
+		hget_us.push_back((millitime() - stime) * 1000 * 1000);
+
+		stime = millitime();
+		HIterator *it = db->hscan(key, "", "", 2000000000);
+		while(it->next());
+		delete it;
+		hgetall_us.push_back((millitime() - stime) * 1000 * 1000);
+	}
+
+	printf("========== %s ==========\n", format.c_str());
+	printf("    load     %.2f s, %d positions\n", load_time, positions);
+	printf("    sst size %.2f MB\n", sst_size(dir) / 1024.0 / 1024.0);
+	printf("    rss      %.2f MB\n", (rss() - rss_start) / 1024.0 / 1024.0);
+	print_latency("hget", &hget_us);
+	print_latency("hgetall", &hgetall_us);
+
+	delete db;
+	return 0;
+}
+
+void bench_table_usage(const char *prog){
+	printf("    %s table [dir] [positions] [lookups]\n", prog);
+	printf("\n");
+	printf("    Compare block and terark tables in process, under [dir]/block\n");
+	printf("    and [dir]/terark (default ./bench-table), loading [positions]\n");
+	printf("    (default 1000000) and timing [lookups] (default 100000) reads.\n");
+	printf("\n");
+}
+
+int bench_table(int argc, char **argv){
+	std::string dir = "./bench-table";
+	int positions = 1000000;
+	int lookups = 100000;
+	if(argc > 1){
+		dir = argv[1];
+	}
+	if(argc > 2){
+		positions = atoi(argv[2]);
+	}
+	if(argc > 3){
+		lookups = atoi(argv[3]);
+	}
+	if(positions <= 0 || lookups <= 0){
+		bench_table_usage("ssdb-bench");
+		return 1;
+	}
+	mkdir(dir.c_str(), 0755);
+
+	if(run("block", dir + "/block", positions, lookups) == -1){
+		return 1;
+	}
+#ifdef SSDB_WITH_TERARK
+	if(run("terark", dir + "/terark", positions, lookups) == -1){
+		return 1;
+	}
+#else
+	printf("========== terark ==========\n");
+	printf("    skipped, ssdb was built without terark\n");
+#endif
+	printf("\n");
+	return 0;
+}
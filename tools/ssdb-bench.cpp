@@ -29,6 +29,10 @@ std::map<std::string, Data *> *ds;
 Fdevents *fdes;
 std::vector<Link *> *free_links;
 
+// in bench-table.cpp
+int bench_table(int argc, char **argv);
+void bench_table_usage(const char *prog);
+
 
 void welcome(){
 	printf("ssdb-bench - SSDB benchmark tool, %s\n", SSDB_VERSION);
@@ -46,6 +50,7 @@ void usage(int argc, char **argv){
 	printf("    requests    Total number of requests (default 10000)\n");
 	printf("    clients     Number of parallel connections (default 50)\n");
 	printf("\n");
+	bench_table_usage(argv[0]);
 }
 
 void init_data(int num){
@@ -185,6 +190,9 @@ int main(int argc, char **argv){
 	int clients = 50;
 
 	welcome();
+	if(argc > 1 && strcmp("table", argv[1]) == 0){
+		return bench_table(argc - 1, argv + 1);
+	}
 	usage(argc, argv);
 	for(int i=1; i<argc; i++){
 		if(strcmp("-v", argv[i]) == 0){
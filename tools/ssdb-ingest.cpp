@@ -0,0 +1,476 @@
+/*
+Copyright (c) 2012-2015 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+// Build sst files of packed hash values from position,move,score rows,
+// for the ingest command of ssdb-server. Rows are sorted in runs of
+// bounded memory spilled to disk, the runs are merged, the moves of a
+// position are packed into one value, a later row of a move wins.
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <vector>
+#include "rocksdb/db.h"
+#include "rocksdb/sst_file_writer.h"
+#include "util/log.h"
+#include "util/bytes.h"
+#include "ssdb/ssdb.h"
+#include "ssdb/options.h"
+#include "ssdb/const.h"
+#include "ssdb/hash_encoder.h"
+#include "ssdb/chess_merger.h"
+#include "ssdb/position_mirror.h"
+
+void welcome(){
+	printf("ssdb-ingest - build sst files of chess positions for ingest\n");
+	printf("Copyright (c) 2012-2015 ssdb.io\n");
+	printf("\n");
+}
+
+void usage(int argc, char **argv){
+	printf("Usage:\n");
+	printf("    %s [options] input out_dir\n", argv[0]);
+	printf("\n");
+	printf("    input     rows of position,move,score, '-' for stdin, a score\n");
+	printf("              of %s deletes the move, or\n", kDelTag.c_str());
+	printf("              the data dir of an ssdb-dump with -d\n");
+	printf("    out_dir   where the sst files are written, on the file system\n");
+	printf("              of the server data, then run:\n");
+	printf("              ssdb-cli> ingest out_dir/ingest-000001.sst ...\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("    -d        input is an ssdb data dir\n");
+	printf("    -m        write merge operands, moves are added to the stored\n");
+	printf("              positions, instead of replacing them\n");
+	printf("    -c        fold a position and its mirror, leveldb.canonical: mirror\n");
+	printf("    -M mem    memory for sorting in MB, default 1024\n");
+	printf("    -s size   size of an sst file in MB, default 256\n");
+	printf("    -t dir    temp dir of sorted runs, default out_dir\n");
+	printf("\n");
+}
+
+struct Row{
+	std::string key;
+	int move;
+	int16_t score;
+
+	bool operator<(const Row &b) const{
+		return key < b.key;
+	}
+};
+
+// [u16 key size][key][u16 move][i16 score]
+static bool write_row(FILE *fp, const Row &row){
+	uint16_t size = row.key.size();
+	uint16_t move = row.move;
+	return fwrite(&size, sizeof(size), 1, fp) == 1
+		&& fwrite(row.key.data(), 1, size, fp) == size
+		&& fwrite(&move, sizeof(move), 1, fp) == 1
+		&& fwrite(&row.score, sizeof(row.score), 1, fp) == 1;
+}
+
+static bool read_row(FILE *fp, Row *row){
+	uint16_t size, move;
+	if(fread(&size, sizeof(size), 1, fp) != 1){
+		return false;
+	}
+	row->key.resize(size);
+	if(fread(&row->key[0], 1, size, fp) != size
+		|| fread(&move, sizeof(move), 1, fp) != 1
+		|| fread(&row->score, sizeof(row->score), 1, fp) != 1){
+		return false;
+	}
+	row->move = move;
+	return true;
+}
+
+// rows sorted by key in runs of at most mem bytes, stable, so the rows
+// of a key stay in input order within and across runs
+class Sorter{
+public:
+	Sorter(const std::string &dir, size_t mem) : dir(dir), mem(mem), bytes(0){
+	}
+	~Sorter(){
+		for(size_t i=0; i<runs.size(); i++){
+			unlink(runs[i].c_str());
+		}
+	}
+
+	int add(const Row &row){
+		rows.push_back(row);
+		bytes += sizeof(Row) + row.key.size();
+		if(bytes >= mem){
+			return spill();
+		}
+		return 0;
+	}
+
+	int spill(){
+		if(rows.empty()){
+			return 0;
+		}
+		std::stable_sort(rows.begin(), rows.end());
+		char name[32];
+		snprintf(name, sizeof(name), "/run-%06d.tmp", (int)runs.size());
+		std::string path = dir + name;
+		FILE *fp = fopen(path.c_str(), "wb");
+		if(!fp){
+			fprintf(stderr, "error creating %s\n", path.c_str());
+			return -1;
+		}
+		runs.push_back(path);
+		for(size_t i=0; i<rows.size(); i++){
+			if(!write_row(fp, rows[i])){
+				fprintf(stderr, "error writing %s\n", path.c_str());
+				fclose(fp);
+				return -1;
+			}
+		}
+		fclose(fp);
+		log_info("sorted run %d, %d rows", (int)runs.size(), (int)rows.size());
+		rows.clear();
+		bytes = 0;
+		return 0;
+	}
+
+	const std::vector<std::string>& files() const{
+		return runs;
+	}
+
+private:
+	std::string dir;
+	size_t mem;
+	size_t bytes;
+	std::vector<Row> rows;
+	std::vector<std::string> runs;
+};
+
+// sst files of at most max_size bytes, a position is never split
+class SstOutput{
+public:
+	SstOutput(const std::string &dir, uint64_t max_size, bool merge)
+		: entries(0), writer(rocksdb::EnvOptions(), rocksdb::Options()),
+		dir(dir), max_size(max_size), merge(merge), opened(false){
+	}
+
+	int add(const std::string &key, const std::string &value){
+		if(opened && writer.FileSize() >= max_size && finish() == -1){
+			return -1;
+		}
+		if(!opened){
+			char name[32];
+			snprintf(name, sizeof(name), "/ingest-%06d.sst", (int)files.size() + 1);
+			std::string path = dir + name;
+			rocksdb::Status s = writer.Open(path);
+			if(!s.ok()){
+				fprintf(stderr, "error creating %s: %s\n", path.c_str(), s.ToString().c_str());
+				return -1;
+			}
+			files.push_back(path);
+			opened = true;
+		}
+		rocksdb::Status s = merge? writer.Merge(key, value) : writer.Put(key, value);
+		if(!s.ok()){
+			fprintf(stderr, "error writing %s: %s\n", files.back().c_str(), s.ToString().c_str());
+			return -1;
+		}
+		entries++;
+		return 0;
+	}
+
+	int finish(){
+		if(!opened){
+			return 0;
+		}
+		opened = false;
+		rocksdb::Status s = writer.Finish();
+		if(!s.ok()){
+			fprintf(stderr, "error writing %s: %s\n", files.back().c_str(), s.ToString().c_str());
+			return -1;
+		}
+		log_info("written %s", files.back().c_str());
+		return 0;
+	}
+
+	std::vector<std::string> files;
+	int64_t entries;
+private:
+	rocksdb::SstFileWriter writer;
+	std::string dir;
+	uint64_t max_size;
+	bool merge;
+	bool opened;
+};
+
+struct Args{
+	std::string input;
+	std::string out_dir;
+	std::string temp_dir;
+	bool dump;
+	bool merge;
+	bool canonical;
+	int mem;
+	int sst_size;
+};
+
+struct Stats{
+	int64_t rows;
+	int64_t invalid;
+};
+
+static ChessHashEncoder encoder;
+static FenMirror mirror;
+
+static int add_row(const Args &args, Sorter *sorter, Stats *stats,
+	const Bytes &name, int move, int16_t score)
+{
+	std::string stored;
+	if(args.canonical && mirror.canonical(name, &stored) == 1){
+		move = ChessHashEncoder::mirror_move(move);
+	}else{
+		stored = name.String();
+	}
+	if(stored.empty() || stored.size() > SSDB_KEY_LEN_MAX){
+		stats->invalid++;
+		return 0;
+	}
+	Row row;
+	row.key = encoder.encode_key(stored);
+	row.move = move;
+	row.score = score;
+	stats->rows++;
+	return sorter->add(row);
+}
+
+// position,move,score, or tab separated, the position is all before the
+// last two separators
+static int read_csv(const Args &args, Sorter *sorter, Stats *stats){
+	FILE *fp = (args.input == "-")? stdin : fopen(args.input.c_str(), "r");
+	if(!fp){
+		fprintf(stderr, "error opening %s\n", args.input.c_str());
+		return -1;
+	}
+	char line[1024];
+	int ret = 0;
+	while(ret == 0 && fgets(line, sizeof(line), fp)){
+		int len = strlen(line);
+		while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')){
+			line[--len] = '\0';
+		}
+		if(len == 0){
+			continue;
+		}
+		char *score_p = strrchr(line, ',');
+		if(!score_p){
+			score_p = strrchr(line, '\t');
+		}
+		char *move_p = NULL;
+		if(score_p){
+			*score_p++ = '\0';
+			move_p = std::max(strrchr(line, ','), strrchr(line, '\t'));
+		}
+		if(!move_p){
+			stats->invalid++;
+			continue;
+		}
+		*move_p++ = '\0';
+		int move = ChessHashEncoder::move_id(Bytes(move_p, strlen(move_p)));
+		char *end;
+		long score = strtol(score_p, &end, 10);
+		// kDelTag deletes the move, as with hset
+		if(move == -1 || end == score_p || *end != '\0'
+			|| (score != kDelScore && (score < -kScoreMax || score > kScoreMax))){
+			stats->invalid++;
+			continue;
+		}
+		ret = add_row(args, sorter, stats, Bytes(line, move_p - 1 - line), move, score);
+	}
+	if(fp != stdin){
+		fclose(fp);
+	}
+	return ret;
+}
+
+// the positions of a data dir, e.g. of another server, as rows, so they
+// are folded like the others
+static int read_dump(const Args &args, Sorter *sorter, Stats *stats){
+	Options option;
+	SSDB *db = SSDB::open(option, args.input);
+	if(!db){
+		fprintf(stderr, "could not open data db: %s\n", args.input.c_str());
+		return -1;
+	}
+	std::string start(1, DataType::HASH);
+	std::string end(1, DataType::HASH + 1);
+	Iterator *it = db->iterator(start, end, UINT64_MAX);
+	int ret = 0;
+	while(ret == 0 && it->next()){
+		Bytes ks = it->key();
+		Bytes vs = it->val();
+		if(ks.empty() || ks.data()[0] != DataType::HASH){
+			continue;
+		}
+		std::string name;
+		if(encoder.decode_key(ks, &name) == -1){
+			stats->invalid++;
+			continue;
+		}
+		std::vector<std::pair<int, int16_t> > moves;
+		int err = ChessHashEncoder::for_each_entry(vs.data(), vs.size(), [&moves](int move, int16_t score, int op){
+			if(op == kOpSet && score != kDelScore){
+				moves.push_back(std::make_pair(move, score));
+			}
+		});
+		if(err == -1){
+			stats->invalid++;
+			continue;
+		}
+		for(size_t i=0; i<moves.size() && ret == 0; i++){
+			ret = add_row(args, sorter, stats, name, moves[i].first, moves[i].second);
+		}
+	}
+	delete it;
+	delete db;
+	return ret;
+}
+
+struct Head{
+	Row row;
+	size_t run;
+
+	// the smallest key first, of the earliest run on ties
+	bool operator<(const Head &b) const{
+		int c = row.key.compare(b.row.key);
+		return c > 0 || (c == 0 && run > b.run);
+	}
+};
+
+// a position as one value, without the deleted moves, or as one
+// operand, with them, so they are deleted from the stored position
+static int merge_runs(const Sorter &sorter, SstOutput *output, bool merge, int64_t *positions){
+	const std::vector<std::string> &runs = sorter.files();
+	std::vector<FILE *> fps;
+	std::priority_queue<Head> heap;
+	int ret = 0;
+	for(size_t i=0; i<runs.size(); i++){
+		FILE *fp = fopen(runs[i].c_str(), "rb");
+		if(!fp){
+			fprintf(stderr, "error opening %s\n", runs[i].c_str());
+			ret = -1;
+			break;
+		}
+		setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+		fps.push_back(fp);
+		Head head;
+		head.run = i;
+		if(read_row(fp, &head.row)){
+			heap.push(head);
+		}
+	}
+
+	MoveSlots *slots = MoveSlots::local();
+	std::string key, value;
+	while(ret == 0 && !heap.empty()){
+		Head head = heap.top();
+		heap.pop();
+		if(head.row.key != key){
+			if(!key.empty()){
+				slots->encode(!merge, &value);
+				if(!value.empty()){
+					ret = output->add(key, value);
+					(*positions)++;
+				}
+			}
+			key = head.row.key;
+			slots->reset();
+		}
+		slots->add(head.row.move, head.row.score);
+		if(read_row(fps[head.run], &head.row)){
+			heap.push(head);
+		}
+	}
+	if(ret == 0 && !key.empty()){
+		slots->encode(!merge, &value);
+		if(!value.empty()){
+			ret = output->add(key, value);
+			(*positions)++;
+		}
+	}
+	for(size_t i=0; i<fps.size(); i++){
+		fclose(fps[i]);
+	}
+	if(ret == 0){
+		ret = output->finish();
+	}
+	return ret;
+}
+
+int main(int argc, char **argv){
+	welcome();
+	Args args;
+	args.dump = false;
+	args.merge = false;
+	args.canonical = false;
+	args.mem = 1024;
+	args.sst_size = 256;
+	int opt;
+	while((opt = getopt(argc, argv, "dmcM:s:t:h")) != -1){
+		switch(opt){
+			case 'd': args.dump = true; break;
+			case 'm': args.merge = true; break;
+			case 'c': args.canonical = true; break;
+			case 'M': args.mem = atoi(optarg); break;
+			case 's': args.sst_size = atoi(optarg); break;
+			case 't': args.temp_dir = optarg; break;
+			default:
+				usage(argc, argv);
+				return 1;
+		}
+	}
+	if(argc - optind != 2 || args.mem <= 0 || args.sst_size <= 0){
+		usage(argc, argv);
+		return 1;
+	}
+	args.input = argv[optind];
+	args.out_dir = argv[optind + 1];
+	if(args.temp_dir.empty()){
+		args.temp_dir = args.out_dir;
+	}
+	mkdir(args.out_dir.c_str(), 0755);
+	mkdir(args.temp_dir.c_str(), 0755);
+
+	Stats stats;
+	stats.rows = 0;
+	stats.invalid = 0;
+	Sorter sorter(args.temp_dir, (size_t)args.mem * 1024 * 1024);
+	int ret = args.dump? read_dump(args, &sorter, &stats) : read_csv(args, &sorter, &stats);
+	if(ret == 0){
+		ret = sorter.spill();
+	}
+	SstOutput output(args.out_dir, (uint64_t)args.sst_size * 1024 * 1024, args.merge);
+	int64_t positions = 0;
+	if(ret == 0){
+		ret = merge_runs(sorter, &output, args.merge, &positions);
+	}
+	if(ret == -1){
+		return 1;
+	}
+
+	printf("rows %" PRId64 ", invalid %" PRId64 ", positions %" PRId64 ", files %d\n",
+		stats.rows, stats.invalid, positions, (int)output.files.size());
+	if(!output.files.empty()){
+		printf("ingest");
+		for(size_t i=0; i<output.files.size(); i++){
+			printf(" %s", output.files[i].c_str());
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2012-2015 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+// Fold positions stored before leveldb.canonical was set to mirror: the
+// fields of every position that is the mirror of its stored name are
+// mirrored into the stored one, the mirrored copy is deleted. Run with
+// the server stopped, on the master and every slave, the folding is not
+// written to the binlog.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "util/log.h"
+#include "util/config.h"
+#include "ssdb/ssdb.h"
+#include "ssdb/options.h"
+#include "ssdb/const.h"
+#include "ssdb/chess_merger.h"
+#include "ssdb/hash_value_view.h"
+#include "ssdb/position_mirror.h"
+
+void welcome(){
+	printf("ssdb-mirror-fold - fold mirrored positions of a stopped ssdb-server\n");
+	printf("Copyright (c) 2012-2015 ssdb.io\n");
+	printf("\n");
+}
+
+void usage(int argc, char **argv){
+	printf("Usage:\n");
+	printf("    %s ssdb.conf\n", argv[0]);
+	printf("\n");
+}
+
+// the fields of the stored position first, they win over the mirrored
+// ones, deleted fields are dropped
+static int fold(const Bytes &stored_val, const Bytes &mirrored_val, std::string *out){
+	HashValueView stored, mirrored;
+	if(stored.assign(stored_val) == -1 || mirrored.assign(mirrored_val) == -1){
+		return -1;
+	}
+	MoveSlots *slots = MoveSlots::local();
+	slots->reset();
+	for(int i=0; i<stored.count(); i++){
+		slots->add(stored.move(i), stored.score(i));
+	}
+	for(int i=0; i<mirrored.count(); i++){
+		slots->add(ChessHashEncoder::mirror_move(mirrored.move(i)), mirrored.score(i));
+	}
+	slots->encode(true, out);
+	return 0;
+}
+
+int main(int argc, char **argv){
+	welcome();
+	if(argc != 2){
+		usage(argc, argv);
+		return 1;
+	}
+	Config *conf = Config::load(argv[1]);
+	if(!conf){
+		fprintf(stderr, "error loading conf file: '%s'\n", argv[1]);
+		return 1;
+	}
+	std::string work_dir = conf->get_str("work_dir");
+	if(work_dir.empty()){
+		work_dir = ".";
+	}
+	Options option;
+	option.load(*conf);
+	delete conf;
+
+	SSDB *db = SSDB::open(option, work_dir + "/data");
+	if(!db){
+		fprintf(stderr, "could not open data db: %s/data\n", work_dir.c_str());
+		return 1;
+	}
+
+	ChessHashEncoder encoder;
+	FenMirror mirror;
+	int64_t scanned = 0, folded = 0, merged = 0, errors = 0;
+	std::string start(1, DataType::HASH);
+	std::string end(1, DataType::HASH + 1);
+	Iterator *it = db->iterator(start, end, UINT64_MAX);
+	while(it->next()){
+		Bytes ks = it->key();
+		if(ks.empty() || ks.data()[0] != DataType::HASH){
+			continue;
+		}
+		scanned++;
+		std::string name, stored;
+		if(encoder.decode_key(ks, &name) == -1 || mirror.canonical(name, &stored) == 0){
+			continue;
+		}
+		std::string stored_key = encoder.encode_key(stored);
+		std::string stored_val, value;
+		int ret = db->raw_get(stored_key, &stored_val);
+		if(ret == 1){
+			merged++;
+		}
+		if(ret == -1 || fold(stored_val, it->val(), &value) == -1){
+			log_error("bad hash value of %s", hexmem(ks.data(), ks.size()).c_str());
+			errors++;
+			continue;
+		}
+		if((value.empty()? db->raw_del(stored_key) : db->raw_set(stored_key, value)) == -1 ||
+			db->raw_del(ks) == -1){
+			errors++;
+			break;
+		}
+		folded++;
+	}
+	delete it;
+	delete db;
+
+	printf("scanned %" PRId64 ", folded %" PRId64 " (%" PRId64 " into an existing position), errors %" PRId64 "\n",
+		scanned, folded, merged, errors);
+	return errors? 1 : 0;
+}
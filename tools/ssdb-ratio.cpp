@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2012-2015 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+// Report the compression ratio achieved by each column family of an ssdb
+// data dir, from the properties of its tables. Opens the db read only,
+// the server may be running.
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "rocksdb/db.h"
+#include "rocksdb/options.h"
+#include "rocksdb/table_properties.h"
+#include "util/config.h"
+
+void welcome(){
+	printf("ssdb-ratio - compression ratio of an ssdb data dir\n");
+	printf("Copyright (c) 2012-2015 ssdb.io\n");
+	printf("\n");
+}
+
+void usage(int argc, char **argv){
+	printf("Usage:\n");
+	printf("    %s ssdb.conf\n", argv[0]);
+	printf("\n");
+}
+
+static double mb(uint64_t bytes){
+	return bytes / 1024.0 / 1024.0;
+}
+
+static void report(rocksdb::DB *db, rocksdb::ColumnFamilyHandle *cf){
+	rocksdb::TablePropertiesCollection tables;
+	rocksdb::Status s = db->GetPropertiesOfAllTables(cf, &tables);
+	if(!s.ok()){
+		fprintf(stderr, "%s: %s\n", cf->GetName().c_str(), s.ToString().c_str());
+		return;
+	}
+	uint64_t entries = 0, raw = 0, data = 0, meta = 0;
+	std::set<std::string> compressions;
+	for(rocksdb::TablePropertiesCollection::const_iterator it = tables.begin(); it != tables.end(); it++){
+		const rocksdb::TableProperties &p = *it->second;
+		entries += p.num_entries;
+		raw += p.raw_key_size + p.raw_value_size;
+		data += p.data_size;
+		meta += p.index_size + p.filter_size;
+		compressions.insert(p.compression_name);
+	}
+	printf("========== %s ==========\n", cf->GetName().c_str());
+	printf("    tables      %d, %" PRIu64 " entries\n", (int)tables.size(), entries);
+	printf("    raw         %.2f MB\n", mb(raw));
+	printf("    data blocks %.2f MB\n", mb(data));
+	printf("    index+bloom %.2f MB\n", mb(meta));
+	printf("    ratio       %.2f\n", data? (double)raw / data : 0.0);
+	std::string names;
+	for(std::set<std::string>::const_iterator it = compressions.begin(); it != compressions.end(); it++){
+		names += names.empty()? *it : ", " + *it;
+	}
+	printf("    compression %s\n", names.c_str());
+	// dictionary settings of a table, the same for all tables written
+	// with the same options
+	if(!tables.empty()){
+		printf("    options     %s\n", tables.begin()->second->compression_options.c_str());
+	}
+}
+
+int main(int argc, char **argv){
+	welcome();
+	if(argc != 2){
+		usage(argc, argv);
+		return 1;
+	}
+	Config *conf = Config::load(argv[1]);
+	if(!conf){
+		fprintf(stderr, "error loading conf file: '%s'\n", argv[1]);
+		return 1;
+	}
+	std::string work_dir = conf->get_str("work_dir");
+	if(work_dir.empty()){
+		work_dir = ".";
+	}
+	delete conf;
+	std::string dir = work_dir + "/data";
+
+	rocksdb::Options options;
+	std::vector<std::string> names;
+	rocksdb::Status s = rocksdb::DB::ListColumnFamilies(options, dir, &names);
+	if(!s.ok()){
+		fprintf(stderr, "could not open data db: %s, %s\n", dir.c_str(), s.ToString().c_str());
+		return 1;
+	}
+	// default options, so only block based tables are read, not the
+	// ones of table_format terark
+	std::vector<rocksdb::ColumnFamilyDescriptor> descriptors;
+	for(size_t i=0; i<names.size(); i++){
+		descriptors.push_back(rocksdb::ColumnFamilyDescriptor(names[i], rocksdb::ColumnFamilyOptions()));
+	}
+	rocksdb::DB *db = NULL;
+	std::vector<rocksdb::ColumnFamilyHandle*> handles;
+	s = rocksdb::DB::OpenForReadOnly(options, dir, descriptors, &handles, &db);
+	if(!s.ok()){
+		fprintf(stderr, "could not open data db: %s, %s\n", dir.c_str(), s.ToString().c_str());
+		return 1;
+	}
+	for(size_t i=0; i<handles.size(); i++){
+		report(db, handles[i]);
+		db->DestroyColumnFamilyHandle(handles[i]);
+	}
+	printf("\n");
+	delete db;
+	return 0;
+}